@@ -51,13 +51,28 @@ ChanACL::ChanACL(Channel *chan) : QObject(chan) {
 		c->qlACL << this;
 }
 
+const QString &ChanACL::group() const {
+	return qsGroup;
+}
+
+void ChanACL::setGroup(const QString &group) {
+	qsGroup = group;
+#ifdef MURMUR
+	gpGroup = GroupPredicate(group);
+#endif
+}
+
+#ifdef MURMUR
+
+const GroupPredicate &ChanACL::groupPredicate() const {
+	return gpGroup;
+}
+
 // Check permissions.
 // This will always return true for the superuser,
 // and will return false if a user isn't allowed to
 // traverse to the channel. (Need "read" in all preceeding channels)
 
-#ifdef MURMUR
-
 bool ChanACL::hasPermission(ServerUser *p, Channel *chan, QFlags<Perm> perm, ACLCache *cache) {
 	Permissions granted = effectivePermissions(p, chan, cache);
 
@@ -107,7 +122,7 @@ QFlags<ChanACL::Perm> ChanACL::effectivePermissions(ServerUser *p, Channel *chan
 
 		foreach(acl, ch->qlACL) {
 			bool matchUser = (acl->iUserId != -1) && (acl->iUserId == p->iId);
-			bool matchGroup = Group::isMember(chan, ch, acl->qsGroup, p);
+			bool matchGroup = Group::isMember(chan, ch, acl->gpGroup, p);
 			if (matchUser || matchGroup) {
 				if (acl->pAllow & Traverse)
 					traverse = true;
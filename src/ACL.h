@@ -34,6 +34,10 @@
 #include <QtCore/QHash>
 #include <QtCore/QObject>
 
+#ifdef MURMUR
+#include "Group.h"
+#endif
+
 class Channel;
 class User;
 class ServerUser;
@@ -79,12 +83,17 @@ class ChanACL : public QObject {
 		bool bInherited;
 
 		int iUserId;
-		QString qsGroup;
 		Permissions pAllow;
 		Permissions pDeny;
 
 		ChanACL(Channel *c);
+
+		const QString &group() const;
+		void setGroup(const QString &group);
 #ifdef MURMUR
+		/// group() compiled by setGroup(); this is what effectivePermissions() evaluates.
+		const GroupPredicate &groupPredicate() const;
+
 		static bool hasPermission(ServerUser *p, Channel *c, QFlags<Perm> perm, ACLCache *cache);
 		static QFlags<Perm> effectivePermissions(ServerUser *p, Channel *c, ACLCache *cache);
 #else
@@ -92,6 +101,11 @@ class ChanACL : public QObject {
 #endif
 		static QString permName(QFlags<Perm> p);
 		static QString permName(Perm p);
+	private:
+		QString qsGroup;
+#ifdef MURMUR
+		GroupPredicate gpGroup;
+#endif
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(ChanACL::Permissions)
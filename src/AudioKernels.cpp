@@ -0,0 +1,538 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "murmur_pch.h"
+
+#include "AudioKernels.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <cpuid.h>
+#include <immintrin.h>
+#define KERNELS_X86
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#if defined(__clang__) || (__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9))
+#define KERNELS_AVX2
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#include <immintrin.h>
+#define KERNELS_X86
+#define TARGET_SSE2
+#if _MSC_VER >= 1700
+#define KERNELS_AVX2
+#define TARGET_AVX2
+#endif
+#endif
+
+static int iLimit = AudioKernels::AVX2;
+
+// Scalar versions, also used for the tails the vector loops leave.
+
+static void mixFloat1(float * RESTRICT buffer, const void * RESTRICT ipt, unsigned int nsamp, unsigned int) {
+	memcpy(buffer, ipt, nsamp * sizeof(float));
+}
+
+static void mixFloat2Scalar(float * RESTRICT buffer, const float * RESTRICT input, unsigned int nsamp) {
+	for (unsigned int i = 0; i < nsamp; ++i)
+		buffer[i] = (input[2 * i] + input[2 * i + 1]) * 0.5f;
+}
+
+static void mixShort2Scalar(float * RESTRICT buffer, const short * RESTRICT input, unsigned int nsamp) {
+	const float m = 1.0f / 65536.f;
+	for (unsigned int i = 0; i < nsamp; ++i)
+		buffer[i] = (static_cast<float>(input[2 * i]) + static_cast<float>(input[2 * i + 1])) * m;
+}
+
+static void mixFloatNScalar(float * RESTRICT buffer, const float * RESTRICT input, unsigned int nsamp, unsigned int nchan) {
+	const float m = 1.0f / static_cast<float>(nchan);
+	for (unsigned int i = 0; i < nsamp; ++i) {
+		float v = 0.0f;
+		for (unsigned int j = 0; j < nchan; ++j)
+			v += input[i * nchan + j];
+		buffer[i] = v * m;
+	}
+}
+
+static void mixShortNScalar(float * RESTRICT buffer, const short * RESTRICT input, unsigned int nsamp, unsigned int nchan) {
+	const float m = 1.0f / (32768.f * static_cast<float>(nchan));
+	for (unsigned int i = 0; i < nsamp; ++i) {
+		float v = 0.0f;
+		for (unsigned int j = 0; j < nchan; ++j)
+			v += static_cast<float>(input[i * nchan + j]);
+		buffer[i] = v * m;
+	}
+}
+
+static void shortToFloatScalar(float * RESTRICT dst, const short * RESTRICT src, unsigned int n) {
+	const float m = 1.0f / 32768.f;
+	for (unsigned int i = 0; i < n; ++i)
+		dst[i] = static_cast<float>(src[i]) * m;
+}
+
+static void floatToShortScalar(short * RESTRICT dst, const float * RESTRICT src, unsigned int n) {
+	for (unsigned int i = 0; i < n; ++i)
+		dst[i] = static_cast<short>(qBound(-32768.f, src[i] * 32768.f, 32767.f));
+}
+
+static void clipScalar(float *buffer, unsigned int n) {
+	for (unsigned int i = 0; i < n; ++i)
+		buffer[i] = qBound(-1.0f, buffer[i], 1.0f);
+}
+
+static void mixAddScalar(float * RESTRICT dst, const float * RESTRICT src, float gain, unsigned int n) {
+	for (unsigned int i = 0; i < n; ++i)
+		dst[i] += src[i] * gain;
+}
+
+static void mixRampScalar(float * RESTRICT dst, const float * RESTRICT src, float gain, float inc, unsigned int first, unsigned int n) {
+	for (unsigned int i = first; i < n; ++i)
+		dst[i] += src[i] * (gain + inc * static_cast<float>(i));
+}
+
+static void interleave2Scalar(float * RESTRICT dst, const float * RESTRICT left, const float * RESTRICT right, unsigned int n) {
+	for (unsigned int i = 0; i < n; ++i) {
+		dst[2 * i] = left[i];
+		dst[2 * i + 1] = right[i];
+	}
+}
+
+#ifdef KERNELS_X86
+TARGET_SSE2 static void mixFloat2SSE2(float * RESTRICT buffer, const float * RESTRICT input, unsigned int nsamp) {
+	const __m128 half = _mm_set1_ps(0.5f);
+	unsigned int i = 0;
+	for (; i + 4 <= nsamp; i += 4) {
+		const __m128 a = _mm_loadu_ps(input + 2 * i);
+		const __m128 b = _mm_loadu_ps(input + 2 * i + 4);
+		const __m128 left = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		const __m128 right = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+		_mm_storeu_ps(buffer + i, _mm_mul_ps(_mm_add_ps(left, right), half));
+	}
+	mixFloat2Scalar(buffer + i, input + 2 * i, nsamp - i);
+}
+
+TARGET_SSE2 static void mixShort2SSE2(float * RESTRICT buffer, const short * RESTRICT input, unsigned int nsamp) {
+	const __m128i ones = _mm_set1_epi16(1);
+	const __m128 m = _mm_set1_ps(1.0f / 65536.f);
+	unsigned int i = 0;
+	for (; i + 4 <= nsamp; i += 4) {
+		// Multiply-add against ones sums each left/right pair into 32 bits
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + 2 * i));
+		_mm_storeu_ps(buffer + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_madd_epi16(v, ones)), m));
+	}
+	mixShort2Scalar(buffer + i, input + 2 * i, nsamp - i);
+}
+
+// Any channel count: four frames at a time, each block of four channels is
+// transposed so every row holds one channel, and the rows are summed in
+// channel order to give the same result as the scalar loop.
+TARGET_SSE2 static void mixFloatNSSE2(float * RESTRICT buffer, const float * RESTRICT input, unsigned int nsamp, unsigned int nchan) {
+	const __m128 m = _mm_set1_ps(1.0f / static_cast<float>(nchan));
+	unsigned int i = 0;
+	for (; i + 4 <= nsamp; i += 4) {
+		const float *f0 = input + i * nchan;
+		const float *f1 = f0 + nchan;
+		const float *f2 = f1 + nchan;
+		const float *f3 = f2 + nchan;
+		__m128 acc = _mm_setzero_ps();
+		unsigned int j = 0;
+		for (; j + 4 <= nchan; j += 4) {
+			__m128 r0 = _mm_loadu_ps(f0 + j);
+			__m128 r1 = _mm_loadu_ps(f1 + j);
+			__m128 r2 = _mm_loadu_ps(f2 + j);
+			__m128 r3 = _mm_loadu_ps(f3 + j);
+			_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+			acc = _mm_add_ps(acc, r0);
+			acc = _mm_add_ps(acc, r1);
+			acc = _mm_add_ps(acc, r2);
+			acc = _mm_add_ps(acc, r3);
+		}
+		for (; j < nchan; ++j)
+			acc = _mm_add_ps(acc, _mm_setr_ps(f0[j], f1[j], f2[j], f3[j]));
+		_mm_storeu_ps(buffer + i, _mm_mul_ps(acc, m));
+	}
+	mixFloatNScalar(buffer + i, input + i * nchan, nsamp - i, nchan);
+}
+
+// Same layout as mixFloatNSSE2; the sums are exact in 32 bits, like the
+// float sums of the scalar version.
+TARGET_SSE2 static void mixShortNSSE2(float * RESTRICT buffer, const short * RESTRICT input, unsigned int nsamp, unsigned int nchan) {
+	const __m128 m = _mm_set1_ps(1.0f / (32768.f * static_cast<float>(nchan)));
+	unsigned int i = 0;
+	for (; i + 4 <= nsamp; i += 4) {
+		const short *s0 = input + i * nchan;
+		const short *s1 = s0 + nchan;
+		const short *s2 = s1 + nchan;
+		const short *s3 = s2 + nchan;
+		__m128i acc = _mm_setzero_si128();
+		unsigned int j = 0;
+		for (; j + 4 <= nchan; j += 4) {
+			const __m128i v0 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(s0 + j));
+			const __m128i v1 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(s1 + j));
+			const __m128i v2 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(s2 + j));
+			const __m128i v3 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(s3 + j));
+			__m128 r0 = _mm_castsi128_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v0, v0), 16));
+			__m128 r1 = _mm_castsi128_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v1, v1), 16));
+			__m128 r2 = _mm_castsi128_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v2, v2), 16));
+			__m128 r3 = _mm_castsi128_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v3, v3), 16));
+			_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+			acc = _mm_add_epi32(acc, _mm_castps_si128(r0));
+			acc = _mm_add_epi32(acc, _mm_castps_si128(r1));
+			acc = _mm_add_epi32(acc, _mm_castps_si128(r2));
+			acc = _mm_add_epi32(acc, _mm_castps_si128(r3));
+		}
+		for (; j < nchan; ++j)
+			acc = _mm_add_epi32(acc, _mm_setr_epi32(s0[j], s1[j], s2[j], s3[j]));
+		_mm_storeu_ps(buffer + i, _mm_mul_ps(_mm_cvtepi32_ps(acc), m));
+	}
+	mixShortNScalar(buffer + i, input + i * nchan, nsamp - i, nchan);
+}
+
+TARGET_SSE2 static void shortToFloatSSE2(float * RESTRICT dst, const short * RESTRICT src, unsigned int n) {
+	const __m128 m = _mm_set1_ps(1.0f / 32768.f);
+	unsigned int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+		const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), m));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), m));
+	}
+	shortToFloatScalar(dst + i, src + i, n - i);
+}
+
+TARGET_SSE2 static void floatToShortSSE2(short * RESTRICT dst, const float * RESTRICT src, unsigned int n) {
+	const __m128 mul = _mm_set1_ps(32768.f);
+	const __m128 lo = _mm_set1_ps(-32768.f);
+	const __m128 hi = _mm_set1_ps(32767.f);
+	unsigned int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i), mul), lo), hi);
+		const __m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i + 4), mul), lo), hi);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b)));
+	}
+	floatToShortScalar(dst + i, src + i, n - i);
+}
+
+TARGET_SSE2 static void clipSSE2(float *buffer, unsigned int n) {
+	const __m128 lo = _mm_set1_ps(-1.0f);
+	const __m128 hi = _mm_set1_ps(1.0f);
+	unsigned int i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(buffer + i, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(buffer + i), lo), hi));
+	clipScalar(buffer + i, n - i);
+}
+
+TARGET_SSE2 static void mixAddSSE2(float * RESTRICT dst, const float * RESTRICT src, float gain, unsigned int n) {
+	const __m128 g = _mm_set1_ps(gain);
+	unsigned int i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), g)));
+	mixAddScalar(dst + i, src + i, gain, n - i);
+}
+
+TARGET_SSE2 static void mixRampSSE2(float * RESTRICT dst, const float * RESTRICT src, float gain, float inc, unsigned int n) {
+	const __m128 g = _mm_set1_ps(gain);
+	const __m128 d = _mm_set1_ps(inc);
+	const __m128 step = _mm_set1_ps(4.0f);
+	__m128 idx = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	unsigned int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const __m128 gains = _mm_add_ps(g, _mm_mul_ps(d, idx));
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), gains)));
+		idx = _mm_add_ps(idx, step);
+	}
+	mixRampScalar(dst, src, gain, inc, i, n);
+}
+
+TARGET_SSE2 static void interleave2SSE2(float * RESTRICT dst, const float * RESTRICT left, const float * RESTRICT right, unsigned int n) {
+	unsigned int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const __m128 l = _mm_loadu_ps(left + i);
+		const __m128 r = _mm_loadu_ps(right + i);
+		_mm_storeu_ps(dst + 2 * i, _mm_unpacklo_ps(l, r));
+		_mm_storeu_ps(dst + 2 * i + 4, _mm_unpackhi_ps(l, r));
+	}
+	interleave2Scalar(dst + 2 * i, left + i, right + i, n - i);
+}
+#endif
+
+#ifdef KERNELS_AVX2
+// Deinterleaving floats needs a lane crossing shuffle in AVX2, which ends up
+// slower than the 128 bit version (see tests/MixKernels).
+static void mixFloat2AVX2(float * RESTRICT buffer, const float * RESTRICT input, unsigned int nsamp) {
+	mixFloat2SSE2(buffer, input, nsamp);
+}
+
+// The 4x4 transposes have no cheaper 256 bit equivalent, so more than two
+// channels use the 128 bit versions.
+static void mixFloatNAVX2(float * RESTRICT buffer, const float * RESTRICT input, unsigned int nsamp, unsigned int nchan) {
+	mixFloatNSSE2(buffer, input, nsamp, nchan);
+}
+
+static void mixShortNAVX2(float * RESTRICT buffer, const short * RESTRICT input, unsigned int nsamp, unsigned int nchan) {
+	mixShortNSSE2(buffer, input, nsamp, nchan);
+}
+
+TARGET_AVX2 static void mixShort2AVX2(float * RESTRICT buffer, const short * RESTRICT input, unsigned int nsamp) {
+	const __m256i ones = _mm256_set1_epi16(1);
+	const __m256 m = _mm256_set1_ps(1.0f / 65536.f);
+	unsigned int i = 0;
+	for (; i + 8 <= nsamp; i += 8) {
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(input + 2 * i));
+		_mm256_storeu_ps(buffer + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_madd_epi16(v, ones)), m));
+	}
+	mixShort2SSE2(buffer + i, input + 2 * i, nsamp - i);
+}
+
+TARGET_AVX2 static void shortToFloatAVX2(float * RESTRICT dst, const short * RESTRICT src, unsigned int n) {
+	const __m256 m = _mm256_set1_ps(1.0f / 32768.f);
+	unsigned int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i)));
+		_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), m));
+	}
+	shortToFloatScalar(dst + i, src + i, n - i);
+}
+
+TARGET_AVX2 static void floatToShortAVX2(short * RESTRICT dst, const float * RESTRICT src, unsigned int n) {
+	const __m256 mul = _mm256_set1_ps(32768.f);
+	const __m256 lo = _mm256_set1_ps(-32768.f);
+	const __m256 hi = _mm256_set1_ps(32767.f);
+	unsigned int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i), mul), lo), hi);
+		const __m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i + 8), mul), lo), hi);
+		// packs works per 128 bit lane, so the quarters come out as a0 b0 a1 b1
+		const __m256i packed = _mm256_packs_epi32(_mm256_cvttps_epi32(a), _mm256_cvttps_epi32(b));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+	floatToShortSSE2(dst + i, src + i, n - i);
+}
+
+TARGET_AVX2 static void clipAVX2(float *buffer, unsigned int n) {
+	const __m256 lo = _mm256_set1_ps(-1.0f);
+	const __m256 hi = _mm256_set1_ps(1.0f);
+	unsigned int i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(buffer + i, _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(buffer + i), lo), hi));
+	clipScalar(buffer + i, n - i);
+}
+
+TARGET_AVX2 static void mixAddAVX2(float * RESTRICT dst, const float * RESTRICT src, float gain, unsigned int n) {
+	const __m256 g = _mm256_set1_ps(gain);
+	unsigned int i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_mul_ps(_mm256_loadu_ps(src + i), g)));
+	mixAddScalar(dst + i, src + i, gain, n - i);
+}
+
+TARGET_AVX2 static void mixRampAVX2(float * RESTRICT dst, const float * RESTRICT src, float gain, float inc, unsigned int n) {
+	const __m256 g = _mm256_set1_ps(gain);
+	const __m256 d = _mm256_set1_ps(inc);
+	const __m256 step = _mm256_set1_ps(8.0f);
+	__m256 idx = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+	unsigned int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256 gains = _mm256_add_ps(g, _mm256_mul_ps(d, idx));
+		_mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_mul_ps(_mm256_loadu_ps(src + i), gains)));
+		idx = _mm256_add_ps(idx, step);
+	}
+	mixRampScalar(dst, src, gain, inc, i, n);
+}
+
+TARGET_AVX2 static void interleave2AVX2(float * RESTRICT dst, const float * RESTRICT left, const float * RESTRICT right, unsigned int n) {
+	unsigned int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256 l = _mm256_loadu_ps(left + i);
+		const __m256 r = _mm256_loadu_ps(right + i);
+		// unpack works per 128 bit lane; swap the middle halves back into order
+		const __m256 lo = _mm256_unpacklo_ps(l, r);
+		const __m256 hi = _mm256_unpackhi_ps(l, r);
+		_mm256_storeu_ps(dst + 2 * i, _mm256_permute2f128_ps(lo, hi, 0x20));
+		_mm256_storeu_ps(dst + 2 * i + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+	}
+	interleave2SSE2(dst + 2 * i, left + i, right + i, n - i);
+}
+#endif
+
+#define DISPATCH(name, args) \
+	switch (AudioKernels::level()) { \
+		case AudioKernels::AVX2: \
+			AVX2_CALL(name, args); \
+		case AudioKernels::SSE2: \
+			SSE2_CALL(name, args); \
+		default: \
+			name##Scalar args; \
+	}
+
+#ifdef KERNELS_AVX2
+#define AVX2_CALL(name, args) name##AVX2 args; return
+#else
+#define AVX2_CALL(name, args)
+#endif
+
+#ifdef KERNELS_X86
+#define SSE2_CALL(name, args) name##SSE2 args; return
+#else
+#define SSE2_CALL(name, args)
+#endif
+
+static void mixFloat2(float * RESTRICT buffer, const void * RESTRICT ipt, unsigned int nsamp, unsigned int) {
+	const float * RESTRICT input = reinterpret_cast<const float *>(ipt);
+	DISPATCH(mixFloat2, (buffer, input, nsamp))
+}
+
+static void mixShort2(float * RESTRICT buffer, const void * RESTRICT ipt, unsigned int nsamp, unsigned int) {
+	const short * RESTRICT input = reinterpret_cast<const short *>(ipt);
+	DISPATCH(mixShort2, (buffer, input, nsamp))
+}
+
+static void mixFloatN(float * RESTRICT buffer, const void * RESTRICT ipt, unsigned int nsamp, unsigned int nchan) {
+	const float * RESTRICT input = reinterpret_cast<const float *>(ipt);
+	DISPATCH(mixFloatN, (buffer, input, nsamp, nchan))
+}
+
+static void mixShortN(float * RESTRICT buffer, const void * RESTRICT ipt, unsigned int nsamp, unsigned int nchan) {
+	const short * RESTRICT input = reinterpret_cast<const short *>(ipt);
+	DISPATCH(mixShortN, (buffer, input, nsamp, nchan))
+}
+
+static void mixShort1(float * RESTRICT buffer, const void * RESTRICT ipt, unsigned int nsamp, unsigned int) {
+	AudioKernels::shortToFloat(buffer, reinterpret_cast<const short *>(ipt), nsamp);
+}
+
+AudioKernels::Level AudioKernels::detect() {
+#if defined(__GNUC__) && defined(KERNELS_X86)
+	static int detected = -1;
+	if (detected < 0) {
+		unsigned int eax, ebx, ecx, edx;
+		detected = Scalar;
+		if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (edx & (1 << 26))) {
+			detected = SSE2;
+#ifdef KERNELS_AVX2
+			// AVX2 also needs the OS to save the YMM registers (OSXSAVE and XCR0)
+			if ((ecx & (1 << 27)) && (__get_cpuid_max(0, NULL) >= 7)) {
+				unsigned int xcr0, xcr0hi;
+				__asm__ ("xgetbv" : "=a" (xcr0), "=d" (xcr0hi) : "c" (0));
+				__cpuid_count(7, 0, eax, ebx, ecx, edx);
+				if (((xcr0 & 6) == 6) && (ebx & (1 << 5)))
+					detected = AVX2;
+			}
+#endif
+		}
+	}
+	return static_cast<Level>(detected);
+#elif defined(_MSC_VER) && defined(KERNELS_X86)
+	static int detected = -1;
+	if (detected < 0) {
+		int info[4];
+		__cpuid(info, 0);
+		const int max = info[0];
+		__cpuid(info, 1);
+		detected = Scalar;
+		if (info[3] & (1 << 26)) {
+			detected = SSE2;
+#ifdef KERNELS_AVX2
+			const bool osxsave = (info[2] & (1 << 27)) != 0;
+			if (osxsave && (max >= 7) && ((_xgetbv(0) & 6) == 6)) {
+				__cpuidex(info, 7, 0);
+				if (info[1] & (1 << 5))
+					detected = AVX2;
+			}
+#endif
+		}
+	}
+	return static_cast<Level>(detected);
+#else
+	return Scalar;
+#endif
+}
+
+AudioKernels::Level AudioKernels::level() {
+	return static_cast<Level>(qMin(iLimit, static_cast<int>(detect())));
+}
+
+void AudioKernels::setLevel(Level l) {
+	iLimit = l;
+}
+
+AudioKernels::MixerFunc AudioKernels::mixer(unsigned int nchan, bool isfloat) {
+	switch (nchan) {
+		case 1:
+			return isfloat ? mixFloat1 : mixShort1;
+		case 2:
+			return isfloat ? mixFloat2 : mixShort2;
+		default:
+			return isfloat ? mixFloatN : mixShortN;
+	}
+}
+
+void AudioKernels::shortToFloat(float * RESTRICT dst, const short * RESTRICT src, unsigned int n) {
+	DISPATCH(shortToFloat, (dst, src, n))
+}
+
+void AudioKernels::floatToShort(short * RESTRICT dst, const float * RESTRICT src, unsigned int n) {
+	DISPATCH(floatToShort, (dst, src, n))
+}
+
+void AudioKernels::clip(float *buffer, unsigned int n) {
+	DISPATCH(clip, (buffer, n))
+}
+
+void AudioKernels::mixAdd(float * RESTRICT dst, const float * RESTRICT src, float gain, unsigned int n) {
+	DISPATCH(mixAdd, (dst, src, gain, n))
+}
+
+void AudioKernels::mixRamp(float * RESTRICT dst, const float * RESTRICT src, float gain, float inc, unsigned int n) {
+	switch (AudioKernels::level()) {
+		case AudioKernels::AVX2:
+			AVX2_CALL(mixRamp, (dst, src, gain, inc, n));
+		case AudioKernels::SSE2:
+			SSE2_CALL(mixRamp, (dst, src, gain, inc, n));
+		default:
+			mixRampScalar(dst, src, gain, inc, 0, n);
+	}
+}
+
+void AudioKernels::interleave(float * RESTRICT dst, const float * RESTRICT src, unsigned int nchan, unsigned int n) {
+	if (nchan == 1) {
+		memcpy(dst, src, n * sizeof(float));
+	} else if (nchan == 2) {
+		DISPATCH(interleave2, (dst, src, src + n, n))
+	} else {
+		for (unsigned int s = 0; s < nchan; ++s) {
+			const float * RESTRICT plane = src + s * n;
+			float * RESTRICT o = dst + s;
+			for (unsigned int i = 0; i < n; ++i)
+				o[i * nchan] = plane[i];
+		}
+	}
+}
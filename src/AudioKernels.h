@@ -0,0 +1,73 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_AUDIOKERNELS_H_
+#define MUMBLE_AUDIOKERNELS_H_
+
+/**
+ * Sample conversion, downmix and mixing loops of the audio path, with SSE2
+ * and AVX2 versions picked at runtime by what the CPU supports.
+ *
+ * Every version produces the same samples as the scalar one: float to
+ * 16 bit PCM scales by 32768, saturates to the 16 bit range and truncates
+ * towards zero, like static_cast<short>(qBound(...)) does.
+ */
+class AudioKernels {
+	public:
+		enum Level { Scalar, SSE2, AVX2 };
+
+		typedef void (*MixerFunc)(float * RESTRICT, const void * RESTRICT, unsigned int, unsigned int);
+
+		/// Best level the CPU and compiler support.
+		static Level detect();
+		/// Level in use, detect() unless changed with setLevel().
+		static Level level();
+		/// Limits the level in use; meant for comparing the versions.
+		static void setLevel(Level);
+
+		/// Downmix of interleaved input with nchan channels to mono; the last argument of the returned function is nchan.
+		static MixerFunc mixer(unsigned int nchan, bool isfloat);
+
+		/// 16 bit PCM to float in [-1, 1).
+		static void shortToFloat(float * RESTRICT dst, const short * RESTRICT src, unsigned int n);
+		/// Float to saturated 16 bit PCM.
+		static void floatToShort(short * RESTRICT dst, const float * RESTRICT src, unsigned int n);
+		/// Clamps to [-1, 1] in place.
+		static void clip(float *buffer, unsigned int n);
+
+		/// dst[i] += src[i] * gain
+		static void mixAdd(float * RESTRICT dst, const float * RESTRICT src, float gain, unsigned int n);
+		/// dst[i] += src[i] * (gain + inc * i), a linear volume ramp.
+		static void mixRamp(float * RESTRICT dst, const float * RESTRICT src, float gain, float inc, unsigned int n);
+		/// Interleaves nchan planes of n samples each, stored back to back in src.
+		static void interleave(float * RESTRICT dst, const float * RESTRICT src, unsigned int nchan, unsigned int n);
+};
+
+#endif
@@ -51,6 +51,8 @@ Connection::Connection(QObject *p, QSslSocket *qtsSock) : QObject(p) {
 	qtsSocket->setParent(this);
 	iPacketLength = -1;
 	bDisconnectedEmitted = false;
+	iBatchCount = 0;
+	uiBatchMessages = uiBatchWrites = uiBatchBytes = 0;
 
 	static bool bDeclared = false;
 	if (! bDeclared) {
@@ -195,9 +197,38 @@ void Connection::sendMessage(const ::google::protobuf::Message &msg, unsigned in
 	sendMessage(cache);
 }
 
+/**
+ * Queues an already framed message. Everything queued during one pass of the event
+ * loop is written in one go once control returns to it, so a burst of state changes
+ * costs each client a single TLS record instead of one per message.
+ */
 void Connection::sendMessage(const QByteArray &qbaMsg) {
-	if (! qbaMsg.isEmpty())
-		qtsSocket->write(qbaMsg);
+	if (qbaMsg.isEmpty())
+		return;
+
+	++uiBatchMessages;
+	++iBatchCount;
+	if (qbaBatch.isEmpty()) {
+		// Shares the caller's buffer; only a second message makes us copy.
+		qbaBatch = qbaMsg;
+		QMetaObject::invokeMethod(this, "flushBatch", Qt::QueuedConnection);
+	} else {
+		qbaBatch.append(qbaMsg);
+	}
+}
+
+void Connection::flushBatch() {
+	if (qbaBatch.isEmpty())
+		return;
+
+	if (iBatchCount > 1)
+		uiBatchBytes += qbaBatch.size();
+
+	++uiBatchWrites;
+	if (qtsSocket->state() != QAbstractSocket::UnconnectedState)
+		qtsSocket->write(qbaBatch);
+	qbaBatch.clear();
+	iBatchCount = 0;
 }
 
 void Connection::forceFlush() {
@@ -209,6 +240,7 @@ void Connection::forceFlush() {
 
 	int nodelay;
 
+	flushBatch();
 	qtsSocket->flush();
 
 	nodelay = 1;
@@ -223,10 +255,14 @@ void Connection::disconnectSocket(bool force) {
 		return;
 	}
 
-	if (force)
+	if (force) {
+		qbaBatch.clear();
+		iBatchCount = 0;
 		qtsSocket->abort();
-	else
+	} else {
+		flushBatch();
 		qtsSocket->disconnectFromHost();
+	}
 }
 
 QHostAddress Connection::peerAddress() const {
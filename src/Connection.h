@@ -65,6 +65,10 @@ class Connection : public QObject {
 #endif
 		unsigned int uiType;
 		int iPacketLength;
+		/// Control messages written since the last event loop pass, sent as a single
+		/// socket write (and thus usually a single TLS record) by flushBatch().
+		QByteArray qbaBatch;
+		int iBatchCount;
 #ifdef Q_OS_WIN
 		static HANDLE hQoS;
 		DWORD dwFlow;
@@ -74,6 +78,7 @@ class Connection : public QObject {
 		void socketError(QAbstractSocket::SocketError);
 		void socketDisconnected();
 		void socketSslErrors(const QList<QSslError> &errors);
+		void flushBatch();
 	public slots:
 		void proceedAnyway();
 	signals:
@@ -100,6 +105,12 @@ class Connection : public QObject {
 		quint16 peerPort() const;
 		bool bDisconnectedEmitted;
 
+		/// Messages queued through sendMessage(), and the socket writes they took.
+		/// The difference is the number of TLS records saved by batching.
+		quint64 uiBatchMessages, uiBatchWrites;
+		/// Bytes that went out in a write together with at least one other message.
+		quint64 uiBatchBytes;
+
 		void setToS();
 #ifdef Q_OS_WIN
 		static void setQoS(HANDLE hParentQoS);
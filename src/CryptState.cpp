@@ -43,12 +43,52 @@
 
 #include "Net.h"
 
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <cpuid.h>
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#endif
+
 CryptState::CryptState() {
 	for (int i=0;i<0x100;i++)
 		decrypt_history[i] = 0;
 	bInit = false;
 	uiGood=uiLate=uiLost=uiResync=0;
 	uiRemoteGood=uiRemoteLate=uiRemoteLost=uiRemoteResync=0;
+	evpEncrypt = evpDecrypt = NULL;
+	bAccelerated = false;
+}
+
+CryptState::~CryptState() {
+	if (evpEncrypt)
+		EVP_CIPHER_CTX_free(evpEncrypt);
+	if (evpDecrypt)
+		EVP_CIPHER_CTX_free(evpDecrypt);
+}
+
+/*!
+ * Returns true if the CPU implements the AES-NI instructions. OpenSSL only
+ * outperforms the block-at-a-time AES_encrypt() loop when it can use them.
+ */
+bool CryptState::hasAesNi() {
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+	static int aesni = -1;
+	if (aesni < 0) {
+		unsigned int eax, ebx, ecx, edx;
+		aesni = (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & (1 << 25))) ? 1 : 0;
+	}
+	return aesni == 1;
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+	static int aesni = -1;
+	if (aesni < 0) {
+		int info[4];
+		__cpuid(info, 1);
+		aesni = (info[2] & (1 << 25)) ? 1 : 0;
+	}
+	return aesni == 1;
+#else
+	return false;
+#endif
 }
 
 bool CryptState::isValid() const {
@@ -59,8 +99,7 @@ void CryptState::genKey() {
 	RAND_bytes(raw_key, AES_BLOCK_SIZE);
 	RAND_bytes(encrypt_iv, AES_BLOCK_SIZE);
 	RAND_bytes(decrypt_iv, AES_BLOCK_SIZE);
-	AES_set_encrypt_key(raw_key, 128, &encrypt_key);
-	AES_set_decrypt_key(raw_key, 128, &decrypt_key);
+	setCipherKey();
 	bInit = true;
 }
 
@@ -68,8 +107,7 @@ void CryptState::setKey(const unsigned char *rkey, const unsigned char *eiv, con
 	memcpy(raw_key, rkey, AES_BLOCK_SIZE);
 	memcpy(encrypt_iv, eiv, AES_BLOCK_SIZE);
 	memcpy(decrypt_iv, div, AES_BLOCK_SIZE);
-	AES_set_encrypt_key(raw_key, 128, &encrypt_key);
-	AES_set_decrypt_key(raw_key, 128, &decrypt_key);
+	setCipherKey();
 	bInit = true;
 }
 
@@ -77,6 +115,29 @@ void CryptState::setDecryptIV(const unsigned char *iv) {
 	memcpy(decrypt_iv, iv, AES_BLOCK_SIZE);
 }
 
+void CryptState::setCipherKey() {
+	AES_set_encrypt_key(raw_key, 128, &encrypt_key);
+	AES_set_decrypt_key(raw_key, 128, &decrypt_key);
+
+	bAccelerated = false;
+	if (! hasAesNi())
+		return;
+
+	if (! evpEncrypt)
+		evpEncrypt = EVP_CIPHER_CTX_new();
+	if (! evpDecrypt)
+		evpDecrypt = EVP_CIPHER_CTX_new();
+	if (! evpEncrypt || ! evpDecrypt)
+		return;
+
+	if (! EVP_CipherInit_ex(evpEncrypt, EVP_aes_128_ecb(), NULL, raw_key, NULL, 1) || ! EVP_CipherInit_ex(evpDecrypt, EVP_aes_128_ecb(), NULL, raw_key, NULL, 0))
+		return;
+	EVP_CIPHER_CTX_set_padding(evpEncrypt, 0);
+	EVP_CIPHER_CTX_set_padding(evpDecrypt, 0);
+
+	bAccelerated = true;
+}
+
 void CryptState::encrypt(const unsigned char *source, unsigned char *dst, unsigned int plain_length) {
 	unsigned char tag[AES_BLOCK_SIZE];
 
@@ -233,13 +294,53 @@ static void inline ZERO(keyblock &block) {
 #define AESencrypt(src,dst,key) AES_encrypt(reinterpret_cast<const unsigned char *>(src),reinterpret_cast<unsigned char *>(dst), key);
 #define AESdecrypt(src,dst,key) AES_decrypt(reinterpret_cast<const unsigned char *>(src),reinterpret_cast<unsigned char *>(dst), key);
 
+// Number of full blocks handed to EVP at once; a maximum size voice packet fits.
+#define OCB_BATCH 64
+
+static void inline AESecb(EVP_CIPHER_CTX *ctx, keyblock *blocks, unsigned int count) {
+	int outlen;
+	EVP_CipherUpdate(ctx, reinterpret_cast<unsigned char *>(blocks), &outlen, reinterpret_cast<const unsigned char *>(blocks), count * AES_BLOCK_SIZE);
+}
+
+static void inline AESblock(CryptState *cs, const void *src, void *dst) {
+	if (cs->bAccelerated) {
+		int outlen;
+		EVP_EncryptUpdate(cs->evpEncrypt, reinterpret_cast<unsigned char *>(dst), &outlen, reinterpret_cast<const unsigned char *>(src), AES_BLOCK_SIZE);
+	} else {
+		AES_encrypt(reinterpret_cast<const unsigned char *>(src), reinterpret_cast<unsigned char *>(dst), &cs->encrypt_key);
+	}
+}
+
 void CryptState::ocb_encrypt(const unsigned char *plain, unsigned char *encrypted, unsigned int len, const unsigned char *nonce, unsigned char *tag) {
 	keyblock checksum, delta, tmp, pad;
 
 	// Initialize
-	AESencrypt(nonce, delta, &encrypt_key);
+	AESblock(this, nonce, delta);
 	ZERO(checksum);
 
+	if (bAccelerated) {
+		keyblock offsets[OCB_BATCH], blocks[OCB_BATCH];
+
+		while (len > AES_BLOCK_SIZE) {
+			unsigned int count = qMin((len - 1) / AES_BLOCK_SIZE, static_cast<unsigned int>(OCB_BATCH));
+			const subblock *src = reinterpret_cast<const subblock *>(plain);
+
+			for (unsigned int i=0;i<count;i++) {
+				S2(delta);
+				memcpy(offsets[i], delta, AES_BLOCK_SIZE);
+				XOR(blocks[i], delta, src + i * BLOCKSIZE);
+				XOR(checksum, checksum, src + i * BLOCKSIZE);
+			}
+			AESecb(evpEncrypt, blocks, count);
+			for (unsigned int i=0;i<count;i++)
+				XOR(reinterpret_cast<subblock *>(encrypted) + i * BLOCKSIZE, offsets[i], blocks[i]);
+
+			len -= count * AES_BLOCK_SIZE;
+			plain += count * AES_BLOCK_SIZE;
+			encrypted += count * AES_BLOCK_SIZE;
+		}
+	}
+
 	while (len > AES_BLOCK_SIZE) {
 		S2(delta);
 		XOR(tmp, delta, reinterpret_cast<const subblock *>(plain));
@@ -255,7 +356,7 @@ void CryptState::ocb_encrypt(const unsigned char *plain, unsigned char *encrypte
 	ZERO(tmp);
 	tmp[BLOCKSIZE - 1] = SWAPPED(len * 8);
 	XOR(tmp, tmp, delta);
-	AESencrypt(tmp, pad, &encrypt_key);
+	AESblock(this, tmp, pad);
 	memcpy(tmp, plain, len);
 	memcpy(reinterpret_cast<unsigned char *>(tmp)+len, reinterpret_cast<const unsigned char *>(pad)+len, AES_BLOCK_SIZE - len);
 	XOR(checksum, checksum, tmp);
@@ -264,16 +365,41 @@ void CryptState::ocb_encrypt(const unsigned char *plain, unsigned char *encrypte
 
 	S3(delta);
 	XOR(tmp, delta, checksum);
-	AESencrypt(tmp, tag, &encrypt_key);
+	AESblock(this, tmp, tag);
 }
 
 void CryptState::ocb_decrypt(const unsigned char *encrypted, unsigned char *plain, unsigned int len, const unsigned char *nonce, unsigned char *tag) {
 	keyblock checksum, delta, tmp, pad;
 
 	// Initialize
-	AESencrypt(nonce, delta, &encrypt_key);
+	AESblock(this, nonce, delta);
 	ZERO(checksum);
 
+	if (bAccelerated) {
+		keyblock offsets[OCB_BATCH], blocks[OCB_BATCH];
+
+		while (len > AES_BLOCK_SIZE) {
+			unsigned int count = qMin((len - 1) / AES_BLOCK_SIZE, static_cast<unsigned int>(OCB_BATCH));
+			const subblock *src = reinterpret_cast<const subblock *>(encrypted);
+			subblock *dst = reinterpret_cast<subblock *>(plain);
+
+			for (unsigned int i=0;i<count;i++) {
+				S2(delta);
+				memcpy(offsets[i], delta, AES_BLOCK_SIZE);
+				XOR(blocks[i], delta, src + i * BLOCKSIZE);
+			}
+			AESecb(evpDecrypt, blocks, count);
+			for (unsigned int i=0;i<count;i++) {
+				XOR(dst + i * BLOCKSIZE, offsets[i], blocks[i]);
+				XOR(checksum, checksum, dst + i * BLOCKSIZE);
+			}
+
+			len -= count * AES_BLOCK_SIZE;
+			plain += count * AES_BLOCK_SIZE;
+			encrypted += count * AES_BLOCK_SIZE;
+		}
+	}
+
 	while (len > AES_BLOCK_SIZE) {
 		S2(delta);
 		XOR(tmp, delta, reinterpret_cast<const subblock *>(encrypted));
@@ -289,7 +415,7 @@ void CryptState::ocb_decrypt(const unsigned char *encrypted, unsigned char *plai
 	ZERO(tmp);
 	tmp[BLOCKSIZE - 1] = SWAPPED(len * 8);
 	XOR(tmp, tmp, delta);
-	AESencrypt(tmp, pad, &encrypt_key);
+	AESblock(this, tmp, pad);
 	memset(tmp, 0, AES_BLOCK_SIZE);
 	memcpy(tmp, encrypted, len);
 	XOR(tmp, tmp, pad);
@@ -298,5 +424,5 @@ void CryptState::ocb_decrypt(const unsigned char *encrypted, unsigned char *plai
 
 	S3(delta);
 	XOR(tmp, delta, checksum);
-	AESencrypt(tmp, tag, &encrypt_key);
+	AESblock(this, tmp, tag);
 }
@@ -32,6 +32,7 @@
 #define MUMBLE_CRYPTSTATE_H_
 
 #include <openssl/aes.h>
+#include <openssl/evp.h>
 
 #include "Timer.h"
 
@@ -56,15 +57,26 @@ class CryptState {
 
 		AES_KEY	encrypt_key;
 		AES_KEY decrypt_key;
+		// AES-128-ECB contexts used to run the full OCB blocks of a packet
+		// through the cipher in one call, which lets OpenSSL pipeline AES-NI.
+		EVP_CIPHER_CTX *evpEncrypt;
+		EVP_CIPHER_CTX *evpDecrypt;
+		// Use the EVP contexts. Set by setKey() and genKey() when the CPU
+		// has AES instructions; clearing it forces the block-at-a-time path.
+		bool bAccelerated;
 		Timer tLastGood;
 		Timer tLastRequest;
 		bool bInit;
 		CryptState();
+		~CryptState();
+
+		static bool hasAesNi();
 
 		bool isValid() const;
 		void genKey();
 		void setKey(const unsigned char *rkey, const unsigned char *eiv, const unsigned char *div);
 		void setDecryptIV(const unsigned char *iv);
+		void setCipherKey();
 
 		void ocb_encrypt(const unsigned char *plain, unsigned char *encrypted, unsigned int len, const unsigned char *nonce, unsigned char *tag);
 		void ocb_decrypt(const unsigned char *encrypted, unsigned char *plain, unsigned int len, const unsigned char *nonce, unsigned char *tag);
@@ -121,152 +121,169 @@ QSet<QString> Group::groupNames(Channel *chan) {
 	return m;
 }
 
-#define RET_FALSE (invert ? true : false)
-#define RET_TRUE (invert ? false : true)
-
-bool Group::isMember(Channel *curChan, Channel *aclChan, QString name, ServerUser *pl) {
-	Channel *p;
-	Channel *c;
-	Group *g;
+GroupPredicate::GroupPredicate() : kKind(Invalid), bInvert(false), bACLChannel(false), iMinPath(0), iMinDesc(1), iMaxDesc(1000) {
+}
 
-	bool m = false;
-	bool invert = false;
+GroupPredicate::GroupPredicate(const QString &spec) : kKind(Invalid), bInvert(false), bACLChannel(false), iMinPath(0), iMinDesc(1), iMaxDesc(1000) {
 	bool token = false;
 	bool hash = false;
-	c = curChan;
-
-	while (true) {
-		if (name.isEmpty())
-			return false;
-
-		if (name.startsWith(QChar::fromLatin1('!'))) {
-			invert = true;
-			name = name.remove(0,1);
-			continue;
-		}
-
-		if (name.startsWith(QChar::fromLatin1('~'))) {
-			c = aclChan;
-			name = name.remove(0,1);
-			continue;
-		}
-
-		if (name.startsWith(QChar::fromLatin1('#'))) {
+	int i = 0;
+
+	for (; i < spec.length(); ++i) {
+		const QChar c = spec.at(i);
+		if (c == QLatin1Char('!'))
+			bInvert = true;
+		else if (c == QLatin1Char('~'))
+			bACLChannel = true;
+		else if (c == QLatin1Char('#'))
 			token = true;
-			name = name.remove(0,1);
-			continue;
-		}
-		if (name.startsWith(QChar::fromLatin1('$'))) {
+		else if (c == QLatin1Char('$'))
 			hash = true;
-			name = name.remove(0,1);
-			continue;
-		}
-
-		break;
+		else
+			break;
 	}
 
+	if (i == spec.length())
+		return;
+
+	const QString name = spec.mid(i);
+
 	if (token)
-		m = pl->qslAccessTokens.contains(name, Qt::CaseInsensitive);
+		kKind = Token;
 	else if (hash)
-		m = pl->qsHash == name;
+		kKind = Hash;
 	else if (name == QLatin1String("none"))
-		m = false;
+		kKind = None;
 	else if (name == QLatin1String("all"))
-		m = true;
+		kKind = All;
 	else if (name == QLatin1String("auth"))
-		m = (pl->iId >= 0);
+		kKind = Auth;
 	else if (name == QLatin1String("strong"))
-		m = pl->bVerified;
+		kKind = Strong;
 	else if (name == QLatin1String("in"))
-		m = (pl->cChannel == c);
+		kKind = In;
 	else if (name == QLatin1String("out"))
-		m = !(pl->cChannel == c);
-	else if (name == QLatin1String("sub")
-			|| name.startsWith(QLatin1String("sub,"))) {
-		
-		name = name.remove(0,4);
-		int mindesc = 1;
-		int maxdesc = 1000;
-		int minpath = 0;
-		QStringList args = name.split(QLatin1String(","));
+		kKind = Out;
+	else if (name == QLatin1String("sub") || name.startsWith(QLatin1String("sub,"))) {
+		kKind = Sub;
+
+		QStringList args = name.mid(4).split(QLatin1String(","));
 		switch (args.count()) {
 			default:
 			case 3:
-				maxdesc = args[2].isEmpty() ? maxdesc : args[2].toInt();
+				iMaxDesc = args[2].isEmpty() ? iMaxDesc : args[2].toInt();
 			case 2:
-				mindesc = args[1].isEmpty() ? mindesc : args[1].toInt();
+				iMinDesc = args[1].isEmpty() ? iMinDesc : args[1].toInt();
 			case 1:
-				minpath = args[0].isEmpty() ? minpath : args[0].toInt();
+				iMinPath = args[0].isEmpty() ? iMinPath : args[0].toInt();
 			case 0:
 				break;
 		}
+		return;
+	} else
+		kKind = Named;
 
-		Channel *home = pl->cChannel;
-		QList<Channel *> playerChain;
-		QList<Channel *> groupChain;
-
-		p = home;
-		while (p) {
-			playerChain.prepend(p);
-			p = p->cParent;
-		}
-
-		p = curChan;
-		while (p) {
-			groupChain.prepend(p);
-			p = p->cParent;
-		}
-
-		int cofs = groupChain.indexOf(c);
-		Q_ASSERT(cofs != -1);
-
-		cofs += minpath;
-
-		if (cofs >= groupChain.count()) {
-			return RET_FALSE;
-		} else if (cofs < 0) {
-			cofs = 0;
-		}
-
-		Channel *needed = groupChain[cofs];
-		if (playerChain.indexOf(needed) == -1) {
-			return RET_FALSE;
-		}
-
-		int mindepth = cofs + mindesc;
-		int maxdepth = cofs + maxdesc;
-
-		int pdepth = playerChain.count() - 1;
-
-		m = (pdepth >= mindepth) && (pdepth <= maxdepth);
-	} else {
-		QStack<Group *> s;
+	qsName = name;
+}
 
-		p = c;
+bool Group::isMember(Channel *curChan, Channel *aclChan, const QString &name, ServerUser *pl) {
+	return isMember(curChan, aclChan, GroupPredicate(name), pl);
+}
 
-		while (p) {
-			g = p->qhGroups.value(name);
+bool Group::isMember(Channel *curChan, Channel *aclChan, const GroupPredicate &gp, ServerUser *pl) {
+	Channel *c = gp.bACLChannel ? aclChan : curChan;
+	Channel *p;
+	bool m = false;
 
-			if (g) {
-				if ((p != c) && ! g->bInheritable)
+	switch (gp.kKind) {
+		case GroupPredicate::Invalid:
+			return false;
+		case GroupPredicate::Token:
+			m = pl->qslAccessTokens.contains(gp.qsName, Qt::CaseInsensitive);
+			break;
+		case GroupPredicate::Hash:
+			m = pl->qsHash == gp.qsName;
+			break;
+		case GroupPredicate::None:
+			m = false;
+			break;
+		case GroupPredicate::All:
+			m = true;
+			break;
+		case GroupPredicate::Auth:
+			m = (pl->iId >= 0);
+			break;
+		case GroupPredicate::Strong:
+			m = pl->bVerified;
+			break;
+		case GroupPredicate::In:
+			m = (pl->cChannel == c);
+			break;
+		case GroupPredicate::Out:
+			m = !(pl->cChannel == c);
+			break;
+		case GroupPredicate::Sub: {
+				// Depths are counted from the root channel, which is at depth 0.
+				int cofs = 0;
+				for (p = c->cParent; p; p = p->cParent)
+					++cofs;
+				int chandepth = cofs;
+				for (p = curChan; p && (p != c); p = p->cParent)
+					++chandepth;
+				// c is not an ancestor of curChan
+				if (! p)
+					return false;
+
+				cofs += gp.iMinPath;
+
+				if (cofs > chandepth)
 					break;
-				s.push(g);
-				if (! g->bInherit)
+				else if (cofs < 0)
+					cofs = 0;
+
+				Channel *needed = curChan;
+				for (int i = chandepth; i > cofs; --i)
+					needed = needed->cParent;
+
+				int pdepth = -1;
+				bool found = false;
+				for (p = pl->cChannel; p; p = p->cParent) {
+					found = found || (p == needed);
+					++pdepth;
+				}
+				if (! found)
 					break;
-			}
 
-			p = p->cParent;
-		}
-
-		while (! s.isEmpty()) {
-			g = s.pop();
-			if (g->qsAdd.contains(pl->iId) || g->qsTemporary.contains(pl->iId) || g->qsTemporary.contains(- static_cast<int>(pl->uiSession)))
-				m = true;
-			if (g->qsRemove.contains(pl->iId))
-				m = false;
-		}
+				m = (pdepth >= cofs + gp.iMinDesc) && (pdepth <= cofs + gp.iMaxDesc);
+			}
+			break;
+		case GroupPredicate::Named: {
+				QVarLengthArray<Group *, 16> s;
+
+				for (p = c; p; p = p->cParent) {
+					Group *g = p->qhGroups.value(gp.qsName);
+
+					if (g) {
+						if ((p != c) && ! g->bInheritable)
+							break;
+						s.append(g);
+						if (! g->bInherit)
+							break;
+					}
+				}
+
+				const int negsession = - static_cast<int>(pl->uiSession);
+				for (int i = s.count() - 1; i >= 0; --i) {
+					Group *g = s[i];
+					if (g->qsAdd.contains(pl->iId) || g->qsTemporary.contains(pl->iId) || g->qsTemporary.contains(negsession))
+						m = true;
+					if (g->qsRemove.contains(pl->iId))
+						m = false;
+				}
+			}
+			break;
 	}
-	return invert ? !m : m;
+	return gp.bInvert ? !m : m;
 }
 
 #endif
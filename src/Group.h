@@ -37,6 +37,31 @@ class Channel;
 class User;
 class ServerUser;
 
+#ifdef MURMUR
+/**
+ * A group specification as found in ACLs and whisper targets ("admin",
+ * "!~in", "#token", "$certhash", "sub,1,2", ...), parsed once so that
+ * evaluating it for every user and channel doesn't have to.
+ */
+class GroupPredicate {
+	public:
+		enum Kind { Invalid, None, All, Auth, Strong, In, Out, Sub, Token, Hash, Named };
+
+		Kind kKind;
+		/// Prefixed with '!'.
+		bool bInvert;
+		/// Prefixed with '~'; evaluated in the channel defining the ACL rather than the current one.
+		bool bACLChannel;
+		/// Arguments of "sub,minpath,mindesc,maxdesc".
+		int iMinPath, iMinDesc, iMaxDesc;
+		/// Group name, access token or certificate hash.
+		QString qsName;
+
+		GroupPredicate();
+		explicit GroupPredicate(const QString &spec);
+};
+#endif
+
 class Group {
 	private:
 		Q_DISABLE_COPY(Group)
@@ -55,7 +80,8 @@ class Group {
 		static QSet<QString> groupNames(Channel *c);
 		static Group *getGroup(Channel *c, QString name);
 
-		static bool isMember(Channel *c, Channel *aclChan, QString name, ServerUser *);
+		static bool isMember(Channel *c, Channel *aclChan, const QString &name, ServerUser *);
+		static bool isMember(Channel *c, Channel *aclChan, const GroupPredicate &gp, ServerUser *);
 #endif
 };
 
@@ -38,8 +38,9 @@
 class Timer {
 	protected:
 		quint64 uiStart;
-		static quint64 now();
 	public:
+		/// Current time of the clock all Timers use, in microseconds.
+		static quint64 now();
 		Timer(bool start = true);
 		bool isElapsed(quint64 us);
 		quint64 elapsed() const;
@@ -160,7 +160,7 @@ ACLEditor::ACLEditor(int channelid, const MumbleProto::ACL &mea, QWidget *p) : Q
 	def->bApplySubs = true;
 	def->bInherited = true;
 	def->iUserId = -1;
-	def->qsGroup = QLatin1String("all");
+	def->setGroup(QLatin1String("all"));
 	def->pAllow = ChanACL::Traverse | ChanACL::Enter | ChanACL::Speak | ChanACL::Whisper | ChanACL::TextMessage;
 	def->pDeny = (~def->pAllow) & ChanACL::All;
 
@@ -177,7 +177,7 @@ ACLEditor::ACLEditor(int channelid, const MumbleProto::ACL &mea, QWidget *p) : Q
 		if (as.has_user_id())
 			acl->iUserId = as.user_id();
 		else
-			acl->qsGroup = u8(as.group());
+			acl->setGroup(u8(as.group()));
 		acl->pAllow = static_cast<ChanACL::Permissions>(as.grant());
 		acl->pDeny = static_cast<ChanACL::Permissions>(as.deny());
 
@@ -299,7 +299,7 @@ void ACLEditor::accept() {
 			if (acl->iUserId != -1)
 				mpa->set_user_id(acl->iUserId);
 			else
-				mpa->set_group(u8(acl->qsGroup));
+				mpa->set_group(u8(acl->group()));
 			mpa->set_grant(acl->pAllow);
 			mpa->set_deny(acl->pDeny);
 		}
@@ -431,7 +431,7 @@ void ACLEditor::refillACL() {
 			continue;
 		QString text;
 		if (acl->iUserId == -1)
-			text = QString::fromLatin1("@%1").arg(acl->qsGroup);
+			text = QString::fromLatin1("@%1").arg(acl->group());
 		else
 			text = userName(acl->iUserId);
 		QListWidgetItem *item = new QListWidgetItem(text, qlwACLs);
@@ -620,8 +620,8 @@ void ACLEditor::ACLEnableCheck() {
 
 		if (as->iUserId == -1) {
 			qcbACLUser->clearEditText();
-			qcbACLGroup->addItem(as->qsGroup);
-			qcbACLGroup->setCurrentIndex(qcbACLGroup->findText(as->qsGroup, Qt::MatchExactly));
+			qcbACLGroup->addItem(as->group());
+			qcbACLGroup->setCurrentIndex(qcbACLGroup->findText(as->group(), Qt::MatchExactly));
 		} else {
 			qcbACLUser->setEditText(userName(as->iUserId));
 		}
@@ -651,7 +651,7 @@ void ACLEditor::updatePasswordField() {
 	foreach(ChanACL *acl, qlACLs) {
 		// Check for sth that applies to '#<something>' AND grants 'Enter' AND may grant 'Speak', 'Whisper',
 		// 'TextMessage', 'Link' but NOTHING else AND does not deny anything, then '<something>' is the password.
-		if (acl->qsGroup.startsWith(QLatin1Char('#')) &&
+		if (acl->group().startsWith(QLatin1Char('#')) &&
 		        acl->bApplyHere &&
 		        !acl->bInherited &&
 		        (acl->pAllow & ChanACL::Enter) &&
@@ -662,7 +662,7 @@ void ACLEditor::updatePasswordField() {
 		}
 	}
 	if (pcaPassword)
-		qleChannelPassword->setText(pcaPassword->qsGroup.mid(1));
+		qleChannelPassword->setText(pcaPassword->group().mid(1));
 	else
 		qleChannelPassword->clear();
 
@@ -677,7 +677,7 @@ void ACLEditor::updatePasswordACL() {
 			// Search and remove the @all deny ACL
 			ChanACL *denyall = NULL;
 			foreach(ChanACL *acl, qlACLs) {
-				if (acl->qsGroup == QLatin1String("all") &&
+				if (acl->group() == QLatin1String("all") &&
 				        acl->bInherited == false &&
 				        acl->bApplyHere == true &&
 				        acl->pAllow == ChanACL::None &&
@@ -700,7 +700,7 @@ void ACLEditor::updatePasswordACL() {
 			pcaPassword->bInherited = false;
 			pcaPassword->pAllow = ChanACL::None;
 			pcaPassword->pDeny = ChanACL::Enter | ChanACL::Speak | ChanACL::Whisper | ChanACL::TextMessage | ChanACL::LinkChannel | ChanACL::Traverse;
-			pcaPassword->qsGroup = QLatin1String("all");
+			pcaPassword->setGroup(QLatin1String("all"));
 			qlACLs << pcaPassword;
 
 			pcaPassword = new ChanACL(NULL);
@@ -709,10 +709,10 @@ void ACLEditor::updatePasswordACL() {
 			pcaPassword->bInherited = false;
 			pcaPassword->pAllow = ChanACL::Enter | ChanACL::Speak | ChanACL::Whisper | ChanACL::TextMessage | ChanACL::LinkChannel | ChanACL::Traverse;
 			pcaPassword->pDeny = ChanACL::None;
-			pcaPassword->qsGroup = QString(QLatin1String("#%1")).arg(qleChannelPassword->text());
+			pcaPassword->setGroup(QString(QLatin1String("#%1")).arg(qleChannelPassword->text()));
 			qlACLs << pcaPassword;
 		} else {
-			pcaPassword->qsGroup = QString(QLatin1String("#%1")).arg(qleChannelPassword->text());
+			pcaPassword->setGroup(QString(QLatin1String("#%1")).arg(qleChannelPassword->text()));
 		}
 	}
 }
@@ -726,7 +726,7 @@ void ACLEditor::on_qpbACLAdd_clicked() {
 	as->bApplyHere = true;
 	as->bApplySubs = true;
 	as->bInherited = false;
-	as->qsGroup = QLatin1String("all");
+	as->setGroup(QLatin1String("all"));
 	as->iUserId = -1;
 	as->pAllow = ChanACL::None;
 	as->pDeny = ChanACL::None;
@@ -802,10 +802,10 @@ void ACLEditor::on_qcbACLGroup_activated(const QString &text) {
 
 	if (text.isEmpty()) {
 		qcbACLGroup->setCurrentIndex(1);
-		as->qsGroup = QLatin1String("all");
+		as->setGroup(QLatin1String("all"));
 	} else {
 		qcbACLUser->clearEditText();
-		as->qsGroup = text;
+		as->setGroup(text);
 	}
 	refillACL();
 }
@@ -821,7 +821,7 @@ void ACLEditor::on_qcbACLUser_activated() {
 		as->iUserId = -1;
 		if (qcbACLGroup->currentIndex() == 0) {
 			qcbACLGroup->setCurrentIndex(1);
-			as->qsGroup = QLatin1String("all");
+			as->setGroup(QLatin1String("all"));
 		}
 		refillACL();
 	} else {
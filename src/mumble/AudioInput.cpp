@@ -32,6 +32,7 @@
 
 #include "AudioInput.h"
 
+#include "AudioKernels.h"
 #include "AudioOutput.h"
 #include "CELTCodec.h"
 #include "ServerHandler.h"
@@ -129,7 +130,8 @@ AudioInput::AudioInput() : opusBuffer(g.s.iFramesPerPacket * (SAMPLE_RATE / 100)
 	sppPreprocess = NULL;
 	sesEcho = NULL;
 	srsMic = srsEcho = NULL;
-	iJitterSeq = 0;
+	eqEcho = NULL;
+	uiJitterBase = 0;
 	iMinBuffered = 1000;
 
 	psMic = new short[iFrameSize];
@@ -172,8 +174,7 @@ AudioInput::~AudioInput() {
 		cCodec->celt_encoder_destroy(ceEncoder);
 	}
 
-	foreach(short *buf, qlEchoFrames)
-		delete [] buf;
+	delete eqEcho;
 
 	if (sppPreprocess)
 		speex_preprocess_state_destroy(sppPreprocess);
@@ -198,116 +199,8 @@ bool AudioInput::isTransmitting() const {
 	return bPreviousVoice;
 };
 
-#define IN_MIXER_FLOAT(channels) \
-static void inMixerFloat##channels ( float * RESTRICT buffer, const void * RESTRICT ipt, unsigned int nsamp, unsigned int N) { \
-  const float * RESTRICT input = reinterpret_cast<const float *>(ipt); \
-  register const float m = 1.0f / static_cast<float>(channels); \
-  Q_UNUSED(N); \
-  for(unsigned int i=0;i<nsamp;++i) {\
-	  register float v= 0.0f; \
-	  for(unsigned int j=0;j<channels;++j) \
-	  	v += input[i*channels+j]; \
-	  buffer[i] = v * m; \
-  } \
-}
-
-#define IN_MIXER_SHORT(channels) \
-static void inMixerShort##channels ( float * RESTRICT buffer, const void * RESTRICT ipt, unsigned int nsamp, unsigned int N) { \
-  const short * RESTRICT input = reinterpret_cast<const short *>(ipt); \
-  register const float m = 1.0f / (32768.f * static_cast<float>(channels)); \
-  Q_UNUSED(N); \
-  for(unsigned int i=0;i<nsamp;++i) {\
-	  register float v= 0.0f; \
-	  for(unsigned int j=0;j<channels;++j) \
-	  	v += static_cast<float>(input[i*channels+j]); \
-	  buffer[i] = v * m; \
-  } \
-}
-
-IN_MIXER_FLOAT(1)
-IN_MIXER_FLOAT(2)
-IN_MIXER_FLOAT(3)
-IN_MIXER_FLOAT(4)
-IN_MIXER_FLOAT(5)
-IN_MIXER_FLOAT(6)
-IN_MIXER_FLOAT(7)
-IN_MIXER_FLOAT(8)
-IN_MIXER_FLOAT(N)
-
-IN_MIXER_SHORT(1)
-IN_MIXER_SHORT(2)
-IN_MIXER_SHORT(3)
-IN_MIXER_SHORT(4)
-IN_MIXER_SHORT(5)
-IN_MIXER_SHORT(6)
-IN_MIXER_SHORT(7)
-IN_MIXER_SHORT(8)
-IN_MIXER_SHORT(N)
-
 AudioInput::inMixerFunc AudioInput::chooseMixer(const unsigned int nchan, SampleFormat sf) {
-	inMixerFunc r = NULL;
-	if (sf == SampleFloat) {
-		switch (nchan) {
-			case 1:
-				r = inMixerFloat1;
-				break;
-			case 2:
-				r = inMixerFloat2;
-				break;
-			case 3:
-				r = inMixerFloat3;
-				break;
-			case 4:
-				r = inMixerFloat4;
-				break;
-			case 5:
-				r = inMixerFloat5;
-				break;
-			case 6:
-				r = inMixerFloat6;
-				break;
-			case 7:
-				r = inMixerFloat7;
-				break;
-			case 8:
-				r = inMixerFloat8;
-				break;
-			default:
-				r = inMixerFloatN;
-				break;
-		}
-	} else {
-		switch (nchan) {
-			case 1:
-				r = inMixerShort1;
-				break;
-			case 2:
-				r = inMixerShort2;
-				break;
-			case 3:
-				r = inMixerShort3;
-				break;
-			case 4:
-				r = inMixerShort4;
-				break;
-			case 5:
-				r = inMixerShort5;
-				break;
-			case 6:
-				r = inMixerShort6;
-				break;
-			case 7:
-				r = inMixerShort7;
-				break;
-			case 8:
-				r = inMixerShort8;
-				break;
-			default:
-				r = inMixerShortN;
-				break;
-		}
-	}
-	return r;
+	return AudioKernels::mixer(nchan, sf == SampleFloat);
 }
 
 void AudioInput::initializeMixer() {
@@ -320,6 +213,9 @@ void AudioInput::initializeMixer() {
 	delete [] pfMicInput;
 	delete [] pfEchoInput;
 	delete [] pfOutput;
+	delete eqEcho;
+	delete [] psSpeaker;
+	psSpeaker = NULL;
 
 	if (iMicFreq != iSampleRate)
 		srsMic = speex_resampler_init(1, iMicFreq, iSampleRate, 3, &err);
@@ -337,9 +233,13 @@ void AudioInput::initializeMixer() {
 		iEchoMCLength = bEchoMulti ? iEchoLength * iEchoChannels : iEchoLength;
 		iEchoFrameSize = bEchoMulti ? iFrameSize * iEchoChannels : iFrameSize;
 		pfEchoInput = new float[iEchoMCLength];
+		eqEcho = new EchoQueue(iEchoFrameSize);
+		uiJitterBase = 0;
+		iMinBuffered = 1000;
 	} else {
 		srsEcho = NULL;
 		pfEchoInput = NULL;
+		eqEcho = NULL;
 	}
 
 	imfMic = chooseMixer(iMicChannels, eMicFormat);
@@ -386,37 +286,30 @@ void AudioInput::addMic(const void *data, unsigned int nsamp) {
 			}
 
 			// Convert float to 16bit PCM
-			const float mul = 32768.f;
-			for (int j = 0; j < iFrameSize; ++j)
-				psMic[j] = static_cast<short>(qBound(-32768.f, (ptr[j] * mul), 32767.f));
+			AudioKernels::floatToShort(psMic, ptr, iFrameSize);
 
 			// If we have echo chancellation enabled...
 			if (iEchoChannels > 0) {
-				short *echo = NULL;
+				const unsigned int queued = eqEcho->count();
 
-				{
-					QMutexLocker l(&qmEcho);
+				if (queued == 0) {
+					uiJitterBase = eqEcho->written();
+					iMinBuffered = 1000;
+				} else {
+					// Compensate for drift between the microphone and the echo source
+					iMinBuffered = qMin(iMinBuffered, static_cast<int>(queued));
 
-					if (qlEchoFrames.isEmpty()) {
-						iJitterSeq = 0;
+					if ((eqEcho->written() - uiJitterBase > 100) && (iMinBuffered > 1)) {
+						uiJitterBase = eqEcho->written();
 						iMinBuffered = 1000;
-					} else {
-						// Compensate for drift between the microphone and the echo source
-						iMinBuffered = qMin(iMinBuffered, qlEchoFrames.count());
-
-						if ((iJitterSeq > 100) && (iMinBuffered > 1)) {
-							iJitterSeq = 0;
-							iMinBuffered = 1000;
-							delete [] qlEchoFrames.takeFirst();
-						}
-						echo = qlEchoFrames.takeFirst();
+						eqEcho->pop();
 					}
-				}
 
-				if (echo) {
 					// We have echo data for the current frame, remember that
-					delete [] psSpeaker;
-					psSpeaker = echo;
+					if (! psSpeaker)
+						psSpeaker = new short[iEchoFrameSize];
+					memcpy(psSpeaker, eqEcho->front(), iEchoFrameSize * sizeof(short));
+					eqEcho->pop();
 				}
 			}
 
@@ -435,13 +328,11 @@ void AudioInput::addEcho(const void *data, unsigned int nsamp) {
 			const unsigned int samples = left * iEchoChannels;
 
 			if (eEchoFormat == SampleFloat) {
-				for (unsigned int i=0;i<samples;++i)
-					pfEchoInput[i] = reinterpret_cast<const float *>(data)[i];
+				memcpy(pfEchoInput, data, samples * sizeof(float));
 			}
 			else {
 				// 16bit PCM -> float
-				for (unsigned int i=0;i<samples;++i)
-					pfEchoInput[i] = static_cast<float>(reinterpret_cast<const short *>(data)[i]) * (1.0f / 32768.f);
+				AudioKernels::shortToFloat(pfEchoInput, reinterpret_cast<const short *>(data), samples);
 			}
 		} else {
 			// Mix echo channels (converts 16bit PCM -> float if needed)
@@ -473,18 +364,16 @@ void AudioInput::addEcho(const void *data, unsigned int nsamp) {
 				speex_resampler_process_interleaved_float(srsEcho, pfEchoInput, &inlen, pfOutput, &outlen);
 			}
 
-			short *outbuff = new short[iEchoFrameSize];
+			// Fill the next slot of the echo chancellers jitter buffer; if
+			// addMic() has stopped taking frames, drop this one
+			short *outbuff = eqEcho->reserve();
+			if (! outbuff)
+				continue;
 
 			// float -> 16bit PCM
-			const float mul = 32768.f;
-			for (unsigned int j=0;j<iEchoFrameSize;++j)
-				outbuff[j] = static_cast<short>(ptr[j] * mul);
-
-			// Push frame into the echo chancellers jitter buffer
-			QMutexLocker l(&qmEcho);
+			AudioKernels::floatToShort(outbuff, ptr, iEchoFrameSize);
 
-			iJitterSeq = qMin(iJitterSeq + 1,10000U);
-			qlEchoFrames.append(outbuff);
+			eqEcho->commit();
 		}
 	}
 }
@@ -42,6 +42,7 @@
 #include <vector>
 
 #include "Audio.h"
+#include "EchoQueue.h"
 #include "Settings.h"
 #include "Timer.h"
 #include "Message.h"
@@ -87,9 +88,10 @@ class AudioInput : public QThread {
 	private:
 		SpeexResamplerState *srsMic, *srsEcho;
 
-		QMutex qmEcho;
-		QList<short *> qlEchoFrames;
-		unsigned int iJitterSeq;
+		/// Echo frames from addEcho() waiting for addMic().
+		EchoQueue *eqEcho;
+		/// eqEcho->written() when the drift compensation last started over.
+		unsigned int uiJitterBase;
 		int iMinBuffered;
 
 		unsigned int iMicFilled, iEchoFilled;
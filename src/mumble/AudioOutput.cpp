@@ -34,6 +34,7 @@
 #include "AudioOutput.h"
 
 #include "AudioInput.h"
+#include "AudioKernels.h"
 #include "AudioOutputSample.h"
 #include "AudioOutputSpeech.h"
 #include "User.h"
@@ -105,6 +106,14 @@ AudioOutput::AudioOutput()
     , fSpeakerVolume(NULL)
     , bSpeakerPositional(NULL)
     
+    , fSpeakersRotated(NULL)
+    , uiCameraGeneration(0)
+    , uiGainGeneration(1)
+    
+    , iMixCapacity(0)
+    , pfMixPlanes(NULL)
+    , pfMixOutput(NULL)
+    
     , eSampleFormat(SampleFloat)
     
     , bRunning(true)
@@ -117,7 +126,7 @@ AudioOutput::AudioOutput()
     , qrwlOutputs()
     , qmOutputs() {
 	
-	// Nothing
+	memset(fGainSettings, 0, sizeof(fGainSettings));
 }
 
 AudioOutput::~AudioOutput() {
@@ -128,6 +137,9 @@ AudioOutput::~AudioOutput() {
 	delete [] fSpeakers;
 	delete [] fSpeakerVolume;
 	delete [] bSpeakerPositional;
+	delete [] fSpeakersRotated;
+	delete [] pfMixPlanes;
+	delete [] pfMixOutput;
 }
 
 // Here's the theory.
@@ -248,10 +260,22 @@ void AudioOutput::initializeMixer(const unsigned int *chanmasks, bool forceheadp
 	delete[] fSpeakers;
 	delete[] bSpeakerPositional;
 	delete[] fSpeakerVolume;
+	delete[] fSpeakersRotated;
+	delete[] pfMixPlanes;
+	delete[] pfMixOutput;
+
+	// Sized by the first mix() call
+	iMixCapacity = 0;
+	pfMixPlanes = NULL;
+	pfMixOutput = NULL;
 
 	fSpeakers = new float[iChannels * 3];
 	bSpeakerPositional = new bool[iChannels];
 	fSpeakerVolume = new float[iChannels];
+	fSpeakersRotated = new float[iChannels * 3];
+
+	// Forces updateListener() to rotate the new speakers
+	uiCameraGeneration = 0;
 
 	memset(fSpeakers, 0, sizeof(float) * iChannels * 3);
 	memset(bSpeakerPositional, 0, sizeof(bool) * iChannels);
@@ -361,10 +385,111 @@ void AudioOutput::initializeMixer(const unsigned int *chanmasks, bool forceheadp
 	qWarning("AudioOutput: Initialized %d channel %d hz mixer", iChannels, iMixerFreq);
 }
 
+void AudioOutput::reserveMix(unsigned int nsamp) {
+	if (nsamp <= iMixCapacity)
+		return;
+
+	delete [] pfMixPlanes;
+	delete [] pfMixOutput;
+
+	iMixCapacity = nsamp;
+	pfMixPlanes = new float[iChannels * iMixCapacity];
+	pfMixOutput = new float[iChannels * iMixCapacity];
+	vRecordBuffers.clear();
+}
+
+boost::shared_array<float> AudioOutput::recordBuffer(unsigned int nsamp) {
+	boost::shared_array<float> buffer;
+
+	// Only we hold a unique buffer, so the recorder thread is done with it
+	for (size_t i = 0; i < vRecordBuffers.size(); ++i) {
+		if (vRecordBuffers[i].unique()) {
+			buffer = vRecordBuffers[i];
+			break;
+		}
+	}
+	if (! buffer) {
+		buffer = boost::shared_array<float>(new float[iMixCapacity]);
+		vRecordBuffers.push_back(buffer);
+	}
+
+	memset(buffer.get(), 0, sizeof(float) * nsamp);
+	return buffer;
+}
+
+void AudioOutput::updateListener() {
+	const float settings[4] = { g.s.fAudioBloom, g.s.fAudioMinDistance, g.s.fAudioMaxDistance, g.s.fAudioMaxDistVolume };
+
+	if ((uiCameraGeneration == g.p->uiCameraGeneration) && (memcmp(settings, fGainSettings, sizeof(settings)) == 0))
+		return;
+
+	uiCameraGeneration = g.p->uiCameraGeneration;
+	memcpy(fGainSettings, settings, sizeof(settings));
+	++uiGainGeneration;
+
+	float front[3] = { g.p->fCameraFront[0], g.p->fCameraFront[1], g.p->fCameraFront[2] };
+	float top[3] = { g.p->fCameraTop[0], g.p->fCameraTop[1], g.p->fCameraTop[2] };
+
+	// Front vector is dominant; if it's zero we presume all is zero.
+
+	float flen = sqrtf(front[0]*front[0]+front[1]*front[1]+front[2]*front[2]);
+
+	if (flen > 0.0f) {
+		front[0] *= (1.0f / flen);
+		front[1] *= (1.0f / flen);
+		front[2] *= (1.0f / flen);
+
+		float tlen = sqrtf(top[0]*top[0]+top[1]*top[1]+top[2]*top[2]);
+
+		if (tlen > 0.0f) {
+			top[0] *= (1.0f / tlen);
+			top[1] *= (1.0f / tlen);
+			top[2] *= (1.0f / tlen);
+		} else {
+			top[0] = 0.0f;
+			top[1] = 1.0f;
+			top[2] = 0.0f;
+		}
+
+		if (std::abs<float>(front[0] * top[0] + front[1] * top[1] + front[2] * top[2]) > 0.01f) {
+			// Not perpendicular. Assume Y up and rotate 90 degrees.
+
+			float azimuth = 0.0f;
+			if ((front[0] != 0.0f) || (front[2] != 0.0f))
+				azimuth = atan2f(front[2], front[0]);
+			float inclination = acosf(front[1]) - static_cast<float>(M_PI) / 2.0f;
+
+			top[0] = sinf(inclination)*cosf(azimuth);
+			top[1] = cosf(inclination);
+			top[2] = sinf(inclination)*sinf(azimuth);
+		}
+	} else {
+		front[0] = 0.0f;
+		front[1] = 0.0f;
+		front[2] = 1.0f;
+
+		top[0] = 0.0f;
+		top[1] = 1.0f;
+		top[2] = 0.0f;
+	}
+
+	// Calculate right vector as front X top
+	float right[3] = {top[1]*front[2] - top[2]*front[1], top[2]*front[0] - top[0]*front[2], top[0]*front[1] - top[1] * front[0] };
+
+	/*
+				qWarning("Front: %f %f %f", front[0], front[1], front[2]);
+				qWarning("Top: %f %f %f", top[0], top[1], top[2]);
+				qWarning("Right: %f %f %f", right[0], right[1], right[2]);
+	*/
+	// Rotate speakers to match orientation
+	for (unsigned int i=0;i<iChannels;++i) {
+		fSpeakersRotated[3*i+0] = fSpeakers[3*i+0] * right[0] + fSpeakers[3*i+1] * top[0] + fSpeakers[3*i+2] * front[0];
+		fSpeakersRotated[3*i+1] = fSpeakers[3*i+0] * right[1] + fSpeakers[3*i+1] * top[1] + fSpeakers[3*i+2] * front[1];
+		fSpeakersRotated[3*i+2] = fSpeakers[3*i+0] * right[2] + fSpeakers[3*i+1] * top[2] + fSpeakers[3*i+2] * front[2];
+	}
+}
+
 bool AudioOutput::mix(void *outbuff, unsigned int nsamp) {
-	QList<AudioOutputUser *> qlMix;
-	QList<AudioOutputUser *> qlDel;
-	
 	if (g.s.fVolume < 0.01f) {
 		return false;
 	}
@@ -378,19 +503,25 @@ bool AudioOutput::mix(void *outbuff, unsigned int nsamp) {
 		recorder = g.sh->recorder;
 	}
 
+	vMixSources.clear();
+	vMixUsers.clear();
+	vMixDelete.clear();
+
 	qrwlOutputs.lockForRead();
 	
 	bool prioritySpeakerActive = false;
 	
+	// Speech outputs are keyed by their user, samples by NULL
 	QMultiHash<const ClientUser *, AudioOutputUser *>::const_iterator it = qmOutputs.constBegin();
 	while (it != qmOutputs.constEnd()) {
 		AudioOutputUser *aop = it.value();
 		if (! aop->needSamples(nsamp)) {
-			qlDel.append(aop);
+			vMixDelete.push_back(aop);
 		} else {
-			qlMix.append(aop);
-			
 			const ClientUser *user = it.key();
+			vMixSources.push_back(aop);
+			vMixUsers.push_back(user);
+			
 			if (user && user->bPrioritySpeaker) {
 				prioritySpeakerActive = true;
 			}
@@ -402,20 +533,24 @@ bool AudioOutput::mix(void *outbuff, unsigned int nsamp) {
 		prioritySpeakerActive = true;
 	}
 
-	if (! qlMix.isEmpty()) {
-		STACKVAR(float, speaker, iChannels*3);
+	if (! vMixSources.empty()) {
 		STACKVAR(float, svol, iChannels);
 
-		STACKVAR(float, fOutput, iChannels * nsamp);
-		float *output = (eSampleFormat == SampleFloat) ? reinterpret_cast<float *>(outbuff) : fOutput;
+		const size_t nsources = vMixSources.size();
 		bool validListener = false;
 
-		memset(output, 0, sizeof(float) * nsamp * iChannels);
+		reserveMix(nsamp);
+		vMixGain.resize(nsources * nchan);
+		vMixRamp.resize(nsources * nchan);
+
+		float * RESTRICT planes = pfMixPlanes;
+		memset(planes, 0, sizeof(float) * nsamp * nchan);
 
 		boost::shared_array<float> recbuff;
+		const ClientUser *recordUser = NULL;
 		if (recorder) {
-			recbuff = boost::shared_array<float>(new float[nsamp]);
-			memset(recbuff.get(), 0, sizeof(float) * nsamp);
+			recbuff = recordBuffer(nsamp);
+			recordUser = &recorder->getRecordUser();
 			recorder->prepareBufferAdds();
 		}
 
@@ -423,173 +558,129 @@ bool AudioOutput::mix(void *outbuff, unsigned int nsamp) {
 			svol[i] = mul * fSpeakerVolume[i];
 
 		if (g.s.bPositionalAudio && (iChannels > 1) && g.p->fetch() && (g.bPosTest || g.p->fCameraPosition[0] != 0 || g.p->fCameraPosition[1] != 0 || g.p->fCameraPosition[2] != 0)) {
-
-			float front[3] = { g.p->fCameraFront[0], g.p->fCameraFront[1], g.p->fCameraFront[2] };
-			float top[3] = { g.p->fCameraTop[0], g.p->fCameraTop[1], g.p->fCameraTop[2] };
-
-			// Front vector is dominant; if it's zero we presume all is zero.
-
-			float flen = sqrtf(front[0]*front[0]+front[1]*front[1]+front[2]*front[2]);
-
-			if (flen > 0.0f) {
-				front[0] *= (1.0f / flen);
-				front[1] *= (1.0f / flen);
-				front[2] *= (1.0f / flen);
-
-				float tlen = sqrtf(top[0]*top[0]+top[1]*top[1]+top[2]*top[2]);
-
-				if (tlen > 0.0f) {
-					top[0] *= (1.0f / tlen);
-					top[1] *= (1.0f / tlen);
-					top[2] *= (1.0f / tlen);
-				} else {
-					top[0] = 0.0f;
-					top[1] = 1.0f;
-					top[2] = 0.0f;
-				}
-
-				if (std::abs<float>(front[0] * top[0] + front[1] * top[1] + front[2] * top[2]) > 0.01f) {
-					// Not perpendicular. Assume Y up and rotate 90 degrees.
-
-					float azimuth = 0.0f;
-					if ((front[0] != 0.0f) || (front[2] != 0.0f))
-						azimuth = atan2f(front[2], front[0]);
-					float inclination = acosf(front[1]) - static_cast<float>(M_PI) / 2.0f;
-
-					top[0] = sinf(inclination)*cosf(azimuth);
-					top[1] = cosf(inclination);
-					top[2] = sinf(inclination)*sinf(azimuth);
-				}
-			} else {
-				front[0] = 0.0f;
-				front[1] = 0.0f;
-				front[2] = 1.0f;
-
-				top[0] = 0.0f;
-				top[1] = 1.0f;
-				top[2] = 0.0f;
-			}
-
-			// Calculate right vector as front X top
-			float right[3] = {top[1]*front[2] - top[2]*front[1], top[2]*front[0] - top[0]*front[2], top[0]*front[1] - top[1] * front[0] };
-
-			/*
-						qWarning("Front: %f %f %f", front[0], front[1], front[2]);
-						qWarning("Top: %f %f %f", top[0], top[1], top[2]);
-						qWarning("Right: %f %f %f", right[0], right[1], right[2]);
-			*/
-			// Rotate speakers to match orientation
-			for (unsigned int i=0;i<iChannels;++i) {
-				speaker[3*i+0] = fSpeakers[3*i+0] * right[0] + fSpeakers[3*i+1] * top[0] + fSpeakers[3*i+2] * front[0];
-				speaker[3*i+1] = fSpeakers[3*i+0] * right[1] + fSpeakers[3*i+1] * top[1] + fSpeakers[3*i+2] * front[1];
-				speaker[3*i+2] = fSpeakers[3*i+0] * right[2] + fSpeakers[3*i+1] * top[2] + fSpeakers[3*i+2] * front[2];
-			}
+			updateListener();
 			validListener = true;
 		}
 
-		foreach(AudioOutputUser *aop, qlMix) {
+		// Work out the gains of every source first, then mix them a channel at a time
+		for (size_t k = 0; k < nsources; ++k) {
+			AudioOutputUser *aop = vMixSources[k];
+			const ClientUser *user = vMixUsers[k];
 			const float * RESTRICT pfBuffer = aop->pfBuffer;
+			float *gain = &vMixGain[k * nchan];
+			float *ramp = &vMixRamp[k * nchan];
 			float volumeAdjustment = 1;
 
-			if (prioritySpeakerActive) {
-				AudioOutputSpeech *speech = qobject_cast<AudioOutputSpeech *>(aop);
-				if (speech) {
-					const ClientUser* user = speech->p;
+			if (prioritySpeakerActive && user) {
+				if (user->tsState != Settings::Whispering
+				    && !user->bPrioritySpeaker) {
 					
-					if (user->tsState != Settings::Whispering
-					    && !user->bPrioritySpeaker) {
-						
-						volumeAdjustment = adjustFactor;
-					}
+					volumeAdjustment = adjustFactor;
 				}
 			}
 
-			if (recorder) {
-				AudioOutputSpeech *aos = qobject_cast<AudioOutputSpeech *>(aop);
+			if (recorder && user) {
+				AudioKernels::mixAdd(recbuff.get(), pfBuffer, volumeAdjustment, nsamp);
 
-				if (aos) {
-					for (unsigned int i = 0; i < nsamp; ++i) {
-						recbuff[i] += pfBuffer[i] * volumeAdjustment;
-					}
-
-					if (!recorder->isInMixDownMode()) {
-						if (aos) {
-							recorder->addBuffer(aos->p, recbuff, nsamp);
-						} else {
-							// this should be unreachable
-							Q_ASSERT(false);
-						}
-						recbuff = boost::shared_array<float>(new float[nsamp]);
-						memset(recbuff.get(), 0, sizeof(float) * nsamp);
-					}
+				if (!recorder->isInMixDownMode()) {
+					recorder->addBuffer(user, recbuff, nsamp);
+					recbuff = recordBuffer(nsamp);
+				}
 
-					// Don't add the local audio to the real output
-					if (qobject_cast<RecordUser *>(aos->p)) {
-						continue;
-					}
+				// Don't add the local audio to the real output
+				if (user == recordUser) {
+					memset(gain, 0, sizeof(float) * nchan);
+					memset(ramp, 0, sizeof(float) * nchan);
+					continue;
 				}
 			}
 
 			if (validListener && ((aop->fPos[0] != 0.0f) || (aop->fPos[1] != 0.0f) || (aop->fPos[2] != 0.0f))) {
-				float dir[3] = { aop->fPos[0] - g.p->fCameraPosition[0], aop->fPos[1] - g.p->fCameraPosition[1], aop->fPos[2] - g.p->fCameraPosition[2] };
-				float len = sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
-				if (len > 0.0f) {
-					dir[0] /= len;
-					dir[1] /= len;
-					dir[2] /= len;
-				}
-				/*
-								qWarning("Voice pos: %f %f %f", aop->fPos[0], aop->fPos[1], aop->fPos[2]);
-								qWarning("Voice dir: %f %f %f", dir[0], dir[1], dir[2]);
-				*/
 				if (! aop->pfVolume) {
 					aop->pfVolume = new float[nchan];
 					for (unsigned int s=0;s<nchan;++s)
 						aop->pfVolume[s] = -1.0;
 				}
+				if (! aop->pfGain)
+					aop->pfGain = new float[nchan];
+
+				// Only redo the geometry when the source or the listener moved
+				if ((aop->uiGainGeneration != uiGainGeneration) || (memcmp(aop->fGainPos, aop->fPos, sizeof(aop->fPos)) != 0)) {
+					float dir[3] = { aop->fPos[0] - g.p->fCameraPosition[0], aop->fPos[1] - g.p->fCameraPosition[1], aop->fPos[2] - g.p->fCameraPosition[2] };
+					float len = sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+					if (len > 0.0f) {
+						dir[0] /= len;
+						dir[1] /= len;
+						dir[2] /= len;
+					}
+					/*
+									qWarning("Voice pos: %f %f %f", aop->fPos[0], aop->fPos[1], aop->fPos[2]);
+									qWarning("Voice dir: %f %f %f", dir[0], dir[1], dir[2]);
+					*/
+					const float *speaker = fSpeakersRotated;
+					for (unsigned int s=0;s<nchan;++s) {
+						const float dot = bSpeakerPositional[s] ? dir[0] * speaker[s*3+0] + dir[1] * speaker[s*3+1] + dir[2] * speaker[s*3+2] : 1.0f;
+						aop->pfGain[s] = calcGain(dot, len);
+						/*
+											qWarning("%d: Pos %f %f %f : Dot %f Len %f Gain %f", s, speaker[s*3+0], speaker[s*3+1], speaker[s*3+2], dot, len, aop->pfGain[s]);
+						*/
+					}
+					memcpy(aop->fGainPos, aop->fPos, sizeof(aop->fPos));
+					aop->uiGainGeneration = uiGainGeneration;
+				}
 				for (unsigned int s=0;s<nchan;++s) {
-					const float dot = bSpeakerPositional[s] ? dir[0] * speaker[s*3+0] + dir[1] * speaker[s*3+1] + dir[2] * speaker[s*3+2] : 1.0f;
-					const float str = svol[s] * calcGain(dot, len) * volumeAdjustment;
-					float * RESTRICT o = output + s;
+					const float str = svol[s] * aop->pfGain[s] * volumeAdjustment;
 					const float old = (aop->pfVolume[s] >= 0.0f) ? aop->pfVolume[s] : str;
-					const float inc = (str - old) / static_cast<float>(nsamp);
 					aop->pfVolume[s] = str;
-					/*
-										qWarning("%d: Pos %f %f %f : Dot %f Len %f Str %f", s, speaker[s*3+0], speaker[s*3+1], speaker[s*3+2], dot, len, str);
-					*/
-					if ((old >= 0.00000001f) || (str >= 0.00000001f))
-						for (unsigned int i=0;i<nsamp;++i)
-							o[i*nchan] += pfBuffer[i] * (old + inc*static_cast<float>(i));
+					if ((old >= 0.00000001f) || (str >= 0.00000001f)) {
+						gain[s] = old;
+						ramp[s] = (str - old) / static_cast<float>(nsamp);
+					} else {
+						gain[s] = 0.0f;
+						ramp[s] = 0.0f;
+					}
 				}
 			} else {
 				for (unsigned int s=0;s<nchan;++s) {
-					const float str = svol[s] * volumeAdjustment;
-					float * RESTRICT o = output + s;
-					for (unsigned int i=0;i<nsamp;++i)
-						o[i*nchan] += pfBuffer[i] * str;
+					gain[s] = svol[s] * volumeAdjustment;
+					ramp[s] = 0.0f;
 				}
 			}
 		}
 
+		for (unsigned int s=0;s<nchan;++s) {
+			float * RESTRICT o = planes + s * nsamp;
+			for (size_t k = 0; k < nsources; ++k) {
+				const float gain = vMixGain[k * nchan + s];
+				const float ramp = vMixRamp[k * nchan + s];
+				if (ramp != 0.0f)
+					AudioKernels::mixRamp(o, vMixSources[k]->pfBuffer, gain, ramp, nsamp);
+				else if (gain != 0.0f)
+					AudioKernels::mixAdd(o, vMixSources[k]->pfBuffer, gain, nsamp);
+			}
+		}
+
 		if (recorder && recorder->isInMixDownMode()) {
 			recorder->addBuffer(NULL, recbuff, nsamp);
 		}
 
-		// Clip
-		if (eSampleFormat == SampleFloat)
-			for (unsigned int i=0;i<nsamp*iChannels;i++)
-				output[i] = qBound(-1.0f, output[i], 1.0f);
-		else
-			for (unsigned int i=0;i<nsamp*iChannels;i++)
-				reinterpret_cast<short *>(outbuff)[i] = static_cast<short>(qBound(-32768.f, (output[i] * 32768.f), 32767.f));
+		// Interleave and clip
+		if (eSampleFormat == SampleFloat) {
+			float *output = reinterpret_cast<float *>(outbuff);
+			AudioKernels::interleave(output, planes, nchan, nsamp);
+			AudioKernels::clip(output, nsamp * nchan);
+		} else {
+			AudioKernels::interleave(pfMixOutput, planes, nchan, nsamp);
+			AudioKernels::floatToShort(reinterpret_cast<short *>(outbuff), pfMixOutput, nsamp * nchan);
+		}
 	}
 
 	qrwlOutputs.unlock();
 
-	foreach(AudioOutputUser *aop, qlDel)
-		removeBuffer(aop);
+	for (size_t i = 0; i < vMixDelete.size(); ++i)
+		removeBuffer(vMixDelete[i]);
 	
-	return (! qlMix.isEmpty());
+	return (! vMixSources.empty());
 }
 
 bool AudioOutput::isAlive() const {
@@ -32,9 +32,11 @@
 #ifndef MUMBLE_MUMBLE_AUDIOOUTPUT_H_
 #define MUMBLE_MUMBLE_AUDIOOUTPUT_H_
 
+#include <boost/shared_array.hpp>
 #include <boost/shared_ptr.hpp>
 #include <QtCore/QObject>
 #include <QtCore/QThread>
+#include <vector>
 
 // AudioOutput depends on User being valid. This means it's important
 // to removeBuffer from here BEFORE MainWindow gets any UserLeft
@@ -102,6 +104,35 @@ class AudioOutput : public QThread {
 		float *fSpeakers;
 		float *fSpeakerVolume;
 		bool *bSpeakerPositional;
+
+		/// fSpeakers rotated to the listener's orientation by updateListener().
+		float *fSpeakersRotated;
+		/// Camera generation and calcGain() settings fSpeakersRotated was made for.
+		unsigned int uiCameraGeneration;
+		float fGainSettings[4];
+		/// Bumped whenever the positional gains cached in AudioOutputUser go stale.
+		unsigned int uiGainGeneration;
+
+		void updateListener();
+
+		/// Scratch space of mix(), kept between calls so the audio callback
+		/// only allocates when the frame size or the number of sources grows.
+		unsigned int iMixCapacity;
+		/// One plane of iMixCapacity samples per channel.
+		float *pfMixPlanes;
+		/// Interleaved output before conversion to 16 bit.
+		float *pfMixOutput;
+		std::vector<AudioOutputUser *> vMixSources;
+		std::vector<const ClientUser *> vMixUsers;
+		std::vector<AudioOutputUser *> vMixDelete;
+		/// Gain at the first sample and per sample increment, iChannels per source.
+		std::vector<float> vMixGain;
+		std::vector<float> vMixRamp;
+		/// Buffers handed to the recorder; reused once it dropped them.
+		std::vector<boost::shared_array<float> > vRecordBuffers;
+
+		void reserveMix(unsigned int nsamp);
+		boost::shared_array<float> recordBuffer(unsigned int nsamp);
 	protected:
 		enum { SampleShort, SampleFloat } eSampleFormat;
 		volatile bool bRunning;
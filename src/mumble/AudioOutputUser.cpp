@@ -37,12 +37,16 @@ AudioOutputUser::AudioOutputUser(const QString& name) : qsName(name) {
 	iBufferSize = 0;
 	pfBuffer = NULL;
 	pfVolume = NULL;
+	pfGain = NULL;
+	uiGainGeneration = 0;
 	fPos[0]=fPos[1]=fPos[2]=0.0;
+	fGainPos[0]=fGainPos[1]=fGainPos[2]=0.0;
 }
 
 AudioOutputUser::~AudioOutputUser() {
 	delete [] pfBuffer;
 	delete [] pfVolume;
+	delete [] pfGain;
 }
 
 void AudioOutputUser::resizeBuffer(unsigned int newsize) {
@@ -48,6 +48,10 @@ class AudioOutputUser : public QObject {
 		float *pfBuffer;
 		float *pfVolume;
 		float fPos[3];
+		/// Positional gain per speaker, valid while fGainPos and uiGainGeneration match.
+		float *pfGain;
+		float fGainPos[3];
+		unsigned int uiGainGeneration;
 		virtual bool needSamples(unsigned int snum) = 0;
 };
 
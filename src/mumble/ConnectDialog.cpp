@@ -49,6 +49,13 @@ QList<PublicInfo> ConnectDialog::qlPublicServers;
 QString ConnectDialog::qsUserCountry, ConnectDialog::qsUserCountryCode, ConnectDialog::qsUserContinentCode;
 Timer ConnectDialog::tPublicServers;
 
+/// Host name lookups running at the same time.
+#define DNS_PARALLEL 16
+/// Pings sent per tick of the ping timer.
+#define PING_BATCH 64
+/// Microseconds after which a ping counts as lost.
+#define PING_TIMEOUT 10000000ULL
+
 
 PingStats::PingStats() {
 	init();
@@ -895,7 +902,6 @@ ConnectDialog::ConnectDialog(QWidget *p, bool autoconnect) : QDialog(p), bAutoCo
 		qtwServers->siPublic->setExpanded(true);
 	}
 
-	iPingIndex = -1;
 	qtPingTick->start(50);
 
 	new QShortcut(QKeySequence(QKeySequence::Copy), this, SLOT(on_qaFavoriteCopy_triggered()));
@@ -1311,8 +1317,10 @@ void ConnectDialog::timeTick() {
 		}
 	}
 
-	// Start DNS Lookup of first unknown hostname
+	// Keep up to DNS_PARALLEL lookups of unknown hostnames running
 	foreach(const QString &host, qlDNSLookup) {
+		if (qsDNSActive.count() >= DNS_PARALLEL)
+			break;
 		if (qsDNSActive.contains(host))
 			continue;
 
@@ -1321,7 +1329,17 @@ void ConnectDialog::timeTick() {
 
 		qsDNSActive.insert(host);
 		QHostInfo::lookupHost(host, this, SLOT(lookedUp(QHostInfo)));
-		break;
+	}
+
+	if (tPingPrune.isElapsed(1000000ULL)) {
+		const quint64 now = tPing.elapsed();
+		QHash<quint64, PingRequest>::iterator i = qhPingOutstanding.begin();
+		while (i != qhPingOutstanding.end()) {
+			if (now - i->uiSent > PING_TIMEOUT)
+				i = qhPingOutstanding.erase(i);
+			else
+				++i;
+		}
 	}
 
 	ServerItem *current = static_cast<ServerItem *>(qtwServers->currentItem());
@@ -1346,38 +1364,56 @@ void ConnectDialog::timeTick() {
 		}
 	}
 
-	if (!si) {
-		if (qlItems.isEmpty())
-			return;
+	if (si) {
+		if (si == current)
+			tCurrent.restart();
+		if (si == hover)
+			tHover.restart();
 
-		bool expanded;
+		foreach(const QHostAddress &host, si->qlAddresses)
+			sendPing(host, si->usPort);
+	}
 
-		do {
-			++iPingIndex;
-			if (iPingIndex >= qlItems.count()) {
-				if (tRestart.isElapsed(1000000ULL))
-					iPingIndex = 0;
-				else
-					return;
-			}
-			si = qlItems.at(iPingIndex);
+	// Work through the list in paced batches, starting a new pass at most once a second
+	if (qlPingQueue.isEmpty() && tRestart.isElapsed(1000000ULL))
+		fillPingQueue();
 
-			ServerItem *p = si->siParent;
-			expanded = true;
-			while (p && expanded) {
-				expanded = expanded && p->isExpanded();
-				p = p->siParent;
-			}
-		} while (si->qlAddresses.isEmpty() || ! expanded);
+	for (int i = 0; (i < PING_BATCH) && ! qlPingQueue.isEmpty(); ++i) {
+		const qpAddress addr = qlPingQueue.takeFirst();
+		if (qhPings.contains(addr))
+			sendPing(addr.first, addr.second);
 	}
+}
 
-	if (si == current)
-		tCurrent.restart();
-	if (si == hover)
-		tHover.restart();
+static bool isShown(const ServerItem *si) {
+	for (const ServerItem *p = si->siParent; p; p = p->siParent)
+		if (! p->isExpanded())
+			return false;
+	return true;
+}
 
-	foreach(const QHostAddress &host, si->qlAddresses)
-		sendPing(host, si->usPort);
+/// Queues every resolved address with a visible item, favorites and LAN servers first.
+void ConnectDialog::fillPingQueue() {
+	QList<qpAddress> qlPublic;
+
+	QHash<qpAddress, QSet<ServerItem *> >::const_iterator i;
+	for (i = qhPings.constBegin(); i != qhPings.constEnd(); ++i) {
+		bool shown = false;
+		bool pub = true;
+		foreach(const ServerItem *si, i.value()) {
+			if (isShown(si)) {
+				shown = true;
+				pub = pub && (si->itType == ServerItem::PublicType);
+			}
+		}
+		if (! shown)
+			continue;
+		if (pub)
+			qlPublic << i.key();
+		else
+			qlPingQueue << i.key();
+	}
+	qlPingQueue << qlPublic;
 }
 
 
@@ -1491,8 +1527,11 @@ void ConnectDialog::sendPing(const QHostAddress &host, unsigned short port) {
 		qhPingRand.insert(addr, uiRand);
 	}
 
+	const quint64 now = tPing.elapsed();
+	const quint64 token = now ^ uiRand;
+
 	memset(blob, 0, sizeof(blob));
-	* reinterpret_cast<quint64 *>(blob+8) = tPing.elapsed() ^ uiRand;
+	* reinterpret_cast<quint64 *>(blob+8) = token;
 
 	if (bIPv4 && host.protocol() == QAbstractSocket::IPv4Protocol)
 		qusSocket4->writeDatagram(blob+4, 12, host, port);
@@ -1501,6 +1540,10 @@ void ConnectDialog::sendPing(const QHostAddress &host, unsigned short port) {
 	else
 		return;
 
+	PingRequest &pr = qhPingOutstanding[token];
+	pr.qpAddr = addr;
+	pr.uiSent = now;
+
 	const QSet<ServerItem *> &qs = qhPings.value(addr);
 
 	foreach(ServerItem *si, qs)
@@ -1521,11 +1564,14 @@ void ConnectDialog::udpReply() {
 				host.setScopeId(QLatin1String(""));
 
 			qpAddress address(host, port);
-			if (qhPings.contains(address)) {
-				quint32 *ping = reinterpret_cast<quint32 *>(blob+4);
-				quint64 *ts = reinterpret_cast<quint64 *>(blob+8);
-
-				quint64 elapsed = tPing.elapsed() - (*ts ^ qhPingRand.value(address));
+			quint32 *ping = reinterpret_cast<quint32 *>(blob+4);
+			quint64 *ts = reinterpret_cast<quint64 *>(blob+8);
+
+			// Replies echo the token of the ping they answer
+			QHash<quint64, PingRequest>::iterator req = qhPingOutstanding.find(*ts);
+			if ((req != qhPingOutstanding.end()) && (req->qpAddr == address)) {
+				quint64 elapsed = tPing.elapsed() - req->uiSent;
+				qhPingOutstanding.erase(req);
 
 				foreach(ServerItem *si, qhPings.value(address)) {
 					si->uiVersion = qFromBigEndian(ping[0]);
@@ -235,17 +235,27 @@ class ConnectDialog : public QDialog, public Ui::ConnectDialog {
 		QHash<qpAddress, quint64> qhPingRand;
 		QHash<qpAddress, QSet<ServerItem *> > qhPings;
 
+		struct PingRequest {
+			qpAddress qpAddr;
+			quint64 uiSent;
+		};
+		/// Pings awaiting a reply, keyed by the token they carry.
+		QHash<quint64, PingRequest> qhPingOutstanding;
+		/// Addresses left to ping in the current pass over the list.
+		QList<qpAddress> qlPingQueue;
+		Timer tPingPrune;
+
 		QMap<QPair<QString, unsigned short>, unsigned int> qmPingCache;
 
 		bool bIPv4;
 		bool bIPv6;
-		int iPingIndex;
 
 		bool bLastFound;
 
 		QMap<QString, QIcon> qmIcons;
 
 		void sendPing(const QHostAddress &, unsigned short port);
+		void fillPingQueue();
 
 		void initList();
 		void fillList();
@@ -0,0 +1,127 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MUMBLE_ECHOQUEUE_H_
+#define MUMBLE_MUMBLE_ECHOQUEUE_H_
+
+#include <QtCore/QAtomicInt>
+
+/**
+ * Echo reference frames passed from the playback to the capture callback.
+ *
+ * All frames live in one block allocated up front, used as a single-producer
+ * single-consumer ring: the playback side fills the slot returned by
+ * reserve() and publishes it with commit(), the capture side reads front()
+ * and hands the slot back with pop(). Neither side allocates or waits on
+ * the other. When the capture side stops consuming, new frames are dropped
+ * instead of queued.
+ *
+ * Everything is inline so the class can be tested without the rest of the
+ * client.
+ */
+class EchoQueue {
+	private:
+		Q_DISABLE_COPY(EchoQueue)
+	public:
+		/// Number of slots; must be a power of two.
+		static const unsigned int uiSlots = 32;
+
+		explicit EchoQueue(unsigned int framesize) : qaiHead(0), qaiTail(0), uiFrameSize(framesize) {
+			psBuffer = new short[uiSlots * uiFrameSize];
+		}
+		~EchoQueue() {
+			delete [] psBuffer;
+		}
+
+		unsigned int frameSize() const {
+			return uiFrameSize;
+		}
+
+		/// Producer side. The slot for the next frame, or NULL if the queue is full.
+		short *reserve() {
+			const unsigned int head = load(qaiHead);
+			if (head - loadAcquire(qaiTail) >= uiSlots)
+				return NULL;
+			return psBuffer + (head & (uiSlots - 1)) * uiFrameSize;
+		}
+		/// Producer side. Publishes the frame written to the slot from reserve().
+		void commit() {
+			storeRelease(qaiHead, load(qaiHead) + 1);
+		}
+		/// Number of frames committed since construction, wrapping at 2^32.
+		unsigned int written() const {
+			return loadAcquire(qaiHead);
+		}
+
+		/// Consumer side.
+		unsigned int count() const {
+			return loadAcquire(qaiHead) - load(qaiTail);
+		}
+		/// Consumer side. The oldest frame; only valid if count() is nonzero.
+		const short *front() const {
+			return psBuffer + (load(qaiTail) & (uiSlots - 1)) * uiFrameSize;
+		}
+		/// Consumer side. Releases the oldest frame.
+		void pop() {
+			storeRelease(qaiTail, load(qaiTail) + 1);
+		}
+	protected:
+		QAtomicInt qaiHead;
+		char cPadHead[64 - sizeof(QAtomicInt)];
+		QAtomicInt qaiTail;
+		char cPadTail[64 - sizeof(QAtomicInt)];
+		unsigned int uiFrameSize;
+		short *psBuffer;
+
+		// Each index is only written by its own side, so that side can read it relaxed.
+		static unsigned int load(const QAtomicInt &v) {
+#if QT_VERSION >= 0x050000
+			return static_cast<unsigned int>(v.load());
+#else
+			return static_cast<unsigned int>(static_cast<int>(v));
+#endif
+		}
+		static unsigned int loadAcquire(const QAtomicInt &v) {
+#if QT_VERSION >= 0x050000
+			return static_cast<unsigned int>(v.loadAcquire());
+#else
+			return static_cast<unsigned int>(const_cast<QAtomicInt &>(v).fetchAndAddAcquire(0));
+#endif
+		}
+		static void storeRelease(QAtomicInt &v, unsigned int value) {
+#if QT_VERSION >= 0x050000
+			v.storeRelease(static_cast<int>(value));
+#else
+			v.fetchAndStoreRelease(static_cast<int>(value));
+#endif
+		}
+};
+
+#endif
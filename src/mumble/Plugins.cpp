@@ -223,7 +223,10 @@ Plugins::Plugins(QObject *p) : QObject(p) {
 	bValid = false;
 	iPluginTry = 0;
 	for (int i=0;i<3;i++)
-		fPosition[i]=fFront[i]=fTop[i]= 0.0;
+		fPosition[i]=fFront[i]=fTop[i]=fCameraPosition[i]=fCameraFront[i]=fCameraTop[i]= 0.0;
+	for (int i=0;i<9;i++)
+		fCameraLast[i] = 0.0f;
+	uiCameraGeneration = 1;
 	QMetaObject::connectSlotsByName(this);
 
 #ifdef QT_NO_DEBUG
@@ -365,6 +368,7 @@ bool Plugins::fetch() {
 			fCameraTop[i] = fTop[i];
 		}
 
+		updateCameraGeneration();
 		bValid = true;
 		return true;
 	}
@@ -401,10 +405,22 @@ bool Plugins::fetch() {
 				fPosition[i]=fFront[i]=fTop[i]=fCameraPosition[i]=fCameraFront[i]=fCameraTop[i] = 0.0f;
 		}
 	}
+	updateCameraGeneration();
 	bValid = ok;
 	return bValid;
 }
 
+void Plugins::updateCameraGeneration() {
+	const float camera[9] = { fCameraPosition[0], fCameraPosition[1], fCameraPosition[2],
+	                          fCameraFront[0], fCameraFront[1], fCameraFront[2],
+	                          fCameraTop[0], fCameraTop[1], fCameraTop[2] };
+
+	if (memcmp(camera, fCameraLast, sizeof(camera)) != 0) {
+		memcpy(fCameraLast, camera, sizeof(camera));
+		++uiCameraGeneration;
+	}
+}
+
 void Plugins::on_Timer_timeout() {
 	fetch();
 
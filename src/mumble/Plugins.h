@@ -82,6 +82,8 @@ class Plugins : public QObject {
 		void clearPlugins();
 		int iPluginTry;
 		QMap<QString, PluginFetchMeta> qmPluginFetchMeta;
+		float fCameraLast[9];
+		void updateCameraGeneration();
 		QString qsSystemPlugins;
 		QString qsUserPlugins;
 #ifdef Q_OS_WIN
@@ -96,6 +98,8 @@ class Plugins : public QObject {
 		bool bUnlink;
 		float fPosition[3], fFront[3], fTop[3];
 		float fCameraPosition[3], fCameraFront[3], fCameraTop[3];
+		/// Changes whenever fetch() sees the camera move, so anything derived from it can be cached.
+		unsigned int uiCameraGeneration;
 
 		Plugins(QObject *p = NULL);
 		~Plugins() Q_DECL_OVERRIDE;
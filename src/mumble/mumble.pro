@@ -69,6 +69,7 @@ HEADERS *= BanEditor.h \
     AudioConfigDialog.h \
     AudioStats.h \
     AudioInput.h \
+    EchoQueue.h \
     AudioOutput.h \
     AudioOutputSample.h \
     AudioOutputSpeech.h \
@@ -113,6 +114,7 @@ HEADERS *= BanEditor.h \
     VoiceRecorderDialog.h \
     WebFetch.h \
     ../SignalCurry.h \
+    ../AudioKernels.h \
     OverlayClient.h \
     OverlayUser.h \
     OverlayUserGroup.h \
@@ -129,6 +131,7 @@ SOURCES *= BanEditor.cpp \
     AudioConfigDialog.cpp \
     AudioStats.cpp \
     AudioInput.cpp \
+    ../AudioKernels.cpp \
     AudioOutput.cpp \
     AudioOutputSample.cpp \
     AudioOutputSpeech.cpp \
@@ -0,0 +1,189 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "murmur_pch.h"
+
+#include "BanTrie.h"
+
+static inline int bitAt(const HostAddress &ha, int bit) {
+	return (ha.qip6.c[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+static HostAddress masked(const HostAddress &ha, int bits) {
+	HostAddress r = ha;
+	for (int i = 0; i < 16; ++i) {
+		if (bits >= 8)
+			bits -= 8;
+		else if (bits > 0) {
+			r.qip6.c[i] &= static_cast<quint8>(0xff << (8 - bits));
+			bits = 0;
+		} else
+			r.qip6.c[i] = 0;
+	}
+	return r;
+}
+
+// Number of leading bits a and b have in common, up to limit.
+static int commonBits(const HostAddress &a, const HostAddress &b, int limit) {
+	int bits = 0;
+	for (int i = 0; (i < 16) && (bits < limit); ++i) {
+		quint8 diff = a.qip6.c[i] ^ b.qip6.c[i];
+		if (! diff) {
+			bits += 8;
+			continue;
+		}
+		while (! (diff & 0x80)) {
+			diff = static_cast<quint8>(diff << 1);
+			++bits;
+		}
+		break;
+	}
+	return qMin(bits, limit);
+}
+
+BanTrie::BanTrie() {
+	iRoot = -1;
+}
+
+void BanTrie::clear() {
+	qvNodes.clear();
+	qmExpiry.clear();
+	iRoot = -1;
+}
+
+int BanTrie::nodes() const {
+	return qvNodes.count();
+}
+
+quint64 BanTrie::expiry(const Ban &ban) {
+	if (ban.iDuration <= 0)
+		return Permanent;
+	return static_cast<quint64>(ban.qdtStart.toTime_t()) + static_cast<quint64>(ban.iDuration);
+}
+
+quint64 BanTrie::now() {
+	return QDateTime::currentDateTime().toUTC().toTime_t();
+}
+
+int BanTrie::addNode(const HostAddress &prefix, int bits, quint64 exp) {
+	Node n;
+	n.haPrefix = prefix;
+	n.iBits = bits;
+	n.iChild[0] = n.iChild[1] = -1;
+	n.uiExpiry = exp;
+	qvNodes.append(n);
+	return qvNodes.count() - 1;
+}
+
+void BanTrie::insert(const Ban &ban) {
+	const int bits = qBound(0, ban.iMask, 128);
+	const HostAddress prefix = masked(ban.haAddress, bits);
+	const quint64 exp = expiry(ban);
+
+	if (exp != Permanent)
+		++qmExpiry[exp];
+
+	if (iRoot < 0) {
+		iRoot = addNode(prefix, bits, exp);
+		return;
+	}
+
+	// Slot holding the index of the node we are looking at; nodes are referred
+	// to by index since addNode() may reallocate the vector.
+	int parent = -1;
+	int side = 0;
+	int idx = iRoot;
+
+	forever {
+		const int nbits = qvNodes.at(idx).iBits;
+		const int common = commonBits(prefix, qvNodes.at(idx).haPrefix, qMin(bits, nbits));
+
+		if (common < nbits) {
+			// The new prefix branches off above this node (or is a prefix of it);
+			// put a node for the shared part in between.
+			int split;
+			if (common == bits) {
+				split = addNode(prefix, bits, exp);
+			} else {
+				split = addNode(masked(prefix, common), common, 0);
+				const int leaf = addNode(prefix, bits, exp);
+				qvNodes[split].iChild[bitAt(prefix, common)] = leaf;
+			}
+			qvNodes[split].iChild[bitAt(qvNodes.at(idx).haPrefix, common)] = idx;
+
+			if (parent < 0)
+				iRoot = split;
+			else
+				qvNodes[parent].iChild[side] = split;
+			return;
+		}
+
+		if (bits == nbits) {
+			Node &n = qvNodes[idx];
+			n.uiExpiry = qMax(n.uiExpiry, exp);
+			return;
+		}
+
+		parent = idx;
+		side = bitAt(prefix, nbits);
+		idx = qvNodes.at(parent).iChild[side];
+		if (idx < 0) {
+			const int leaf = addNode(prefix, bits, exp);
+			qvNodes[parent].iChild[side] = leaf;
+			return;
+		}
+	}
+}
+
+void BanTrie::rebuild(const QList<Ban> &bans) {
+	clear();
+	qvNodes.reserve(bans.count() * 2);
+	foreach(const Ban &ban, bans)
+		insert(ban);
+}
+
+bool BanTrie::match(const HostAddress &ha, quint64 t) const {
+	int idx = iRoot;
+	while (idx >= 0) {
+		const Node &n = qvNodes.at(idx);
+		if (commonBits(ha, n.haPrefix, n.iBits) < n.iBits)
+			return false;
+		if (n.uiExpiry >= t)
+			return true;
+		if (n.iBits >= 128)
+			return false;
+		idx = n.iChild[bitAt(ha, n.iBits)];
+	}
+	return false;
+}
+
+bool BanTrie::hasExpired(quint64 t) const {
+	return ! qmExpiry.isEmpty() && (qmExpiry.constBegin().key() < t);
+}
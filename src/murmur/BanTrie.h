@@ -0,0 +1,82 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MURMUR_BANTRIE_H_
+#define MUMBLE_MURMUR_BANTRIE_H_
+
+#include <QtCore/QList>
+#include <QtCore/QMap>
+#include <QtCore/QVector>
+
+#include "Net.h"
+
+/**
+ * Address ban lookup for incoming connections.
+ *
+ * Bans are kept in a path compressed binary trie over the 128 bit
+ * (IPv4-mapped IPv6) address, so a lookup visits at most one node per
+ * prefix length regardless of how many bans are loaded. Each node that
+ * terminates a ban remembers when the latest ban on that prefix expires.
+ * The expiry times are also counted in one bucket per second, which tells
+ * cheaply whether any ban has run out and the list needs purging.
+ */
+class BanTrie {
+	public:
+		/// Expiry of a ban without a duration.
+		static const quint64 Permanent = ~0ULL;
+
+		struct Node {
+			HostAddress haPrefix;
+			int iBits;
+			int iChild[2];
+			/// Seconds since the epoch until which the prefix is banned, 0 if it isn't.
+			quint64 uiExpiry;
+		};
+	protected:
+		QVector<Node> qvNodes;
+		QMap<quint64, int> qmExpiry;
+		int iRoot;
+
+		int addNode(const HostAddress &prefix, int bits, quint64 expiry);
+	public:
+		BanTrie();
+		void clear();
+		void insert(const Ban &);
+		void rebuild(const QList<Ban> &);
+		bool match(const HostAddress &, quint64 now) const;
+		/// True if a ban inserted since the last rebuild expired before \p now.
+		bool hasExpired(quint64 now) const;
+		int nodes() const;
+
+		static quint64 expiry(const Ban &);
+		static quint64 now();
+};
+
+#endif
@@ -0,0 +1,184 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "murmur_pch.h"
+
+#include "BlobStore.h"
+
+#include "Message.h"
+#include "Mumble.pb.h"
+
+int BlobStore::Entry::size() const {
+	return qbaData.size() + qsText.size() * static_cast<int>(sizeof(QChar)) + qbaField.size();
+}
+
+BlobStore::BlobStore() : uiClock(0), iIdleBytes(0), iLimit(16 * 1024 * 1024) {
+}
+
+void BlobStore::setLimit(int bytes) {
+	iLimit = qMax(0, bytes);
+	trim();
+}
+
+int BlobStore::limit() const {
+	return iLimit;
+}
+
+int BlobStore::count() const {
+	return qhEntries.count();
+}
+
+int BlobStore::idleBytes() const {
+	return iIdleBytes;
+}
+
+QByteArray BlobStore::key(const QByteArray &hash, Kind kind) {
+	QByteArray k = hash;
+	k.append(static_cast<char>(kind));
+	return k;
+}
+
+/// Takes a reference to the entry, moving it off the idle list.
+BlobStore::Entry &BlobStore::ref(const QByteArray &k) {
+	Entry &e = qhEntries[k];
+	if ((e.iRefs == 0) && e.uiUsed) {
+		qmIdle.remove(e.uiUsed);
+		iIdleBytes -= e.size();
+	}
+	++e.iRefs;
+	e.uiUsed = ++uiClock;
+	return e;
+}
+
+/// Marks an entry as used; idle entries move to the end of the eviction order.
+void BlobStore::touch(const QByteArray &k, Entry &e) {
+	if (e.iRefs == 0)
+		qmIdle.remove(e.uiUsed);
+	e.uiUsed = ++uiClock;
+	if (e.iRefs == 0)
+		qmIdle.insert(e.uiUsed, k);
+}
+
+void BlobStore::trim() {
+	while ((iIdleBytes > iLimit) && ! qmIdle.isEmpty()) {
+		QMap<quint64, QByteArray>::iterator i = qmIdle.begin();
+		QHash<QByteArray, Entry>::iterator e = qhEntries.find(i.value());
+		if (e != qhEntries.end()) {
+			iIdleBytes -= e->size();
+			qhEntries.erase(e);
+		}
+		qmIdle.erase(i);
+	}
+}
+
+QByteArray BlobStore::acquire(const QByteArray &hash, const QByteArray &texture) {
+	Entry &e = ref(key(hash, Texture));
+	if (e.qbaData.isNull())
+		e.qbaData = texture;
+	return e.qbaData;
+}
+
+QString BlobStore::acquire(const QByteArray &hash, const QString &comment) {
+	Entry &e = ref(key(hash, Comment));
+	if (e.qsText.isNull())
+		e.qsText = comment;
+	return e.qsText;
+}
+
+void BlobStore::release(const QByteArray &hash, Kind kind) {
+	if (hash.isEmpty())
+		return;
+
+	const QByteArray &k = key(hash, kind);
+	QHash<QByteArray, Entry>::iterator e = qhEntries.find(k);
+	if ((e == qhEntries.end()) || (e->iRefs <= 0))
+		return;
+
+	if (--e->iRefs == 0) {
+		e->uiUsed = ++uiClock;
+		qmIdle.insert(e->uiUsed, k);
+		iIdleBytes += e->size();
+		trim();
+	}
+}
+
+void BlobStore::insert(const QByteArray &hash, const QByteArray &texture) {
+	const QByteArray &k = key(hash, Texture);
+	QHash<QByteArray, Entry>::iterator e = qhEntries.find(k);
+	if (e != qhEntries.end()) {
+		touch(k, *e);
+		return;
+	}
+
+	Entry &n = qhEntries[k];
+	n.qbaData = texture;
+	n.uiUsed = ++uiClock;
+	qmIdle.insert(n.uiUsed, k);
+	iIdleBytes += n.size();
+	trim();
+}
+
+QByteArray BlobStore::texture(const QByteArray &hash) {
+	const QByteArray &k = key(hash, Texture);
+	QHash<QByteArray, Entry>::iterator e = qhEntries.find(k);
+	if (e == qhEntries.end())
+		return QByteArray();
+	touch(k, *e);
+	return e->qbaData;
+}
+
+QByteArray BlobStore::field(const QByteArray &hash, Kind kind) {
+	const QByteArray &k = key(hash, kind);
+	QHash<QByteArray, Entry>::iterator e = qhEntries.find(k);
+	if (e == qhEntries.end())
+		return QByteArray();
+
+	if (e->qbaField.isEmpty()) {
+		MumbleProto::UserState mpus;
+		if (kind == Texture)
+			mpus.set_texture(blob(e->qbaData));
+		else
+			mpus.set_comment(u8(e->qsText));
+
+		QByteArray qba;
+		qba.resize(mpus.ByteSize());
+		mpus.SerializeToArray(qba.data(), qba.size());
+		e->qbaField = qba;
+		if (e->iRefs == 0) {
+			iIdleBytes += qba.size();
+			touch(k, *e);
+			trim();
+		}
+		return qba;
+	}
+
+	touch(k, *e);
+	return e->qbaField;
+}
@@ -0,0 +1,99 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MURMUR_BLOBSTORE_H_
+#define MUMBLE_MURMUR_BLOBSTORE_H_
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+#include <QtCore/QString>
+
+/**
+ * Content addressed store for the user textures and comments of one server.
+ *
+ * Blobs are keyed by the SHA1 hash the protocol already uses for them, so
+ * users with the same avatar or comment share a single copy. Every user
+ * holding a blob keeps a reference to it; blobs nobody references stay
+ * cached until the idle ones exceed the size limit, and are then dropped in
+ * least recently used order. Dropped textures of registered users are read
+ * from the database again when they are needed.
+ *
+ * For RequestBlob replies each blob also keeps its UserState field
+ * serialized once, so serving it doesn't build a new message per request.
+ */
+class BlobStore {
+	public:
+		enum Kind { Texture, Comment };
+	protected:
+		struct Entry {
+			QByteArray qbaData;
+			QString qsText;
+			/// Serialized UserState holding only the texture or comment field.
+			QByteArray qbaField;
+			int iRefs;
+			quint64 uiUsed;
+			Entry() : iRefs(0), uiUsed(0) {}
+			int size() const;
+		};
+		/// Keyed by hash and kind, see key().
+		QHash<QByteArray, Entry> qhEntries;
+		/// Entries without references, by the time they were last used.
+		QMap<quint64, QByteArray> qmIdle;
+		quint64 uiClock;
+		int iIdleBytes;
+		int iLimit;
+
+		static QByteArray key(const QByteArray &hash, Kind kind);
+		Entry &ref(const QByteArray &k);
+		void touch(const QByteArray &k, Entry &e);
+		void trim();
+	public:
+		BlobStore();
+		void setLimit(int bytes);
+		int limit() const;
+		int count() const;
+		int idleBytes() const;
+
+		/// Takes a reference to the texture \p hash and returns the stored copy of it.
+		QByteArray acquire(const QByteArray &hash, const QByteArray &texture);
+		/// Takes a reference to the comment \p hash and returns the stored copy of it.
+		QString acquire(const QByteArray &hash, const QString &comment);
+		void release(const QByteArray &hash, Kind kind);
+		/// Caches a texture without taking a reference.
+		void insert(const QByteArray &hash, const QByteArray &texture);
+
+		/// The cached texture, or a null QByteArray if it isn't cached.
+		QByteArray texture(const QByteArray &hash);
+		/// The serialized UserState field of a cached blob, or an empty QByteArray.
+		QByteArray field(const QByteArray &hash, Kind kind);
+};
+
+#endif
@@ -84,13 +84,7 @@ bool Server::isKeyForCert(const QSslKey &key, const QSslCertificate &cert) {
 	return false;
 }
 
-void Server::initializeCert() {
-	QByteArray crt, key, pass;
-
-	crt = getConf("certificate", QString()).toByteArray();
-	key = getConf("key", QString()).toByteArray();
-	pass = getConf("passphrase", QByteArray()).toByteArray();
-
+void Server::parseCert(const QByteArray &crt, const QByteArray &key, const QByteArray &pass, QSslKey &qskKey, QSslCertificate &qscCert, QList<QSslCertificate> &qlCA) {
 	QList<QSslCertificate> ql;
 
 	if (! key.isEmpty()) {
@@ -115,6 +109,49 @@ void Server::initializeCert() {
 		}
 		qlCA = ql;
 	}
+}
+
+CertParser::CertParser(const QByteArray &crt, const QByteArray &key, const QByteArray &pass) : qbaCert(crt), qbaKey(key), qbaPass(pass) {
+	bDone = false;
+	setAutoDelete(false);
+}
+
+void CertParser::run() {
+	Server::parseCert(qbaCert, qbaKey, qbaPass, qskKey, qscCert, qlCA);
+
+	QMutexLocker l(&qmDone);
+	bDone = true;
+	qwcDone.wakeAll();
+}
+
+void CertParser::wait() {
+	QMutexLocker l(&qmDone);
+	while (! bDone)
+		qwcDone.wait(&qmDone);
+}
+
+void Server::initializeCert() {
+	QByteArray crt, key, pass;
+
+	crt = getConf("certificate", QString()).toByteArray();
+	key = getConf("key", QString()).toByteArray();
+	pass = getConf("passphrase", QByteArray()).toByteArray();
+
+	// Meta::bootAll() may already have parsed it on the thread pool.
+	CertParser *cp = meta->qhCertParsers.take(iServerNum);
+	if (cp)
+		cp->wait();
+
+	if (cp && qskKey.isNull() && (cp->qbaCert == crt) && (cp->qbaKey == key) && (cp->qbaPass == pass)) {
+		qskKey = cp->qskKey;
+		if (! qskKey.isNull()) {
+			qscCert = cp->qscCert;
+			qlCA = cp->qlCA;
+		}
+	} else {
+		parseCert(crt, key, pass, qskKey, qscCert, qlCA);
+	}
+	delete cp;
 
 	QString issuer;
 #if QT_VERSION >= 0x050000
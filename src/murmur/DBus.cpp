@@ -531,12 +531,12 @@ void MurmurDBus::setACL(int id, const QList<ACLInfo> &acls, const QList<GroupInf
 		a->bApplyHere = ai.applyHere;
 		a->bApplySubs = ai.applySubs;
 		a->iUserId = ai.playerid;
-		a->qsGroup = ai.group;
+		a->setGroup(ai.group);
 		a->pDeny = static_cast<ChanACL::Permissions>(ai.deny) & ChanACL::All;
 		a->pAllow = static_cast<ChanACL::Permissions>(ai.allow) & ChanACL::All;
 	}
 
-	server->clearACLCache();
+	server->clearACLCacheSubtree(cChannel);
 	server->updateChannel(cChannel);
 }
 
@@ -736,7 +736,7 @@ ACLInfo::ACLInfo(const ChanACL *acl) {
 	applySubs = acl->bApplySubs;
 	inherited = false;
 	playerid = acl->iUserId;
-	group = acl->qsGroup;
+	group = acl->group();
 	allow = acl->pAllow;
 	deny = acl->pDeny;
 }
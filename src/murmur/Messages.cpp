@@ -110,7 +110,6 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 	MSG_SETUP(ServerUser::Connected);
 
 	Channel *root = qhChannels.value(0);
-	Channel *c;
 
 	uSource->qsName = u8(msg.username());
 
@@ -226,49 +225,8 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 		sendTextMessage(NULL, uSource, false, QLatin1String("<strong>WARNING:</strong> Your client doesn't support the CELT codec, you won't be able to talk to or hear most clients. Please make sure your client was built with CELT support."));
 	}
 
-	// Transmit channel tree
-	QQueue<Channel *> q;
-	QSet<Channel *> chans;
-	q << root;
-	MumbleProto::ChannelState mpcs;
-	while (! q.isEmpty()) {
-		c = q.dequeue();
-		chans.insert(c);
-
-		mpcs.Clear();
-
-		mpcs.set_channel_id(c->iId);
-		if (c->cParent)
-			mpcs.set_parent(c->cParent->iId);
-		if (c->iId == 0)
-			mpcs.set_name(u8(qsRegName.isEmpty() ? QLatin1String("Root") : qsRegName));
-		else
-			mpcs.set_name(u8(c->qsName));
-
-		mpcs.set_position(c->iPosition);
-
-		if ((uSource->uiVersion >= 0x010202) && ! c->qbaDescHash.isEmpty())
-			mpcs.set_description_hash(blob(c->qbaDescHash));
-		else if (! c->qsDesc.isEmpty())
-			mpcs.set_description(u8(c->qsDesc));
-
-		sendMessage(uSource, mpcs);
-
-		foreach(c, c->qlChannels)
-			q.enqueue(c);
-	}
-
-	// Transmit links
-	foreach(c, chans) {
-		if (c->qhLinks.count() > 0) {
-			mpcs.Clear();
-			mpcs.set_channel_id(c->iId);
-
-			foreach(Channel *l, c->qhLinks.keys())
-				mpcs.add_links(l->iId);
-			sendMessage(uSource, mpcs);
-		}
-	}
+	// Transmit channel tree and links, serialized once and shared between joins
+	uSource->sendMessage(channelSync(uSource->uiVersion));
 
 	// Transmit user profile
 	MumbleProto::UserState mpus;
@@ -294,7 +252,7 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 	if (uSource->iId >= 0) {
 		mpus.set_user_id(uSource->iId);
 
-		hashAssign(uSource->qbaTexture, uSource->qbaTextureHash, getUserTexture(uSource->iId));
+		setUserTexture(uSource, getUserTexture(uSource->iId));
 
 		if (! uSource->qbaTextureHash.isEmpty())
 			mpus.set_texture_hash(blob(uSource->qbaTextureHash));
@@ -303,7 +261,7 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 
 		const QMap<int, QString> &info = getRegistration(uSource->iId);
 		if (info.contains(ServerDB::User_Comment)) {
-			hashAssign(uSource->qsComment, uSource->qbaCommentHash, info.value(ServerDB::User_Comment));
+			setUserComment(uSource, info.value(ServerDB::User_Comment));
 			if (! uSource->qbaCommentHash.isEmpty())
 				mpus.set_comment_hash(blob(uSource->qbaCommentHash));
 			else if (! uSource->qsComment.isEmpty())
@@ -323,7 +281,8 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 		mpus.set_comment(u8(uSource->qsComment));
 	sendAll(mpus, ~ 0x010202);
 
-	// Transmit other users profiles
+	// Transmit other users profiles, batched into a single socket write
+	QByteArray qbaUsers, qbaMsg;
 	foreach(ServerUser *u, qhUsers) {
 		if (u->sState != ServerUser::Authenticated)
 			continue;
@@ -367,8 +326,10 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 		if (! u->qsHash.isEmpty())
 			mpus.set_hash(u8(u->qsHash));
 
-		sendMessage(uSource, mpus);
+		Connection::messageToNetwork(mpus, MessageHandler::UserState, qbaMsg);
+		qbaUsers.append(qbaMsg);
 	}
+	uSource->sendMessage(qbaUsers);
 
 	// Send syncronisation packet
 	MumbleProto::ServerSync mpss;
@@ -476,7 +437,7 @@ void Server::msgUDPTunnel(ServerUser *uSource, MumbleProto::UDPTunnel &msg) {
 	int len = static_cast<int>(str.length());
 	if (len < 1)
 		return;
-	QReadLocker rl(&qrwlUsers);
+	UserReadLocker rl(&ulUsers);
 	processMsg(uSource, str.data(), len);
 }
 
@@ -611,7 +572,7 @@ void Server::msgUserState(ServerUser *uSource, MumbleProto::UserState &msg) {
 			}
 		} else {
 			// For unregistered users or SuperUser only get the hash
-			hashAssign(pDstServerUser->qbaTexture, pDstServerUser->qbaTextureHash, qba);
+			setUserTexture(pDstServerUser, qba);
 		}
 
 		// The texture will be sent out later in this function
@@ -647,7 +608,7 @@ void Server::msgUserState(ServerUser *uSource, MumbleProto::UserState &msg) {
 	}
 
 	if (! comment.isNull()) {
-		hashAssign(pDstServerUser->qsComment, pDstServerUser->qbaCommentHash, comment);
+		setUserComment(pDstServerUser, comment);
 
 		if (pDstServerUser->iId >= 0) {
 			QMap<int, QString> info;
@@ -912,11 +873,11 @@ void Server::msgChannelState(ServerUser *uSource, MumbleProto::ChannelState &msg
 			if (uSource->iId >= 0)
 				a->iUserId=uSource->iId;
 			else
-				a->qsGroup=QLatin1Char('$') + uSource->qsHash;
+				a->setGroup(QLatin1Char('$') + uSource->qsHash);
 			a->pDeny=ChanACL::None;
 			a->pAllow=ChanACL::Write | ChanACL::Traverse;
 
-			clearACLCache();
+			clearACLCacheSubtree(c);
 		}
 		updateChannel(c);
 
@@ -1040,6 +1001,7 @@ void Server::msgChannelState(ServerUser *uSource, MumbleProto::ChannelState &msg
 
 			c->cParent->removeChannel(c);
 			p->addChannel(c);
+			clearACLCacheSubtree(c);
 		}
 		if (! qsName.isNull()) {
 			log(uSource, QString("Renamed channel %1 to %2").arg(QString(*c),
@@ -1233,7 +1195,7 @@ void Server::msgACL(ServerUser *uSource, MumbleProto::ACL &msg) {
 						mpacl->set_user_id(acl->iUserId);
 						qsId.insert(acl->iUserId);
 					} else
-						mpacl->set_group(u8(acl->qsGroup));
+						mpacl->set_group(u8(acl->group()));
 					mpacl->set_grant(acl->pAllow);
 					mpacl->set_deny(acl->pDeny);
 				}
@@ -1324,12 +1286,12 @@ void Server::msgACL(ServerUser *uSource, MumbleProto::ACL &msg) {
 			if (mpacl.has_user_id())
 				a->iUserId=mpacl.user_id();
 			else
-				a->qsGroup=u8(mpacl.group());
+				a->setGroup(u8(mpacl.group()));
 			a->pDeny=static_cast<ChanACL::Permissions>(mpacl.deny())  & ChanACL::All;
 			a->pAllow=static_cast<ChanACL::Permissions>(mpacl.grant()) & ChanACL::All;
 		}
 
-		clearACLCache();
+		clearACLCacheSubtree(c);
 
 		if (! hasPermission(uSource, c, ChanACL::Write) && ((uSource->iId >= 0) || !uSource->qsHash.isEmpty())) {
 			a = new ChanACL(c);
@@ -1338,12 +1300,12 @@ void Server::msgACL(ServerUser *uSource, MumbleProto::ACL &msg) {
 			if (uSource->iId >= 0)
 				a->iUserId=uSource->iId;
 			else
-				a->qsGroup=QLatin1Char('$') + uSource->qsHash;
+				a->setGroup(QLatin1Char('$') + uSource->qsHash);
 			a->iUserId=uSource->iId;
 			a->pDeny=ChanACL::None;
 			a->pAllow=ChanACL::Write | ChanACL::Traverse;
 
-			clearACLCache();
+			clearACLCacheSubtree(c);
 		}
 
 		updateChannel(c);
@@ -1533,7 +1495,7 @@ void Server::msgVoiceTarget(ServerUser *uSource, MumbleProto::VoiceTarget &msg)
 	if ((target < 1) || (target >= 0x1f))
 		return;
 
-	QWriteLocker lock(&qrwlUsers);
+	UserWriteLocker lock(&ulUsers);
 
 	uSource->qmTargetCache.remove(target);
 
@@ -1686,14 +1648,20 @@ void Server::msgRequestBlob(ServerUser *uSource, MumbleProto::RequestBlob &msg)
 		}
 	}
 	if (ntextures || ncomments) {
+		// Hashed blobs are served from the buffers serialized by bsBlobs
 		MumbleProto::UserState mpus;
 		for (int i=0;i<ntextures;++i) {
 			int session = msg.session_texture(i);
 			ServerUser *su = qhUsers.value(session);
 			if (su && ! su->qbaTexture.isEmpty()) {
-				mpus.set_session(session);
-				mpus.set_texture(blob(su->qbaTexture));
-				sendMessage(uSource, mpus);
+				const QByteArray &field = su->qbaTextureHash.isEmpty() ? QByteArray() : bsBlobs.field(su->qbaTextureHash, BlobStore::Texture);
+				if (! field.isEmpty()) {
+					sendBlob(uSource, session, field);
+				} else {
+					mpus.set_session(session);
+					mpus.set_texture(blob(su->qbaTexture));
+					sendMessage(uSource, mpus);
+				}
 			}
 		}
 		if (ntextures)
@@ -1702,9 +1670,14 @@ void Server::msgRequestBlob(ServerUser *uSource, MumbleProto::RequestBlob &msg)
 			int session = msg.session_comment(i);
 			ServerUser *su = qhUsers.value(session);
 			if (su && ! su->qsComment.isEmpty()) {
-				mpus.set_session(session);
-				mpus.set_comment(u8(su->qsComment));
-				sendMessage(uSource, mpus);
+				const QByteArray &field = su->qbaCommentHash.isEmpty() ? QByteArray() : bsBlobs.field(su->qbaCommentHash, BlobStore::Comment);
+				if (! field.isEmpty()) {
+					sendBlob(uSource, session, field);
+				} else {
+					mpus.set_session(session);
+					mpus.set_comment(u8(su->qsComment));
+					sendMessage(uSource, mpus);
+				}
 			}
 		}
 	}
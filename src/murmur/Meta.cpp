@@ -36,6 +36,7 @@
 #include "Net.h"
 #include "ServerDB.h"
 #include "Server.h"
+#include "SslHandshake.h"
 #include "OSInfo.h"
 #include "Version.h"
 
@@ -67,6 +68,9 @@ MetaParams::MetaParams() {
 	qsLogfile = "murmur.log";
 
 	iLogDays = 31;
+	iLogQueueSize = 10000;
+	bLogQueueWait = false;
+	iLogQueueWait = 100;
 
 	iObfuscate = 0;
 	bSendVersion = true;
@@ -74,6 +78,10 @@ MetaParams::MetaParams() {
 	bAllowPing = true;
 	bCertRequired = false;
 	bForceExternalAuth = false;
+	iUdpBatchSize = 1;
+	iVoiceThreads = 1;
+	iSslThreads = 2;
+	iBlobCache = 16 * 1024 * 1024;
 
 	iBanTries = 10;
 	iBanTimeframe = 120;
@@ -275,6 +283,13 @@ void MetaParams::read(QString fname) {
 	qsEmoticonImages = typeCheckedFromSettings("emoticonimages", qsEmoticonImages);
 	bCertRequired = typeCheckedFromSettings("certrequired", bCertRequired);
 	bForceExternalAuth = typeCheckedFromSettings("forceExternalAuth", bForceExternalAuth);
+	iUdpBatchSize = typeCheckedFromSettings("udpbatchsize", iUdpBatchSize);
+	iVoiceThreads = typeCheckedFromSettings("voicethreads", iVoiceThreads);
+	iSslThreads = qMax(0, typeCheckedFromSettings("sslthreads", iSslThreads));
+	qsSnapshotDir = typeCheckedFromSettings("snapshotdir", qsSnapshotDir);
+	if (! qsSnapshotDir.isEmpty())
+		qsSnapshotDir = qdBasePath.absoluteFilePath(qsSnapshotDir);
+	iBlobCache = typeCheckedFromSettings("blobcache", iBlobCache);
 
 	qsDatabase = typeCheckedFromSettings("database", qsDatabase);
 
@@ -292,6 +307,13 @@ void MetaParams::read(QString fname) {
 	qsIceSecretWrite = typeCheckedFromSettings("icesecretwrite", qsIceSecretRead);
 
 	iLogDays = typeCheckedFromSettings("logdays", iLogDays);
+	iLogQueueSize = qMax(1, typeCheckedFromSettings("logqueuesize", iLogQueueSize));
+	const QString logqueuefull = typeCheckedFromSettings("logqueuefull", QString::fromLatin1("drop"));
+	if (logqueuefull == QLatin1String("wait"))
+		bLogQueueWait = true;
+	else if (logqueuefull != QLatin1String("drop"))
+		qCritical() << "Configuration variable logqueuefull must be drop or wait. Set to default value of drop.";
+	iLogQueueWait = qMax(1, typeCheckedFromSettings("logqueuewait", iLogQueueWait));
 
 	qsDBus = typeCheckedFromSettings("dbus", qsDBus);
 	qsDBusService = typeCheckedFromSettings("dbusservice", qsDBusService);
@@ -483,6 +505,11 @@ void MetaParams::read(QString fname) {
 	qmConfig.insert(QLatin1String("channelname"),qrChannelName.pattern());
 	qmConfig.insert(QLatin1String("certrequired"), bCertRequired ? QLatin1String("true") : QLatin1String("false"));
 	qmConfig.insert(QLatin1String("forceExternalAuth"), bForceExternalAuth ? QLatin1String("true") : QLatin1String("false"));
+	qmConfig.insert(QLatin1String("udpbatchsize"), QString::number(iUdpBatchSize));
+	qmConfig.insert(QLatin1String("voicethreads"), QString::number(iVoiceThreads));
+	qmConfig.insert(QLatin1String("sslthreads"), QString::number(iSslThreads));
+	qmConfig.insert(QLatin1String("snapshotdir"), qsSnapshotDir);
+	qmConfig.insert(QLatin1String("blobcache"), QString::number(iBlobCache));
 	qmConfig.insert(QLatin1String("suggestversion"), qvSuggestVersion.isNull() ? QString() : qvSuggestVersion.toString());
 	qmConfig.insert(QLatin1String("suggestpositional"), qvSuggestPositional.isNull() ? QString() : qvSuggestPositional.toString());
 	qmConfig.insert(QLatin1String("suggestpushtotalk"), qvSuggestPushToTalk.isNull() ? QString() : qvSuggestPushToTalk.toString());
@@ -491,6 +518,8 @@ void MetaParams::read(QString fname) {
 }
 
 Meta::Meta() {
+	hpHandshake = new HandshakePool(mp.iSslThreads, this);
+
 #ifdef Q_OS_WIN
 	QOS_VERSION qvVer;
 	qvVer.MajorVersion = 1;
@@ -525,10 +554,42 @@ void Meta::getOSInfo() {
 	qsOSVersion = OSInfo::getOSDisplayableVersion();
 }
 
+/**
+ * Boots every server marked for boot. The configuration of all servers is read
+ * in one query up front and their certificates are parsed on the thread pool
+ * meanwhile. The servers are then booted one per event loop pass, so those
+ * already up accept connections while the rest are still booting.
+ */
 void Meta::bootAll() {
-	QList<int> ql = ServerDB::getBootServers();
-	foreach(int snum, ql)
+	ServerDB::preloadConf();
+	qlBootQueue = ServerDB::getBootServers();
+
+	foreach(int snum, qlBootQueue) {
+		CertParser *cp = new CertParser(ServerDB::getConf(snum, "certificate", QString()).toByteArray(), ServerDB::getConf(snum, "key", QString()).toByteArray(), ServerDB::getConf(snum, "passphrase", QByteArray()).toByteArray());
+		qhCertParsers.insert(snum, cp);
+		QThreadPool::globalInstance()->start(cp);
+	}
+
+	bootNext();
+}
+
+void Meta::bootNext() {
+	if (! qlBootQueue.isEmpty()) {
+		const int snum = qlBootQueue.takeFirst();
 		boot(snum);
+
+		// The server didn't get as far as its certificate.
+		CertParser *cp = qhCertParsers.take(snum);
+		if (cp) {
+			cp->wait();
+			delete cp;
+		}
+	}
+
+	if (qlBootQueue.isEmpty())
+		ServerDB::clearConfCache();
+	else
+		QMetaObject::invokeMethod(this, "bootNext", Qt::QueuedConnection);
 }
 
 bool Meta::boot(int srvnum) {
@@ -583,6 +644,14 @@ void Meta::kill(int srvnum) {
 }
 
 void Meta::killAll() {
+	qlBootQueue.clear();
+	foreach(CertParser *cp, qhCertParsers) {
+		cp->wait();
+		delete cp;
+	}
+	qhCertParsers.clear();
+	ServerDB::clearConfCache();
+
 	foreach(Server *s, qhServers) {
 		emit stopped(s);
 		delete s;
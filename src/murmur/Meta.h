@@ -44,6 +44,8 @@
 
 #include "Timer.h"
 
+class CertParser;
+class HandshakePool;
 class Server;
 class QSettings;
 
@@ -70,6 +72,11 @@ public:
 	QString qsEmoticonImages;
 	bool bCertRequired;
 	bool bForceExternalAuth;
+	int iUdpBatchSize;
+	int iVoiceThreads;
+	int iSslThreads;
+	QString qsSnapshotDir;
+	int iBlobCache;
 
 	int iBanTries;
 	int iBanTimeframe;
@@ -85,6 +92,10 @@ public:
 	int iDBPort;
 
 	int iLogDays;
+	int iLogQueueSize;
+	/// logqueuefull=wait: wait up to iLogQueueWait ms for room instead of dropping right away.
+	bool bLogQueueWait;
+	int iLogQueueWait;
 
 	int iObfuscate;
 	bool bSendVersion;
@@ -145,6 +156,10 @@ class Meta : public QObject {
 		QHash<QHostAddress, Timer> qhBans;
 		QString qsOS, qsOSVersion;
 		Timer tUptime;
+		HandshakePool *hpHandshake;
+		/// Servers bootAll() has yet to boot.
+		QList<int> qlBootQueue;
+		QHash<int, CertParser *> qhCertParsers;
 
 #ifdef Q_OS_WIN
 		static HANDLE hQoS;
@@ -160,6 +175,8 @@ class Meta : public QObject {
 		void getOSInfo();
 		void connectListener(QObject *);
 		static void getVersion(int &major, int &minor, int &patch, QString &string);
+	public slots:
+		void bootNext();
 	signals:
 		void started(Server *);
 		void stopped(Server *);
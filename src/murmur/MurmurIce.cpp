@@ -124,7 +124,7 @@ static void ACLtoACL(const ::ChanACL *acl, Murmur::ACL &ma) {
 	ma.applySubs = acl->bApplySubs;
 	ma.inherited = false;
 	ma.userid = acl->iUserId;
-	ma.group = u8(acl->qsGroup);
+	ma.group = u8(acl->group());
 	ma.allow = acl->pAllow;
 	ma.deny = acl->pDeny;
 }
@@ -1380,12 +1380,12 @@ static void impl_Server_setACL(const ::Murmur::AMD_Server_setACLPtr cb, int serv
 		acl->bApplyHere = ai.applyHere;
 		acl->bApplySubs = ai.applySubs;
 		acl->iUserId = ai.userid;
-		acl->qsGroup = u8(ai.group);
+		acl->setGroup(u8(ai.group));
 		acl->pDeny = static_cast<ChanACL::Permissions>(ai.deny) & ChanACL::All;
 		acl->pAllow = static_cast<ChanACL::Permissions>(ai.allow) & ChanACL::All;
 	}
 
-	server->clearACLCache();
+	server->clearACLCacheSubtree(channel);
 	server->updateChannel(channel);
 	cb->ice_response();
 }
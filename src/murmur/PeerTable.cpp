@@ -0,0 +1,239 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "murmur_pch.h"
+
+#include "PeerTable.h"
+
+static inline int loadEpoch(const QAtomicInt &v) {
+#if QT_VERSION >= 0x050000
+	return v.loadAcquire();
+#else
+	return v;
+#endif
+}
+
+static inline PeerTable::Snapshot *loadSnapshot(const QAtomicPointer<PeerTable::Snapshot> &p) {
+#if QT_VERSION >= 0x050000
+	return p.loadAcquire();
+#else
+	return p;
+#endif
+}
+
+static unsigned int tableSize(int count) {
+	unsigned int size = 16;
+	while (size < static_cast<unsigned int>(count) * 2)
+		size <<= 1;
+	return size;
+}
+
+static void insertEntry(PeerTable::Entry *table, unsigned int mask, unsigned int h, const HostAddress &ha, quint16 port, ServerUser *u) {
+	unsigned int i = h & mask;
+	while (table[i].u)
+		i = (i + 1) & mask;
+	table[i].haAddress = ha;
+	table[i].usPort = port;
+	table[i].u = u;
+}
+
+PeerTable::Snapshot::Snapshot(int npeers, int nhosts) {
+	unsigned int size = tableSize(npeers);
+	peers = new Entry[size];
+	for (unsigned int i = 0; i < size; ++i)
+		peers[i].u = NULL;
+	uiPeerMask = size - 1;
+
+	size = tableSize(nhosts);
+	hosts = new Entry[size];
+	for (unsigned int i = 0; i < size; ++i)
+		hosts[i].u = NULL;
+	uiHostMask = size - 1;
+
+	iEpoch = 0;
+}
+
+PeerTable::Snapshot::~Snapshot() {
+	delete [] peers;
+	delete [] hosts;
+}
+
+PeerTable::ReadGuard::ReadGuard(PeerTable *pt, int reader) {
+	qaiSlot = &pt->rsReaders[qBound(0, reader, pt->iReaders - 1)].qaiEpoch;
+	// Announce the epoch before picking up the snapshot, so a writer that
+	// retires it afterwards sees us and keeps it alive.
+	qaiSlot->fetchAndStoreOrdered(loadEpoch(pt->qaiEpoch));
+	s = loadSnapshot(pt->qapSnapshot);
+}
+
+PeerTable::ReadGuard::~ReadGuard() {
+	qaiSlot->fetchAndStoreRelease(0);
+}
+
+ServerUser *PeerTable::ReadGuard::peer(const HostAddress &ha, quint16 port) const {
+	unsigned int i = hash(ha, port) & s->uiPeerMask;
+	const Entry *e;
+	while ((e = &s->peers[i])->u) {
+		if ((e->usPort == port) && (e->haAddress == ha))
+			return e->u;
+		i = (i + 1) & s->uiPeerMask;
+	}
+	return NULL;
+}
+
+ServerUser *PeerTable::ReadGuard::host(const HostAddress &ha, int &pos) const {
+	unsigned int i = (pos < 0) ? (hash(ha, 0) & s->uiHostMask) : ((static_cast<unsigned int>(pos) + 1) & s->uiHostMask);
+	const Entry *e;
+	while ((e = &s->hosts[i])->u) {
+		if (e->haAddress == ha) {
+			pos = static_cast<int>(i);
+			return e->u;
+		}
+		i = (i + 1) & s->uiHostMask;
+	}
+	return NULL;
+}
+
+unsigned int PeerTable::hash(const HostAddress &ha, quint16 port) {
+	quint64 k = ha.addr[0] ^ (ha.addr[1] * Q_UINT64_C(0x9E3779B97F4A7C15)) ^ port;
+	k ^= k >> 33;
+	k *= Q_UINT64_C(0xFF51AFD7ED558CCD);
+	k ^= k >> 33;
+	return static_cast<unsigned int>(k);
+}
+
+PeerTable::PeerTable() : qapSnapshot(new Snapshot(0, 0)), qaiEpoch(1), rsReaders(NULL), iReaders(0) {
+	setReaders(1);
+}
+
+PeerTable::~PeerTable() {
+	delete loadSnapshot(qapSnapshot);
+	qDeleteAll(qlRetired);
+	delete [] rsReaders;
+}
+
+void PeerTable::setReaders(int readers) {
+	QMutexLocker lock(&qmWrite);
+
+	delete [] rsReaders;
+	iReaders = qMax(1, readers);
+	rsReaders = new ReaderSlot[iReaders];
+	for (int i = 0; i < iReaders; ++i)
+		rsReaders[i].qaiEpoch.fetchAndStoreOrdered(0);
+}
+
+void PeerTable::addHost(ServerUser *u, const HostAddress &ha) {
+	QMutexLocker lock(&qmWrite);
+
+	qhHosts[ha].insert(u);
+	qhUserHost.insert(u, ha);
+	publish();
+}
+
+bool PeerTable::bind(ServerUser *u, const HostAddress &ha, quint16 port) {
+	QMutexLocker lock(&qmWrite);
+
+	if (! qhUserHost.contains(u) || qhUserPeer.contains(u))
+		return false;
+
+	QPair<HostAddress, quint16> key(ha, port);
+	if (qhPeers.contains(key))
+		return false;
+
+	qhPeers.insert(key, u);
+	qhUserPeer.insert(u, key);
+
+	// A bound user is no longer a candidate for unknown peers.
+	const HostAddress &host = qhUserHost.value(u);
+	QSet<ServerUser *> &qs = qhHosts[host];
+	qs.remove(u);
+	if (qs.isEmpty())
+		qhHosts.remove(host);
+
+	publish();
+	return true;
+}
+
+void PeerTable::remove(ServerUser *u) {
+	QMutexLocker lock(&qmWrite);
+
+	if (qhUserHost.contains(u)) {
+		HostAddress ha = qhUserHost.take(u);
+		if (qhHosts.contains(ha)) {
+			QSet<ServerUser *> &qs = qhHosts[ha];
+			qs.remove(u);
+			if (qs.isEmpty())
+				qhHosts.remove(ha);
+		}
+	}
+	if (qhUserPeer.contains(u))
+		qhPeers.remove(qhUserPeer.take(u));
+
+	publish();
+}
+
+void PeerTable::publish() {
+	Snapshot *s = new Snapshot(qhPeers.count(), qhUserHost.count());
+
+	QHash<QPair<HostAddress, quint16>, ServerUser *>::const_iterator i;
+	for (i = qhPeers.constBegin(); i != qhPeers.constEnd(); ++i)
+		insertEntry(s->peers, s->uiPeerMask, hash(i.key().first, i.key().second), i.key().first, i.key().second, i.value());
+
+	QHash<HostAddress, QSet<ServerUser *> >::const_iterator j;
+	for (j = qhHosts.constBegin(); j != qhHosts.constEnd(); ++j)
+		foreach(ServerUser *u, j.value())
+			insertEntry(s->hosts, s->uiHostMask, hash(j.key(), 0), j.key(), 0, u);
+
+	Snapshot *old = qapSnapshot.fetchAndStoreOrdered(s);
+	// Readers that announced an epoch up to this one may still hold the old snapshot.
+	old->iEpoch = qaiEpoch.fetchAndAddOrdered(1);
+	qlRetired.append(old);
+
+	reclaim();
+}
+
+void PeerTable::reclaim() {
+	int oldest = 0;
+	for (int i = 0; i < iReaders; ++i) {
+		int e = loadEpoch(rsReaders[i].qaiEpoch);
+		if (e && (! oldest || (e < oldest)))
+			oldest = e;
+	}
+
+	QList<Snapshot *>::iterator i = qlRetired.begin();
+	while (i != qlRetired.end()) {
+		if (! oldest || ((*i)->iEpoch < oldest)) {
+			delete *i;
+			i = qlRetired.erase(i);
+		} else {
+			++i;
+		}
+	}
+}
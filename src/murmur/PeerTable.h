@@ -0,0 +1,123 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MURMUR_PEERTABLE_H_
+#define MUMBLE_MURMUR_PEERTABLE_H_
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QAtomicPointer>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QPair>
+#include <QtCore/QSet>
+
+#include "Net.h"
+
+class ServerUser;
+
+/**
+ * Maps UDP peers (address and port) to users for the voice threads.
+ *
+ * Lookups never take a lock. The table keeps its authoritative state in
+ * QHashes guarded by a mutex, and every change publishes a new immutable
+ * open-addressed snapshot through an atomic pointer. Retired snapshots are
+ * freed once no reader slot still announces an epoch that could reference
+ * them, so each voice thread must use its own reader slot.
+ */
+class PeerTable {
+	private:
+		Q_DISABLE_COPY(PeerTable)
+	public:
+		struct Entry {
+			HostAddress haAddress;
+			quint16 usPort;
+			ServerUser *u;
+		};
+
+		struct Snapshot {
+			Entry *peers;
+			unsigned int uiPeerMask;
+			Entry *hosts;
+			unsigned int uiHostMask;
+			int iEpoch;
+			Snapshot(int peers, int hosts);
+			~Snapshot();
+		};
+
+		class ReadGuard {
+			private:
+				Q_DISABLE_COPY(ReadGuard)
+			protected:
+				QAtomicInt *qaiSlot;
+				const Snapshot *s;
+			public:
+				ReadGuard(PeerTable *, int reader);
+				~ReadGuard();
+				ServerUser *peer(const HostAddress &, quint16 port) const;
+				/// Returns the next user connected from the address, starting at pos = -1. Returns NULL when done.
+				ServerUser *host(const HostAddress &, int &pos) const;
+		};
+
+		PeerTable();
+		~PeerTable();
+
+		/// Allocates reader slots. Must be called before any reader is running.
+		void setReaders(int readers);
+
+		void addHost(ServerUser *, const HostAddress &);
+		/// Binds a UDP peer to a user. Fails if the user is gone or already bound.
+		bool bind(ServerUser *, const HostAddress &, quint16 port);
+		void remove(ServerUser *);
+
+		static unsigned int hash(const HostAddress &, quint16 port);
+	protected:
+		struct ReaderSlot {
+			QAtomicInt qaiEpoch;
+			char cPad[64 - sizeof(QAtomicInt)];
+		};
+
+		QMutex qmWrite;
+		QHash<QPair<HostAddress, quint16>, ServerUser *> qhPeers;
+		QHash<HostAddress, QSet<ServerUser *> > qhHosts;
+		QHash<ServerUser *, HostAddress> qhUserHost;
+		QHash<ServerUser *, QPair<HostAddress, quint16> > qhUserPeer;
+
+		QAtomicPointer<Snapshot> qapSnapshot;
+		QAtomicInt qaiEpoch;
+		ReaderSlot *rsReaders;
+		int iReaders;
+		QList<Snapshot *> qlRetired;
+
+		void publish();
+		void reclaim();
+};
+
+#endif
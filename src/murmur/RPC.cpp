@@ -83,7 +83,7 @@ void Server::setUserState(User *pUser, Channel *cChannel, bool mute, bool deaf,
 	pUser->bSuppress = suppressed;
 	pUser->bPrioritySpeaker = prioritySpeaker;
 	pUser->qsName = name;
-	hashAssign(pUser->qsComment, pUser->qbaCommentHash, comment);
+	setUserComment(pUser, comment);
 
 	if (cChannel != pUser->cChannel) {
 		changed = true;
@@ -131,6 +131,7 @@ bool Server::setChannelState(Channel *cChannel, Channel *cParent, const QString
 
 		cChannel->cParent->removeChannel(cChannel);
 		cParent->addChannel(cChannel);
+		clearACLCacheSubtree(cChannel);
 
 		mpcs.set_parent(cParent->iId);
 
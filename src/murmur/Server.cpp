@@ -43,6 +43,7 @@
 #include "PacketDataStream.h"
 #include "ServerDB.h"
 #include "ServerUser.h"
+#include "SslHandshake.h"
 
 #ifdef USE_BONJOUR
 #include "BonjourServer.h"
@@ -55,6 +56,316 @@
 
 #define UDP_PACKET_SIZE 1024
 
+// recvmmsg() appeared in glibc 2.12, sendmmsg() in 2.14.
+#if defined(Q_OS_LINUX) && defined(__GLIBC__) && ((__GLIBC__ > 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ >= 14)))
+#define USE_MMSG
+#endif
+
+#define UDP_MAX_BATCH 256
+
+#if defined(Q_OS_LINUX) && defined(SO_REUSEPORT)
+#define USE_REUSEPORT
+#endif
+
+#define MAX_VOICE_THREADS 64
+
+/*!
+ * Records the UDP peer of u. On Linux this also prebuilds u->mhUdp, the
+ * sendmsg() header used for every datagram to the user, with control data
+ * that sends from the address the user's TCP connection was accepted on.
+ * If no usable source address exists, u->bUdpSource is left false and
+ * nothing is sent over UDP. Must be called with u->qmCrypt held.
+ */
+static void setUdpPeer(ServerUser *u, const struct sockaddr_storage &from) {
+	memcpy(& u->saiUdpAddress, &from, sizeof(from));
+
+#ifdef Q_OS_LINUX
+	struct msghdr *msg = & u->mhUdp;
+
+	memset(msg, 0, sizeof(*msg));
+	msg->msg_name = reinterpret_cast<struct sockaddr *>(& u->saiUdpAddress);
+	msg->msg_namelen = (from.ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+	msg->msg_control = u->aucUdpControl;
+	msg->msg_controllen = CMSG_SPACE((from.ss_family == AF_INET6) ? sizeof(struct in6_pktinfo) : sizeof(struct in_pktinfo));
+	memset(msg->msg_control, 0, msg->msg_controllen);
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
+	HostAddress tcpha(u->saiTcpLocalAddress);
+	if (from.ss_family == AF_INET6) {
+		cmsg->cmsg_level = IPPROTO_IPV6;
+		cmsg->cmsg_type = IPV6_PKTINFO;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
+		struct in6_pktinfo *pktinfo = reinterpret_cast<struct in6_pktinfo *>(CMSG_DATA(cmsg));
+		memcpy(&pktinfo->ipi6_addr.s6_addr[0], &tcpha.qip6.c[0], sizeof(pktinfo->ipi6_addr.s6_addr));
+	} else {
+		if (tcpha.isV6())
+			return;
+		cmsg->cmsg_level = IPPROTO_IP;
+		cmsg->cmsg_type = IP_PKTINFO;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+		struct in_pktinfo *pktinfo = reinterpret_cast<struct in_pktinfo *>(CMSG_DATA(cmsg));
+		pktinfo->ipi_spec_dst.s_addr = tcpha.hash[3];
+	}
+#endif
+	u->bUdpSource = true;
+}
+
+#ifdef USE_MMSG
+/*!
+ * Datagram rings used by the voice thread. All datagrams pending on a socket are
+ * drained with one recvmmsg(), and the voice packets generated while handling
+ * them are queued and transmitted with sendmmsg() once the batch is processed.
+ * With a batch size of 1 the send queue is bypassed entirely.
+ */
+class UdpBatch {
+	private:
+		Q_DISABLE_COPY(UdpBatch)
+	public:
+		struct Slot {
+			sockaddr_storage addr;
+			// Payload starts 4 bytes in, so the ciphertext following the
+			// crypt header is 8-byte aligned, same as in Server::run().
+			char buffer[UDP_PACKET_SIZE + 8];
+			struct iovec iov;
+			u_char controldata[CMSG_SPACE(MAX(sizeof(struct in6_pktinfo),sizeof(struct in_pktinfo)))];
+
+			char *data() {
+				return buffer + 4;
+			}
+		};
+
+		VoiceShard *vs;
+		int iSize;
+
+		Slot *rxSlots;
+		struct mmsghdr *rxMsgs;
+
+		Slot *txSlots;
+		struct mmsghdr *txMsgs;
+		int iTxCount;
+		int iTxSocket;
+
+		UdpBatch(VoiceShard *shard, int size);
+		~UdpBatch();
+		int receive(int sock);
+		void queue(ServerUser *u, const char *data, int len);
+		void flush();
+};
+
+UdpBatch::UdpBatch(VoiceShard *shard, int size) : vs(shard) {
+	iSize = qBound(1, size, UDP_MAX_BATCH);
+	iTxCount = 0;
+	iTxSocket = INVALID_SOCKET;
+
+	rxSlots = new Slot[iSize];
+	rxMsgs = new struct mmsghdr[iSize];
+	txSlots = new Slot[iSize];
+	txMsgs = new struct mmsghdr[iSize];
+
+	memset(rxMsgs, 0, sizeof(struct mmsghdr) * iSize);
+	memset(txMsgs, 0, sizeof(struct mmsghdr) * iSize);
+
+	for (int i=0;i<iSize;++i) {
+		rxSlots[i].iov.iov_base = rxSlots[i].data();
+		rxMsgs[i].msg_hdr.msg_name = reinterpret_cast<struct sockaddr *>(& rxSlots[i].addr);
+		rxMsgs[i].msg_hdr.msg_iov = & rxSlots[i].iov;
+		rxMsgs[i].msg_hdr.msg_iovlen = 1;
+		rxMsgs[i].msg_hdr.msg_control = rxSlots[i].controldata;
+
+		txSlots[i].iov.iov_base = txSlots[i].data();
+		txMsgs[i].msg_hdr.msg_name = reinterpret_cast<struct sockaddr *>(& txSlots[i].addr);
+		txMsgs[i].msg_hdr.msg_iov = & txSlots[i].iov;
+		txMsgs[i].msg_hdr.msg_iovlen = 1;
+		txMsgs[i].msg_hdr.msg_control = txSlots[i].controldata;
+	}
+}
+
+UdpBatch::~UdpBatch() {
+	delete [] rxSlots;
+	delete [] rxMsgs;
+	delete [] txSlots;
+	delete [] txMsgs;
+}
+
+int UdpBatch::receive(int sock) {
+	// The kernel overwrites these on every call.
+	for (int i=0;i<iSize;++i) {
+		rxSlots[i].iov.iov_len = UDP_PACKET_SIZE;
+		rxMsgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+		rxMsgs[i].msg_hdr.msg_controllen = sizeof(rxSlots[i].controldata);
+		rxMsgs[i].msg_hdr.msg_flags = 0;
+	}
+	return ::recvmmsg(sock, rxMsgs, iSize, MSG_TRUNC | MSG_DONTWAIT, NULL);
+}
+
+void UdpBatch::queue(ServerUser *u, const char *data, int len) {
+	if ((iTxCount == iSize) || ((iTxCount > 0) && (iTxSocket != u->sUdpSocket)))
+		flush();
+
+	Slot &slot = txSlots[iTxCount];
+	struct msghdr &msg = txMsgs[iTxCount].msg_hdr;
+
+	{
+		QMutexLocker l(&u->qmCrypt);
+		if (! u->bUdpSource)
+			return;
+		// The user may be gone by the time the ring is flushed, so the
+		// header template is copied rather than referenced.
+		msg.msg_namelen = u->mhUdp.msg_namelen;
+		memcpy(& slot.addr, & u->saiUdpAddress, msg.msg_namelen);
+		msg.msg_controllen = u->mhUdp.msg_controllen;
+		memcpy(slot.controldata, u->aucUdpControl, msg.msg_controllen);
+		u->csCrypt.encrypt(reinterpret_cast<const unsigned char *>(data), reinterpret_cast<unsigned char *>(slot.data()), len);
+	}
+	slot.iov.iov_len = len + 4;
+
+	iTxSocket = u->sUdpSocket;
+	++iTxCount;
+}
+
+void UdpBatch::flush() {
+	int sent = 0;
+	while (sent < iTxCount) {
+		int ret = ::sendmmsg(iTxSocket, txMsgs + sent, iTxCount - sent, 0);
+		++vs->uiSendCalls;
+		if (ret > 0) {
+			vs->uiSendPackets += ret;
+			sent += ret;
+			continue;
+		}
+		if ((ret < 0) && (errno == EINTR))
+			continue;
+
+		// sendmmsg() only fails when the first remaining datagram does. Retry
+		// that one on its own, so one bad destination doesn't cost the rest of
+		// the ring, and drop it if that fails too.
+		++vs->uiSendCalls;
+		if (::sendmsg(iTxSocket, & txMsgs[sent].msg_hdr, 0) >= 0) {
+			++vs->uiSendPackets;
+		} else if (vs->uiSendDropped++ == 0) {
+			qWarning("Voice thread %d: dropping datagram: %s", vs->iShard, strerror(errno));
+		}
+		++sent;
+	}
+	iTxCount = 0;
+}
+#endif
+
+class VoiceThread : public QThread {
+	private:
+		Q_DISABLE_COPY(VoiceThread)
+	protected:
+		Server *s;
+		VoiceShard *vs;
+		void run() {
+			s->voiceLoop(vs);
+		}
+	public:
+		VoiceThread(Server *srv, VoiceShard *shard) : QThread(srv), s(srv), vs(shard) {
+		}
+};
+
+VoiceShard::VoiceShard(int shard) {
+	iShard = shard;
+	qtThread = NULL;
+#ifdef Q_OS_UNIX
+	aiNotify[0] = aiNotify[1] = -1;
+#endif
+	ubBatch = NULL;
+	uiNow = 0;
+	uiRecvCalls = uiRecvPackets = 0;
+	uiSendCalls = uiSendPackets = uiSendDropped = 0;
+}
+
+UserLock::UserLock() : qrwlShared(QReadWriteLock::Recursive) {
+	setReaders(1);
+}
+
+UserLock::~UserLock() {
+	qDeleteAll(qlSlots);
+}
+
+/*!
+ * Sets up one read slot per voice thread. Must not be called while the lock
+ * is in use.
+ */
+void UserLock::setReaders(int readers) {
+	qDeleteAll(qlSlots);
+	qlSlots.clear();
+	for (int i=0;i<readers;++i)
+		qlSlots << new QMutex();
+}
+
+/// The slot of a voice thread, or NULL for everybody else.
+QMutex *UserLock::readSlot(int slot) {
+	if ((slot < 0) || (slot >= qlSlots.count()))
+		return NULL;
+	return qlSlots.at(slot);
+}
+
+void UserLock::lockForRead(int slot) {
+	QMutex *m = readSlot(slot);
+	if (m)
+		m->lock();
+	else
+		qrwlShared.lockForRead();
+}
+
+void UserLock::unlockRead(int slot) {
+	QMutex *m = readSlot(slot);
+	if (m)
+		m->unlock();
+	else
+		qrwlShared.unlock();
+}
+
+void UserLock::lockForWrite() {
+	// Writers serialize on qmWrite first, so the slots are always taken in order.
+	qmWrite.lock();
+	foreach(QMutex *m, qlSlots)
+		m->lock();
+	qrwlShared.lockForWrite();
+}
+
+void UserLock::unlockWrite() {
+	qrwlShared.unlock();
+	foreach(QMutex *m, qlSlots)
+		m->unlock();
+	qmWrite.unlock();
+}
+
+UserReadLocker::UserReadLocker(UserLock *lock, int slot) : ulLock(lock), iSlot(slot) {
+	ulLock->lockForRead(iSlot);
+	bLocked = true;
+}
+
+UserReadLocker::~UserReadLocker() {
+	if (bLocked)
+		ulLock->unlockRead(iSlot);
+}
+
+void UserReadLocker::unlock() {
+	if (bLocked) {
+		ulLock->unlockRead(iSlot);
+		bLocked = false;
+	}
+}
+
+void UserReadLocker::relock() {
+	if (! bLocked) {
+		ulLock->lockForRead(iSlot);
+		bLocked = true;
+	}
+}
+
+UserWriteLocker::UserWriteLocker(UserLock *lock) : ulLock(lock) {
+	ulLock->lockForWrite();
+}
+
+UserWriteLocker::~UserWriteLocker() {
+	ulLock->unlockWrite();
+}
+
 LogEmitter::LogEmitter(QObject *p) : QObject(p) {
 };
 
@@ -92,9 +403,7 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 	bsRegistration = NULL;
 #endif
 
-#ifdef Q_OS_UNIX
-	aiNotify[0] = aiNotify[1] = -1;
-#else
+#ifdef Q_OS_WIN
 	hNotify = NULL;
 #endif
 	qtTimeout = new QTimer(this);
@@ -103,8 +412,12 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 	bPreferAlpha = false;
 	bOpus = true;
 
+	uiSpeechVersion = 1;
+
 	qnamNetwork = NULL;
 
+	const quint64 queries = ServerDB::uiQueries;
+
 	readParams();
 	initialize();
 
@@ -125,6 +438,18 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 	if (! bValid)
 		return;
 
+#ifndef USE_REUSEPORT
+	if (iVoiceThreads > 1) {
+		log("Multiple voice threads are not supported on this platform");
+		iVoiceThreads = 1;
+	}
+#endif
+
+	for (int i=0;i<iVoiceThreads;++i)
+		qlVoiceShards << new VoiceShard(i);
+	ulUsers.setReaders(iVoiceThreads);
+	ptPeers.setReaders(iVoiceThreads);
+
 	foreach(SslServer *ss, qlServer) {
 		sockaddr_storage addr;
 #ifdef Q_OS_UNIX
@@ -136,74 +461,93 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 #endif
 		memset(&addr, 0, sizeof(addr));
 		getsockname(tcpsock, reinterpret_cast<struct sockaddr *>(&addr), &len);
+
+		foreach(VoiceShard *vs, qlVoiceShards) {
 #ifdef Q_OS_UNIX
-		int sock = ::socket(addr.ss_family, SOCK_DGRAM, 0);
+			int sock = ::socket(addr.ss_family, SOCK_DGRAM, 0);
 #ifdef Q_OS_LINUX
-		int sockopt = 1;
-		if (setsockopt(sock, IPPROTO_IP, IP_PKTINFO, &sockopt, sizeof(sockopt)))
-			log(QString("Failed to set IP_PKTINFO for %1").arg(addressToString(ss->serverAddress(), usPort)));
-		sockopt = 1;
-		if (setsockopt(sock, IPPROTO_IPV6, IPV6_RECVPKTINFO, &sockopt, sizeof(sockopt)))
-			log(QString("Failed to set IPV6_RECVPKTINFO for %1").arg(addressToString(ss->serverAddress(), usPort)));
+			int sockopt = 1;
+			if (setsockopt(sock, IPPROTO_IP, IP_PKTINFO, &sockopt, sizeof(sockopt)))
+				log(QString("Failed to set IP_PKTINFO for %1").arg(addressToString(ss->serverAddress(), usPort)));
+			sockopt = 1;
+			if (setsockopt(sock, IPPROTO_IPV6, IPV6_RECVPKTINFO, &sockopt, sizeof(sockopt)))
+				log(QString("Failed to set IPV6_RECVPKTINFO for %1").arg(addressToString(ss->serverAddress(), usPort)));
+#endif
+#ifdef USE_REUSEPORT
+			if (iVoiceThreads > 1) {
+				sockopt = 1;
+				if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &sockopt, sizeof(sockopt)))
+					log(QString("Failed to set SO_REUSEPORT for %1").arg(addressToString(ss->serverAddress(), usPort)));
+			}
 #endif
 #else
 #ifndef SIO_UDP_CONNRESET
 #define SIO_UDP_CONNRESET _WSAIOW(IOC_VENDOR,12)
 #endif
-		SOCKET sock = ::WSASocket(addr.ss_family, SOCK_DGRAM, IPPROTO_UDP, NULL, 0, WSA_FLAG_OVERLAPPED);
-		DWORD dwBytesReturned = 0;
-		BOOL bNewBehaviour = FALSE;
-		if (WSAIoctl(sock, SIO_UDP_CONNRESET, &bNewBehaviour, sizeof(bNewBehaviour), NULL, 0, &dwBytesReturned, NULL, NULL) == SOCKET_ERROR) {
-			log(QString("Failed to set SIO_UDP_CONNRESET: %1").arg(WSAGetLastError()));
-		}
+			SOCKET sock = ::WSASocket(addr.ss_family, SOCK_DGRAM, IPPROTO_UDP, NULL, 0, WSA_FLAG_OVERLAPPED);
+			DWORD dwBytesReturned = 0;
+			BOOL bNewBehaviour = FALSE;
+			if (WSAIoctl(sock, SIO_UDP_CONNRESET, &bNewBehaviour, sizeof(bNewBehaviour), NULL, 0, &dwBytesReturned, NULL, NULL) == SOCKET_ERROR) {
+				log(QString("Failed to set SIO_UDP_CONNRESET: %1").arg(WSAGetLastError()));
+			}
 #endif
-		if (sock == INVALID_SOCKET) {
-			log("Failed to create UDP Socket");
-			bValid = false;
-			return;
-		} else {
-			if (::bind(sock, reinterpret_cast<sockaddr *>(&addr), len) == SOCKET_ERROR) {
-				log(QString("Failed to bind UDP Socket to %1").arg(addressToString(ss->serverAddress(), usPort)));
+			if (sock == INVALID_SOCKET) {
+				log("Failed to create UDP Socket");
+				bValid = false;
+				return;
 			} else {
+				if (::bind(sock, reinterpret_cast<sockaddr *>(&addr), len) == SOCKET_ERROR) {
+					log(QString("Failed to bind UDP Socket to %1").arg(addressToString(ss->serverAddress(), usPort)));
+				} else {
 #ifdef Q_OS_UNIX
-				int val = 0xe0;
-				if (setsockopt(sock, IPPROTO_IP, IP_TOS, &val, sizeof(val))) {
-					val = 0x80;
-					if (setsockopt(sock, IPPROTO_IP, IP_TOS, &val, sizeof(val)))
-						log("Server: Failed to set TOS for UDP Socket");
-				}
+					int val = 0xe0;
+					if (setsockopt(sock, IPPROTO_IP, IP_TOS, &val, sizeof(val))) {
+						val = 0x80;
+						if (setsockopt(sock, IPPROTO_IP, IP_TOS, &val, sizeof(val)))
+							log("Server: Failed to set TOS for UDP Socket");
+					}
 #if defined(SO_PRIORITY)
-				socklen_t optlen = sizeof(val);
-				if (getsockopt(sock, SOL_SOCKET, SO_PRIORITY, &val, &optlen) == 0) {
-					if (val == 0) {
-						val = 6;
-						setsockopt(sock, SOL_SOCKET, SO_PRIORITY, &val, sizeof(val));
+					socklen_t optlen = sizeof(val);
+					if (getsockopt(sock, SOL_SOCKET, SO_PRIORITY, &val, &optlen) == 0) {
+						if (val == 0) {
+							val = 6;
+							setsockopt(sock, SOL_SOCKET, SO_PRIORITY, &val, sizeof(val));
+						}
 					}
-				}
 #endif
 #endif
+				}
+				// Pings may arrive on any shard's socket, so all of them are
+				// watched while the voice threads are stopped.
+				QSocketNotifier *qsn = new QSocketNotifier(sock, QSocketNotifier::Read, this);
+				connect(qsn, SIGNAL(activated(int)), this, SLOT(udpActivated(int)));
+				qlUdpSocket << sock;
+				qlUdpNotifier << qsn;
+				vs->qlSockets << sock;
 			}
-			QSocketNotifier *qsn = new QSocketNotifier(sock, QSocketNotifier::Read, this);
-			connect(qsn, SIGNAL(activated(int)), this, SLOT(udpActivated(int)));
-			qlUdpSocket << sock;
-			qlUdpNotifier << qsn;
 		}
 	}
 
-	bValid = bValid && (qlServer.count() == qlBind.count()) && (qlUdpSocket.count() == qlBind.count());
+	bValid = bValid && (qlServer.count() == qlBind.count()) && (qlUdpSocket.count() == qlBind.count() * iVoiceThreads);
 	if (! bValid)
 		return;
 
 #ifdef Q_OS_UNIX
-	if (socketpair(AF_UNIX, SOCK_STREAM, 0, aiNotify) != 0) {
-		log("Failed to create notify socket");
-		bValid = false;
-		return;
+	foreach(VoiceShard *vs, qlVoiceShards) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, vs->aiNotify) != 0) {
+			log("Failed to create notify socket");
+			bValid = false;
+			return;
+		}
 	}
 #else
 	hNotify = CreateEvent(NULL, FALSE, FALSE, NULL);
 #endif
 
+	foreach(VoiceShard *vs, qlVoiceShards)
+		if (vs->iShard > 0)
+			vs->qtThread = new VoiceThread(this, vs);
+
 	connect(this, SIGNAL(tcpTransmit(QByteArray, unsigned int)), this, SLOT(tcpTransmitData(QByteArray, unsigned int)), Qt::QueuedConnection);
 	connect(this, SIGNAL(reqSync(unsigned int)), this, SLOT(doSync(unsigned int)));
 
@@ -212,11 +556,18 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 
 	connect(qtTimeout, SIGNAL(timeout()), this, SLOT(checkTimeout()));
 
-	getBans();
-	readChannels();
-	readLinks();
+	uiSnapshotGeneration = ServerDB::getSnapshotGeneration(iServerNum);
+	bSnapshotDirty = false;
+	if (! loadSnapshot()) {
+		getBans();
+		readChannels();
+		readLinks();
+		bSnapshotDirty = true;
+	}
 	initializeCert();
 
+	log(QString("Loaded %1 channels and %2 bans with %3 database queries").arg(qhChannels.count()).arg(qlBans.count()).arg(ServerDB::uiQueries - queries));
+
 	int major, minor, patch;
 	QString release;
 	Meta::getVersion(major, minor, patch, release);
@@ -235,12 +586,18 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 
 void Server::startThread() {
 	if (! isRunning()) {
-		log("Starting voice thread");
+		if (qlVoiceShards.count() > 1)
+			log(QString("Starting %1 voice threads").arg(qlVoiceShards.count()));
+		else
+			log("Starting voice thread");
 		bRunning = true;
 
 		foreach(QSocketNotifier *qsn, qlUdpNotifier)
 			qsn->setEnabled(false);
 		start(QThread::HighestPriority);
+		foreach(VoiceShard *vs, qlVoiceShards)
+			if (vs->qtThread)
+				vs->qtThread->start(QThread::HighestPriority);
 #ifdef Q_OS_LINUX
 		// QThread::HighestPriority == Same as everything else...
 		int policy;
@@ -263,17 +620,41 @@ void Server::stopThread() {
 	if (isRunning()) {
 		log("Ending voice thread");
 
+		foreach(VoiceShard *vs, qlVoiceShards) {
 #ifdef Q_OS_UNIX
-		unsigned char val = 0;
-		if (::write(aiNotify[1], &val, 1) != 1)
-			log("Failed to signal voice thread");
+			unsigned char val = 0;
+			if (::write(vs->aiNotify[1], &val, 1) != 1)
+				log("Failed to signal voice thread");
 #else
-		SetEvent(hNotify);
+			SetEvent(hNotify);
 #endif
+		}
+
 		wait();
+		foreach(VoiceShard *vs, qlVoiceShards)
+			if (vs->qtThread)
+				vs->qtThread->wait();
 
 		foreach(QSocketNotifier *qsn, qlUdpNotifier)
 			qsn->setEnabled(true);
+
+		quint64 recvCalls = 0, recvPackets = 0, sendCalls = 0, sendPackets = 0, sendDropped = 0;
+		foreach(VoiceShard *vs, qlVoiceShards) {
+			recvCalls += vs->uiRecvCalls;
+			recvPackets += vs->uiRecvPackets;
+			sendCalls += vs->uiSendCalls;
+			sendPackets += vs->uiSendPackets;
+			sendDropped += vs->uiSendDropped;
+			vs->uiRecvCalls = vs->uiRecvPackets = 0;
+			vs->uiSendCalls = vs->uiSendPackets = vs->uiSendDropped = 0;
+		}
+
+		if (recvCalls || sendCalls) {
+			log(QString("Voice thread batching: %1 datagrams in %2 receive calls (%3 per call), %4 datagrams in %5 send calls (%6 per call), %7 dropped")
+			    .arg(recvPackets).arg(recvCalls).arg(recvCalls ? static_cast<double>(recvPackets) / recvCalls : 0.0, 0, 'f', 2)
+			    .arg(sendPackets).arg(sendCalls).arg(sendCalls ? static_cast<double>(sendPackets) / sendCalls : 0.0, 0, 'f', 2)
+			    .arg(sendDropped));
+		}
 	}
 	qtTimeout->stop();
 }
@@ -285,6 +666,9 @@ Server::~Server() {
 
 	stopThread();
 
+	if (bSnapshotDirty)
+		writeSnapshot();
+
 	foreach(QSocketNotifier *qsn, qlUdpNotifier)
 		delete qsn;
 
@@ -292,17 +676,26 @@ Server::~Server() {
 	foreach(int s, qlUdpSocket)
 		close(s);
 
-	if (aiNotify[0] >= 0)
-		close(aiNotify[0]);
-	if (aiNotify[1] >= 0)
-		close(aiNotify[1]);
+	foreach(VoiceShard *vs, qlVoiceShards) {
+		if (vs->aiNotify[0] >= 0)
+			close(vs->aiNotify[0]);
+		if (vs->aiNotify[1] >= 0)
+			close(vs->aiNotify[1]);
+	}
 #else
 	foreach(SOCKET s, qlUdpSocket)
 		closesocket(s);
 	if (hNotify)
 		CloseHandle(hNotify);
 #endif
+	foreach(VoiceShard *vs, qlVoiceShards) {
+		delete vs->qtThread;
+		delete vs;
+	}
+	qlVoiceShards.clear();
+
 	clearACLCache();
+	flushLastChannels();
 
 	log("Stopped");
 }
@@ -316,6 +709,7 @@ void Server::readParams() {
 	iMaxUsersPerChannel = Meta::mp.iMaxUsersPerChannel;
 	iMaxTextMessageLength = Meta::mp.iMaxTextMessageLength;
 	iMaxImageMessageLength = Meta::mp.iMaxImageMessageLength;
+	bsBlobs.setLimit(Meta::mp.iBlobCache);
 	bAllowHTML = Meta::mp.bAllowHTML;
 	iDefaultChan = Meta::mp.iDefaultChan;
 	bRememberChan = Meta::mp.bRememberChan;
@@ -332,6 +726,8 @@ void Server::readParams() {
 	bAllowPing = Meta::mp.bAllowPing;
 	bCertRequired = Meta::mp.bCertRequired;
 	bForceExternalAuth = Meta::mp.bForceExternalAuth;
+	iUdpBatchSize = Meta::mp.iUdpBatchSize;
+	iVoiceThreads = Meta::mp.iVoiceThreads;
 	qrUserName = Meta::mp.qrUserName;
 	qrChannelName = Meta::mp.qrChannelName;
 	qvSuggestVersion = Meta::mp.qvSuggestVersion;
@@ -375,6 +771,7 @@ void Server::readParams() {
 	iMaxUsersPerChannel = getConf("usersperchannel", iMaxUsersPerChannel).toInt();
 	iMaxTextMessageLength = getConf("textmessagelength", iMaxTextMessageLength).toInt();
 	iMaxImageMessageLength = getConf("imagemessagelength", iMaxImageMessageLength).toInt();
+	bsBlobs.setLimit(getConf("blobcache", bsBlobs.limit()).toInt());
 	bAllowHTML = getConf("allowhtml", bAllowHTML).toBool();
 	iDefaultChan = getConf("defaultchannel", iDefaultChan).toInt();
 	bRememberChan = getConf("rememberchannel", bRememberChan).toBool();
@@ -391,6 +788,8 @@ void Server::readParams() {
 	bAllowPing = getConf("allowping", bAllowPing).toBool();
 	bCertRequired = getConf("certrequired", bCertRequired).toBool();
 	bForceExternalAuth = getConf("forceExternalAuth", bForceExternalAuth).toBool();
+	iUdpBatchSize = qBound(1, getConf("udpbatchsize", iUdpBatchSize).toInt(), UDP_MAX_BATCH);
+	iVoiceThreads = qBound(1, getConf("voicethreads", iVoiceThreads).toInt(), MAX_VOICE_THREADS);
 
 	qvSuggestVersion = getConf("suggestversion", qvSuggestVersion);
 	if (qvSuggestVersion.toUInt() == 0)
@@ -455,6 +854,8 @@ void Server::setLiveConf(const QString &key, const QString &value) {
 			mpsc.set_image_message_length(length);
 			sendAll(mpsc);
 		}
+	} else if (key == "blobcache") {
+		bsBlobs.setLimit(i ? i : Meta::mp.iBlobCache);
 	} else if (key == "allowhtml") {
 		bool allow = !v.isNull() ? QVariant(v).toBool() : Meta::mp.bAllowHTML;
 		if (allow != bAllowHTML) {
@@ -501,6 +902,7 @@ void Server::setLiveConf(const QString &key, const QString &value) {
 		QString text = !v.isNull() ? v : Meta::mp.qsRegName;
 		if (text != qsRegName) {
 			qsRegName = text;
+			invalidateChannelSync(qhChannels.value(0));
 			if (! qsRegName.isEmpty()) {
 				MumbleProto::ChannelState mpcs;
 				mpcs.set_channel_id(0);
@@ -625,29 +1027,43 @@ void Server::udpActivated(int socket) {
 }
 
 void Server::run() {
+	voiceLoop(qlVoiceShards.at(0));
+}
+
+void Server::voiceLoop(VoiceShard *vs) {
 	qint32 len;
+#if !defined(USE_MMSG)
 #if defined(__LP64__)
 	char encbuff[UDP_PACKET_SIZE+8];
 	char *encrypt = encbuff + 4;
 #else
 	char encrypt[UDP_PACKET_SIZE];
+#endif
+	sockaddr_storage from;
 #endif
 	char buffer[UDP_PACKET_SIZE];
 
-	sockaddr_storage from;
-	int nfds = qlUdpSocket.count();
+	int nfds = vs->qlSockets.count();
+
+#ifdef USE_MMSG
+	UdpBatch ubBatch(vs, iUdpBatchSize);
+	if (iUdpBatchSize > 1)
+		vs->ubBatch = &ubBatch;
+#endif
 
 #ifdef Q_OS_UNIX
+#ifndef USE_MMSG
 	socklen_t fromlen;
+#endif
 	STACKVAR(struct pollfd, fds, nfds+1);
 
 	for (int i=0;i<nfds;++i) {
-		fds[i].fd = qlUdpSocket.at(i);
+		fds[i].fd = vs->qlSockets.at(i);
 		fds[i].events = POLLIN;
 		fds[i].revents = 0;
 	}
 
-	fds[nfds].fd=aiNotify[0];
+	fds[nfds].fd=vs->aiNotify[0];
 	fds[nfds].events = POLLIN;
 	fds[nfds].revents = 0;
 #else
@@ -655,7 +1071,7 @@ void Server::run() {
 	STACKVAR(SOCKET, fds, nfds);
 	STACKVAR(HANDLE, events, nfds+1);
 	for (int i=0;i<nfds;++i) {
-		fds[i] = qlUdpSocket.at(i);
+		fds[i] = vs->qlSockets.at(i);
 		events[i] = CreateEvent(NULL, FALSE, FALSE, NULL);
 		::WSAEventSelect(fds[i], events[i], FD_READ);
 	}
@@ -678,7 +1094,7 @@ void Server::run() {
 		if (fds[nfds - 1].revents) {
 			// Drain pipe
 			unsigned char val;
-			while (::recv(aiNotify[0], &val, 1, MSG_DONTWAIT) == 1) {};
+			while (::recv(vs->aiNotify[0], &val, 1, MSG_DONTWAIT) == 1) {};
 			break;
 		}
 
@@ -706,6 +1122,13 @@ void Server::run() {
 				SOCKET sock = fds[ret - WAIT_OBJECT_0];
 #endif
 
+#ifdef USE_MMSG
+				int npackets = ubBatch.receive(sock);
+				if (npackets <= 0)
+					break;
+				++vs->uiRecvCalls;
+				vs->uiRecvPackets += npackets;
+#else
 				fromlen = sizeof(from);
 #ifdef Q_OS_WIN
 				len=::recvfrom(sock, encrypt, UDP_PACKET_SIZE, 0, reinterpret_cast<struct sockaddr *>(&from), &fromlen);
@@ -736,97 +1159,116 @@ void Server::run() {
 					break;
 				} else if (len == SOCKET_ERROR) {
 					break;
-				} else if (len < 5) {
-					// 4 bytes crypt header + type + session
-					continue;
-				} else if (len > UDP_PACKET_SIZE) {
-					continue;
 				}
+				const int npackets = 1;
+#endif
+				vs->uiNow = Timer::now();
+				for (int pkt = 0; pkt < npackets; ++pkt) {
+#ifdef USE_MMSG
+					UdpBatch::Slot &slot = ubBatch.rxSlots[pkt];
+					struct msghdr &msg = ubBatch.rxMsgs[pkt].msg_hdr;
+					char *encrypt = slot.data();
+					sockaddr_storage &from = slot.addr;
+
+					len = static_cast<qint32>(ubBatch.rxMsgs[pkt].msg_len);
+#endif
+					if (len < 5) {
+						// 4 bytes crypt header + type + session
+						continue;
+					} else if (len > UDP_PACKET_SIZE) {
+						continue;
+					}
 
-				QReadLocker rl(&qrwlUsers);
-
-				quint32 *ping = reinterpret_cast<quint32 *>(encrypt);
+					quint32 *ping = reinterpret_cast<quint32 *>(encrypt);
 
-				if ((len == 12) && (*ping == 0) && bAllowPing) {
-					ping[0] = uiVersionBlob;
-					// 1 and 2 will be the timestamp, which we return unmodified.
-					ping[3] = qToBigEndian(static_cast<quint32>(qhUsers.count()));
-					ping[4] = qToBigEndian(static_cast<quint32>(iMaxUsers));
-					ping[5] = qToBigEndian(static_cast<quint32>(iMaxBandwidth));
+					if ((len == 12) && (*ping == 0) && bAllowPing) {
+						ping[0] = uiVersionBlob;
+						// 1 and 2 will be the timestamp, which we return unmodified.
+						ping[3] = qToBigEndian(static_cast<quint32>(qaiUserCount.fetchAndAddRelaxed(0)));
+						ping[4] = qToBigEndian(static_cast<quint32>(iMaxUsers));
+						ping[5] = qToBigEndian(static_cast<quint32>(iMaxBandwidth));
 
 #ifdef Q_OS_LINUX
-					iov[0].iov_len = 6 * sizeof(quint32);
-					::sendmsg(sock, &msg, 0);
+						msg.msg_iov[0].iov_len = 6 * sizeof(quint32);
+						::sendmsg(sock, &msg, 0);
 #else
-					::sendto(sock, encrypt, 6 * sizeof(quint32), 0, reinterpret_cast<struct sockaddr *>(&from), fromlen);
+						::sendto(sock, encrypt, 6 * sizeof(quint32), 0, reinterpret_cast<struct sockaddr *>(&from), fromlen);
 #endif
-					continue;
-				}
+						continue;
+					}
 
 
-				quint16 port = (from.ss_family == AF_INET6) ? (reinterpret_cast<sockaddr_in6 *>(&from)->sin6_port) : (reinterpret_cast<sockaddr_in *>(&from)->sin_port);
-				const HostAddress &ha = HostAddress(from);
+					quint16 port = (from.ss_family == AF_INET6) ? (reinterpret_cast<sockaddr_in6 *>(&from)->sin6_port) : (reinterpret_cast<sockaddr_in *>(&from)->sin_port);
+					const HostAddress &ha = HostAddress(from);
 
-				const QPair<HostAddress, quint16> &key = QPair<HostAddress, quint16>(ha, port);
+					// The peer lookup itself is lock-free. The read lock is what keeps the
+					// user found there alive (users are only removed under the write lock)
+					// and guards the channel tables processMsg() walks. It is this voice
+					// thread's own slot, so it only ever waits for a writer.
+					UserReadLocker rl(&ulUsers, vs->iShard);
 
-				ServerUser *u = qhPeerUsers.value(key);
-				if (u) {
-					if (! checkDecrypt(u, encrypt, buffer, len)) {
-						continue;
-					}
-				} else {
-					// Unknown peer
-					foreach(ServerUser *usr, qhHostUsers.value(ha)) {
-						if (usr->csCrypt.isValid() && checkDecrypt(usr, encrypt, buffer, len)) {
-							// Every time we relock, reverify users' existance.
-							// The main thread might delete the user while the lock isn't held.
-							unsigned int uiSession = usr->uiSession;
-							rl.unlock();
-							qrwlUsers.lockForWrite();
-							if (qhUsers.contains(uiSession)) {
-								u = usr;
-								u->sUdpSocket = sock;
-								memcpy(& u->saiUdpAddress, &from, sizeof(from));
-								qhHostUsers[from].remove(u);
-								qhPeerUsers.insert(key, u);
-								qrwlUsers.unlock();
-								rl.relock();
-								if (! qhUsers.contains(uiSession))
-									u = NULL;
+					ServerUser *u;
+					{
+						PeerTable::ReadGuard pg(&ptPeers, vs->iShard);
+						u = pg.peer(ha, port);
+						if (u) {
+							if (! checkDecrypt(u, encrypt, buffer, len)) {
+								continue;
+							}
+						} else {
+							// Unknown peer. Users can't be removed from the table
+							// while we hold the read lock, so binding can't race removal.
+							ServerUser *usr;
+							int pos = -1;
+							while ((usr = pg.host(ha, pos))) {
+								if (usr->csCrypt.isValid() && checkDecrypt(usr, encrypt, buffer, len)) {
+									if (ptPeers.bind(usr, ha, port)) {
+										QMutexLocker l(&usr->qmCrypt);
+										setUdpPeer(usr, from);
+										usr->sUdpSocket = sock;
+										u = usr;
+									}
+									break;
+								}
+							}
+							if (! u) {
+								continue;
 							}
-							break;
 						}
 					}
-					if (! u) {
-						continue;
+					len -= 4;
+
+					MessageHandler::UDPMessageType msgType = static_cast<MessageHandler::UDPMessageType>((buffer[0] >> 5) & 0x7);
+
+					switch (msgType) {
+						case MessageHandler::UDPVoiceSpeex:
+						case MessageHandler::UDPVoiceCELTAlpha:
+						case MessageHandler::UDPVoiceCELTBeta:
+							if (bOpus)
+								break;
+						case MessageHandler::UDPVoiceOpus: {
+								u->bUdp = true;
+								processMsg(u, buffer, len, vs);
+								break;
+							}
+						case MessageHandler::UDPPing: {
+								QByteArray qba;
+								sendMessage(u, buffer, len, qba, true, vs);
+							}
 					}
 				}
-				len -= 4;
-
-				MessageHandler::UDPMessageType msgType = static_cast<MessageHandler::UDPMessageType>((buffer[0] >> 5) & 0x7);
-
-				switch (msgType) {
-					case MessageHandler::UDPVoiceSpeex:
-					case MessageHandler::UDPVoiceCELTAlpha:
-					case MessageHandler::UDPVoiceCELTBeta:
-						if (bOpus)
-							break;
-					case MessageHandler::UDPVoiceOpus: {
-							u->bUdp = true;
-							processMsg(u, buffer, len);
-							break;
-						}
-					case MessageHandler::UDPPing: {
-							QByteArray qba;
-							sendMessage(u, buffer, len, qba, true);
-						}
-				}
+#ifdef USE_MMSG
+				ubBatch.flush();
+#endif
 #ifdef Q_OS_UNIX
 				fds[i].revents = 0;
 #endif
 			}
 		}
 	}
+#ifdef USE_MMSG
+	vs->ubBatch = NULL;
+#endif
 #ifdef Q_OS_WIN
 	for (int i=0;i<nfds-1;++i) {
 		::WSAEventSelect(fds[i], NULL, 0);
@@ -836,70 +1278,66 @@ void Server::run() {
 }
 
 bool Server::checkDecrypt(ServerUser *u, const char *encrypt, char *plain, unsigned int len) {
-	if (u->csCrypt.isValid() && u->csCrypt.decrypt(reinterpret_cast<const unsigned char *>(encrypt), reinterpret_cast<unsigned char *>(plain), len))
-		return true;
+	bool resync = false;
+	{
+		QMutexLocker l(&u->qmCrypt);
+		if (u->csCrypt.isValid() && u->csCrypt.decrypt(reinterpret_cast<const unsigned char *>(encrypt), reinterpret_cast<unsigned char *>(plain), len))
+			return true;
 
-	if (u->csCrypt.tLastGood.elapsed() > 5000000ULL) {
-		if (u->csCrypt.tLastRequest.elapsed() > 5000000ULL) {
+		// The timers are shared with the other voice threads, so they are read
+		// and restarted under qmCrypt too.
+		if ((u->csCrypt.tLastGood.elapsed() > 5000000ULL) && (u->csCrypt.tLastRequest.elapsed() > 5000000ULL)) {
 			u->csCrypt.tLastRequest.restart();
-			emit reqSync(u->uiSession);
+			resync = true;
 		}
 	}
+
+	if (resync)
+		emit reqSync(u->uiSession);
 	return false;
 }
 
-void Server::sendMessage(ServerUser *u, const char *data, int len, QByteArray &cache, bool force) {
+void Server::sendMessage(ServerUser *u, const char *data, int len, QByteArray &cache, bool force, VoiceShard *vs) {
 	if ((u->bUdp || force) && (u->sUdpSocket != INVALID_SOCKET) && u->csCrypt.isValid()) {
+#ifdef USE_MMSG
+		// Voice produced while a voice thread handles a receive batch is queued
+		// and transmitted with a single sendmmsg() once the batch is done.
+		if (vs && vs->ubBatch) {
+			vs->ubBatch->queue(u, data, len);
+			return;
+		}
+#endif
 #if defined(__LP64__)
 		STACKVAR(char, ebuffer, len+4+16);
 		char *buffer = reinterpret_cast<char *>(((reinterpret_cast<quint64>(ebuffer) + 8) & ~7) + 4);
 #else
 		STACKVAR(char, buffer, len+4);
 #endif
-		u->csCrypt.encrypt(reinterpret_cast<const unsigned char *>(data), reinterpret_cast<unsigned char *>(buffer), len);
+#ifdef Q_OS_LINUX
+		struct msghdr msg;
+#endif
+		{
+			QMutexLocker l(&u->qmCrypt);
+			if (! u->bUdpSource)
+				return;
+#ifdef Q_OS_LINUX
+			msg = u->mhUdp;
+#endif
+			u->csCrypt.encrypt(reinterpret_cast<const unsigned char *>(data), reinterpret_cast<unsigned char *>(buffer), len);
+		}
 #ifdef Q_OS_WIN
 		DWORD dwFlow = 0;
 		if (Meta::hQoS)
 			QOSAddSocketToFlow(Meta::hQoS, u->sUdpSocket, reinterpret_cast<struct sockaddr *>(& u->saiUdpAddress), QOSTrafficTypeVoice, QOS_NON_ADAPTIVE_FLOW, &dwFlow);
 #endif
 #ifdef Q_OS_LINUX
-		struct msghdr msg;
 		struct iovec iov[1];
 
 		iov[0].iov_base = buffer;
 		iov[0].iov_len = len+4;
 
-		u_char controldata[CMSG_SPACE(MAX(sizeof(struct in6_pktinfo),sizeof(struct in_pktinfo)))];
-		memset(controldata, 0, sizeof(controldata));
-
-		memset(&msg, 0, sizeof(msg));
-		msg.msg_name = reinterpret_cast<struct sockaddr *>(& u->saiUdpAddress);
-		msg.msg_namelen = (u->saiUdpAddress.ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
 		msg.msg_iov = iov;
 		msg.msg_iovlen = 1;
-		msg.msg_control = controldata;
-		msg.msg_controllen = CMSG_SPACE((u->saiUdpAddress.ss_family == AF_INET6) ? sizeof(struct in6_pktinfo) : sizeof(struct in_pktinfo));
-
-		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
-		HostAddress tcpha(u->saiTcpLocalAddress);
-		if (u->saiUdpAddress.ss_family == AF_INET6) {
-			cmsg->cmsg_level = IPPROTO_IPV6;
-			cmsg->cmsg_type = IPV6_PKTINFO;
-			cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
-			struct in6_pktinfo *pktinfo = reinterpret_cast<struct in6_pktinfo *>(CMSG_DATA(cmsg));
-			memset(pktinfo, 0, sizeof(*pktinfo));
-			memcpy(&pktinfo->ipi6_addr.s6_addr[0], &tcpha.qip6.c[0], sizeof(pktinfo->ipi6_addr.s6_addr));
-		} else {
-			cmsg->cmsg_level = IPPROTO_IP;
-			cmsg->cmsg_type = IP_PKTINFO;
-			cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
-			struct in_pktinfo *pktinfo = reinterpret_cast<struct in_pktinfo *>(CMSG_DATA(cmsg));
-			memset(pktinfo, 0, sizeof(*pktinfo));
-			if (tcpha.isV6())
-				return;
-			pktinfo->ipi_spec_dst.s_addr = tcpha.hash[3];
-		}
-
 
 		::sendmsg(u->sUdpSocket, &msg, 0);
 #else
@@ -911,6 +1349,24 @@ void Server::sendMessage(ServerUser *u, const char *data, int len, QByteArray &c
 #else
 #endif
 	} else {
+		// Each voice thread, and the main thread after it, is a producer of its own.
+		const int producer = vs ? vs->iShard : qlVoiceShards.count();
+		if (u->tunnel(qlVoiceShards.count() + 1)->push(producer, data, static_cast<unsigned int>(len))) {
+			if (u->qaiTunnelQueued.testAndSetOrdered(0, 1)) {
+				QMutexLocker qml(&qmTunnel);
+				qlTunnelUsers.append(u->uiSession);
+				if (qlTunnelUsers.count() == 1)
+					QMetaObject::invokeMethod(this, "flushTunnels", Qt::QueuedConnection);
+			}
+			return;
+		}
+		// The ring only fills up if the main thread stalls; late voice is useless, so drop it.
+		if (len <= UDP_PACKET_SIZE) {
+			if (qaiTunnelDropped.fetchAndAddRelaxed(1) == 0)
+				qWarning("Server: tunnel queue for session %u is full, dropping voice", u->uiSession);
+			return;
+		}
+
 		if (cache.isEmpty())
 			cache = QByteArray(data, len);
 		emit tcpTransmit(cache,u->uiSession);
@@ -920,12 +1376,12 @@ void Server::sendMessage(ServerUser *u, const char *data, int len, QByteArray &c
 #define SENDTO \
 		if ((!pDst->bDeaf) && (!pDst->bSelfDeaf) && (pDst != u)) { \
 			if ((poslen > 0) && (pDst->ssContext == u->ssContext)) \
-				sendMessage(pDst, buffer, len, qba); \
+				sendMessage(pDst, buffer, len, qba, false, vs); \
 			else \
-				sendMessage(pDst, buffer, len - poslen, qba_npos); \
+				sendMessage(pDst, buffer, len - poslen, qba_npos, false, vs); \
 		}
 
-void Server::processMsg(ServerUser *u, const char *data, int len) {
+void Server::processMsg(ServerUser *u, const char *data, int len, VoiceShard *vs) {
 	if (u->sState != ServerUser::Authenticated || u->bMute || u->bSuppress || u->bSelfMute)
 		return;
 
@@ -945,7 +1401,7 @@ void Server::processMsg(ServerUser *u, const char *data, int len) {
 	int packetsize = 20 + 8 + 4 + len;
 
 	// Check the voice data rate limit.
-	if (! bw->addFrame(packetsize, iMaxBandwidth/8)) {
+	if (! bw->addFrame(packetsize, iMaxBandwidth/8, vs ? vs->uiNow : Timer::now())) {
 		// Suppress packet.
 		return;
 	}
@@ -977,29 +1433,38 @@ void Server::processMsg(ServerUser *u, const char *data, int len) {
 
 	if (target == 0x1f) { // Server loopback
 		buffer[0] = static_cast<char>(type | 0);
-		sendMessage(u, buffer, len, qba);
+		sendMessage(u, buffer, len, qba, false, vs);
 		return;
 	} else if (target == 0) { // Normal speech
 		buffer[0] = static_cast<char>(type | 0);
-		foreach(p, c->qlUsers) {
-			ServerUser *pDst = static_cast<ServerUser *>(p);
-			SENDTO;
-		}
 
-		if (! c->qhLinks.isEmpty()) {
-			QSet<Channel *> chans = c->allLinks();
-			chans.remove(c);
+		if ((u->uiSpeechVersion != uiSpeechVersion) || (u->cSpeechChannel != c)) {
+			QVector<ServerUser *> targets;
+			buildSpeechTargets(u, c, targets);
 
-			QMutexLocker qml(&qmCache);
+			unsigned int version = uiSpeechVersion;
+			int slot = vs ? vs->iShard : -1;
+			ulUsers.unlockRead(slot);
+			ulUsers.lockForWrite();
 
-			foreach(Channel *l, chans) {
-				if (ChanACL::hasPermission(u, l, ChanACL::Speak, &acCache)) {
-					foreach(p, l->qlUsers) {
-						ServerUser *pDst = static_cast<ServerUser *>(p);
-						SENDTO;
-					}
-				}
+			if (version == uiSpeechVersion) {
+				u->qvSpeechTargets = targets;
+				u->cSpeechChannel = c;
+				u->uiSpeechVersion = version;
 			}
+			ulUsers.unlockWrite();
+			ulUsers.lockForRead(slot);
+
+			// Anything that could have removed a target, including the
+			// speaker, bumped the version while the lock wasn't held.
+			if (version != uiSpeechVersion)
+				return;
+		}
+
+		const QVector<ServerUser *> &targets = u->qvSpeechTargets;
+		for (int i = 0; i < targets.count(); ++i) {
+			ServerUser *pDst = targets.at(i);
+			SENDTO;
 		}
 	} else if (u->qmTargets.contains(target)) { // Whisper
 		QSet<ServerUser *> channel;
@@ -1036,12 +1501,12 @@ void Server::processMsg(ServerUser *u, const char *data, int len) {
 							if (dochildren)
 								channels.unite(wc->allChildren());
 							const QString &redirect = u->qmWhisperRedirect.value(wtc.qsGroup);
-							const QString &qsg = redirect.isEmpty() ? wtc.qsGroup : redirect;
+							const GroupPredicate gp(redirect.isEmpty() ? wtc.qsGroup : redirect);
 							foreach(Channel *tc, channels) {
 								if (ChanACL::hasPermission(u, tc, ChanACL::Whisper, &acCache)) {
 									foreach(p, tc->qlUsers) {
 										ServerUser *su = static_cast<ServerUser *>(p);
-										if (! group || Group::isMember(tc, tc, qsg, su)) {
+										if (! group || Group::isMember(tc, tc, gp, su)) {
 											channel.insert(su);
 										}
 									}
@@ -1059,13 +1524,14 @@ void Server::processMsg(ServerUser *u, const char *data, int len) {
 			}
 
 			int uiSession = u->uiSession;
-			qrwlUsers.unlock();
-			qrwlUsers.lockForWrite();
+			int slot = vs ? vs->iShard : -1;
+			ulUsers.unlockRead(slot);
+			ulUsers.lockForWrite();
 
 			if (qhUsers.contains(uiSession))
 				u->qmTargetCache.insert(target, ServerUser::TargetCache(channel, direct));
-			qrwlUsers.unlock();
-			qrwlUsers.lockForRead();
+			ulUsers.unlockWrite();
+			ulUsers.lockForRead(slot);
 			if (! qhUsers.contains(uiSession))
 				return;
 		}
@@ -1088,6 +1554,29 @@ void Server::processMsg(ServerUser *u, const char *data, int len) {
 	}
 }
 
+/* Collects the users in c and in every channel linked to it that u may
+ * speak into, in the order normal speech is forwarded. Deafness is checked
+ * per packet, so it isn't part of the list.
+ */
+void Server::buildSpeechTargets(ServerUser *u, Channel *c, QVector<ServerUser *> &targets) {
+	foreach(User *p, c->qlUsers)
+		targets.append(static_cast<ServerUser *>(p));
+
+	if (! c->qhLinks.isEmpty()) {
+		QSet<Channel *> chans = c->allLinks();
+		chans.remove(c);
+
+		QMutexLocker qml(&qmCache);
+
+		foreach(Channel *l, chans) {
+			if (ChanACL::hasPermission(u, l, ChanACL::Speak, &acCache)) {
+				foreach(User *p, l->qlUsers)
+					targets.append(static_cast<ServerUser *>(p));
+			}
+		}
+	}
+}
+
 void Server::log(ServerUser *u, const QString &str) const {
 	QString msg = QString("<%1:%2(%3)> %4").arg(QString::number(u->uiSession),
 	              u->qsName,
@@ -1121,29 +1610,25 @@ void Server::newClient() {
 
 		HostAddress ha(adr);
 
-		QList<Ban> tmpBans = qlBans;
-		foreach(const Ban &ban, qlBans) {
-			if (ban.isExpired())
-				tmpBans.removeOne(ban);
-		}
-		if (qlBans.count() != tmpBans.count()) {
-			qlBans = tmpBans;
-			saveBans();
-		}
-
-		foreach(const Ban &ban, qlBans) {
-			if (ban.haAddress.match(ha, ban.iMask)) {
-				log(QString("Ignoring connection: %1 (Server ban)").arg(addressToString(sock->peerAddress(), sock->peerPort())));
-				sock->disconnectFromHost();
-				sock->deleteLater();
-				return;
+		const quint64 now = BanTrie::now();
+		if (btBans.hasExpired(now)) {
+			QList<Ban> tmpBans = qlBans;
+			foreach(const Ban &ban, qlBans) {
+				if (ban.isExpired())
+					tmpBans.removeOne(ban);
+			}
+			if (qlBans.count() != tmpBans.count()) {
+				qlBans = tmpBans;
+				saveBans();
 			}
 		}
 
-		sock->setPrivateKey(qskKey);
-		sock->setLocalCertificate(qscCert);
-		sock->addCaCertificate(qscCert);
-		sock->addCaCertificates(qlCA);
+		if (btBans.match(ha, now)) {
+			log(QString("Ignoring connection: %1 (Server ban)").arg(addressToString(sock->peerAddress(), sock->peerPort())));
+			sock->disconnectFromHost();
+			sock->deleteLater();
+			return;
+		}
 
 		if (qqIds.isEmpty()) {
 			log(QString("Session ID pool (%1) empty, rejecting connection").arg(iMaxUsers));
@@ -1152,37 +1637,71 @@ void Server::newClient() {
 			return;
 		}
 
-		ServerUser *u = new ServerUser(this, sock);
-		u->uiSession = qqIds.dequeue();
-		u->haAddress = ha;
-		HostAddress(sock->localAddress()).toSockaddr(& u->saiTcpLocalAddress);
-
-		{
-			QWriteLocker wl(&qrwlUsers);
-			qhUsers.insert(u->uiSession, u);
-			qhHostUsers[ha].insert(u);
-		}
-
-		connect(u, SIGNAL(connectionClosed(QAbstractSocket::SocketError, const QString &)), this, SLOT(connectionClosed(QAbstractSocket::SocketError, const QString &)));
-		connect(u, SIGNAL(message(unsigned int, const QByteArray &)), this, SLOT(message(unsigned int, const QByteArray &)));
-		connect(u, SIGNAL(handleSslErrors(const QList<QSslError> &)), this, SLOT(sslError(const QList<QSslError> &)));
-		connect(u, SIGNAL(encrypted()), this, SLOT(encrypted()));
-
-		log(u, QString("New connection: %1").arg(addressToString(sock->peerAddress(), sock->peerPort())));
-
-		u->setToS();
+		sock->setPrivateKey(qskKey);
+		sock->setLocalCertificate(qscCert);
+		sock->addCaCertificate(qscCert);
+		sock->addCaCertificates(qlCA);
 
 #if QT_VERSION >= 0x050000
 		sock->setProtocol(QSsl::TlsV1_0);
 #else
 		sock->setProtocol(QSsl::TlsV1);
 #endif
-		sock->startServerEncryption();
+		meta->hpHandshake->start(sock, this, iTimeout);
 	}
 }
 
-void Server::encrypted() {
-	ServerUser *uSource = qobject_cast<ServerUser *>(sender());
+/**
+ * Picks up a connection once HandshakePool has finished its TLS handshake, or
+ * logs why the handshake failed if \p sock is NULL.
+ */
+void Server::sslHandshake(QSslSocket *sock, bool verified, const QString &peer, const QString &error) {
+	if (! sock) {
+		log(QString("Connection closed: %1 [%2]").arg(error, peer));
+		return;
+	}
+
+	if (qqIds.isEmpty()) {
+		log(QString("Session ID pool (%1) empty, rejecting connection").arg(iMaxUsers));
+		sock->disconnectFromHost();
+		sock->deleteLater();
+		return;
+	}
+
+	HostAddress ha(sock->peerAddress());
+
+	ServerUser *u = new ServerUser(this, sock);
+	u->uiSession = qqIds.dequeue();
+	u->haAddress = ha;
+	u->bVerified = verified;
+	HostAddress(sock->localAddress()).toSockaddr(& u->saiTcpLocalAddress);
+
+	{
+		UserWriteLocker wl(&ulUsers);
+		qhUsers.insert(u->uiSession, u);
+		qaiUserCount.fetchAndStoreRelaxed(qhUsers.count());
+		ptPeers.addHost(u, ha);
+	}
+
+	connect(u, SIGNAL(connectionClosed(QAbstractSocket::SocketError, const QString &)), this, SLOT(connectionClosed(QAbstractSocket::SocketError, const QString &)));
+	connect(u, SIGNAL(message(unsigned int, const QByteArray &)), this, SLOT(message(unsigned int, const QByteArray &)));
+
+	log(u, QString("New connection: %1").arg(addressToString(sock->peerAddress(), sock->peerPort())));
+
+	u->setToS();
+
+	if (sock->state() != QAbstractSocket::ConnectedState) {
+		u->disconnectSocket();
+		return;
+	}
+
+	encrypted(u);
+
+	// Whatever the client sent right after the handshake is already buffered.
+	QMetaObject::invokeMethod(u, "socketRead", Qt::QueuedConnection);
+}
+
+void Server::encrypted(ServerUser *uSource) {
 	int major, minor, patch;
 	QString release;
 
@@ -1236,38 +1755,6 @@ void Server::encrypted() {
 	}
 }
 
-void Server::sslError(const QList<QSslError> &errors) {
-	ServerUser *u = qobject_cast<ServerUser *>(sender());
-	if (!u)
-		return;
-
-	bool ok = true;
-	foreach(QSslError e, errors) {
-		switch (e.error()) {
-			case QSslError::InvalidPurpose:
-				// Allow email certificates.
-				break;
-			case QSslError::NoPeerCertificate:
-			case QSslError::SelfSignedCertificate:
-			case QSslError::SelfSignedCertificateInChain:
-			case QSslError::UnableToGetLocalIssuerCertificate:
-			case QSslError::HostNameMismatch:
-			case QSslError::CertificateNotYetValid:
-			case QSslError::CertificateExpired:
-				u->bVerified = false;
-				break;
-			default:
-				log(u, QString("SSL Error: %1").arg(e.errorString()));
-				ok = false;
-		}
-	}
-
-	if (ok)
-		u->proceedAnyway();
-	else
-		u->disconnectSocket(true);
-}
-
 void Server::connectionClosed(QAbstractSocket::SocketError err, const QString &reason) {
 	Connection *c = qobject_cast<Connection *>(sender());
 	if (! c)
@@ -1278,7 +1765,7 @@ void Server::connectionClosed(QAbstractSocket::SocketError err, const QString &r
 
 	ServerUser *u = static_cast<ServerUser *>(c);
 
-	log(u, QString("Connection closed: %1 [%2]").arg(reason).arg(err));
+	log(u, QString("Connection closed: %1 [%2] (%3 control messages in %4 writes, %5 bytes batched)").arg(reason).arg(err).arg(u->uiBatchMessages).arg(u->uiBatchWrites).arg(u->uiBatchBytes));
 
 	if (u->sState == ServerUser::Authenticated) {
 		MumbleProto::UserRemove mpur;
@@ -1291,14 +1778,12 @@ void Server::connectionClosed(QAbstractSocket::SocketError err, const QString &r
 	Channel *old = u->cChannel;
 
 	{
-		QWriteLocker wl(&qrwlUsers);
+		UserWriteLocker wl(&ulUsers);
 
 		qhUsers.remove(u->uiSession);
-		qhHostUsers[u->haAddress].remove(u);
-
-		quint16 port = (u->saiUdpAddress.ss_family == AF_INET6) ? (reinterpret_cast<sockaddr_in6 *>(&u->saiUdpAddress)->sin6_port) : (reinterpret_cast<sockaddr_in *>(&u->saiUdpAddress)->sin_port);
-		const QPair<HostAddress, quint16> &key = QPair<HostAddress, quint16>(u->haAddress, port);
-		qhPeerUsers.remove(key);
+		qaiUserCount.fetchAndStoreRelaxed(qhUsers.count());
+		ptPeers.remove(u);
+		++uiSpeechVersion;
 
 		if (old)
 			old->removeUser(u);
@@ -1310,6 +1795,9 @@ void Server::connectionClosed(QAbstractSocket::SocketError err, const QString &r
 	if (static_cast<int>(u->uiSession) < iMaxUsers * 2)
 		qqIds.enqueue(u->uiSession); // Reinsert session id into pool
 
+	bsBlobs.release(u->qbaTextureHash, BlobStore::Texture);
+	bsBlobs.release(u->qbaCommentHash, BlobStore::Comment);
+
 	if (u->sState == ServerUser::Authenticated) {
 		clearTempGroups(u); // Also clears ACL cache
 		recheckCodecVersions(); // Maybe can choose a better codec now
@@ -1335,7 +1823,7 @@ void Server::message(unsigned int uiType, const QByteArray &qbaMsg, ServerUser *
 		if (l < 2)
 			return;
 
-		QReadLocker rl(&qrwlUsers);
+		UserReadLocker rl(&ulUsers);
 
 		u->bUdp = false;
 
@@ -1391,16 +1879,25 @@ void Server::message(unsigned int uiType, const QByteArray &qbaMsg, ServerUser *
 void Server::checkTimeout() {
 	QList<ServerUser *> qlClose;
 
-	qrwlUsers.lockForRead();
+	ulUsers.lockForRead();
 	foreach(ServerUser *u, qhUsers) {
 		if (u->activityTime() > (iTimeout * 1000)) {
 			log(u, "Timeout");
 			qlClose.append(u);
 		}
 	}
-	qrwlUsers.unlock();
+	ulUsers.unlockRead();
 	foreach(ServerUser *u, qlClose)
 		u->disconnectSocket(true);
+
+	if (bSnapshotDirty)
+		writeSnapshot();
+
+	flushLastChannels();
+
+	const int dropped = qaiTunnelDropped.fetchAndStoreRelaxed(0);
+	if (dropped)
+		log(QString("Dropped %1 tunnelled voice packets on full tunnel queues").arg(dropped));
 }
 
 void Server::tcpTransmitData(QByteArray a, unsigned int id) {
@@ -1420,6 +1917,25 @@ void Server::tcpTransmitData(QByteArray a, unsigned int id) {
 	}
 }
 
+void Server::flushTunnels() {
+	QList<unsigned int> sessions;
+	{
+		QMutexLocker qml(&qmTunnel);
+		sessions = qlTunnelUsers;
+		qlTunnelUsers.clear();
+	}
+
+	foreach(unsigned int id, sessions) {
+		// Looked up by session, as the user may have left since it was queued.
+		ServerUser *u = qhUsers.value(id);
+		if (! u)
+			continue;
+		// Clear before draining, so voice pushed from here on queues the user again.
+		u->qaiTunnelQueued.fetchAndStoreOrdered(0);
+		u->flushTunnel();
+	}
+}
+
 void Server::doSync(unsigned int id) {
 	ServerUser *u = qhUsers.value(id);
 	if (u) {
@@ -1429,6 +1945,75 @@ void Server::doSync(unsigned int id) {
 	}
 }
 
+void Server::invalidateChannelSync(const Channel *c) {
+	if (c)
+		qhChannelSync.remove(c->iId);
+	else
+		qhChannelSync.clear();
+	qbaChannelSync[0].clear();
+	qbaChannelSync[1].clear();
+}
+
+/* Returns the whole channel tree as one buffer of framed ChannelState messages, in
+ * the order a joining client needs them: every channel parent first, then links.
+ * Only channels changed since the last call are serialized again.
+ */
+const QByteArray &Server::channelSync(unsigned int version) {
+	const int bucket = (version >= 0x010202) ? 1 : 0;
+	QByteArray &sync = qbaChannelSync[bucket];
+	if (! sync.isEmpty())
+		return sync;
+
+	QByteArray links;
+	QQueue<Channel *> q;
+	q << qhChannels.value(0);
+
+	while (! q.isEmpty()) {
+		Channel *c = q.dequeue();
+		ChannelSync &cs = qhChannelSync[c->iId];
+
+		if (cs.qbaState[bucket].isEmpty()) {
+			MumbleProto::ChannelState mpcs;
+			mpcs.set_channel_id(c->iId);
+			if (c->cParent)
+				mpcs.set_parent(c->cParent->iId);
+			if (c->iId == 0)
+				mpcs.set_name(u8(qsRegName.isEmpty() ? QLatin1String("Root") : qsRegName));
+			else
+				mpcs.set_name(u8(c->qsName));
+
+			mpcs.set_position(c->iPosition);
+
+			if (bucket && ! c->qbaDescHash.isEmpty())
+				mpcs.set_description_hash(blob(c->qbaDescHash));
+			else if (! c->qsDesc.isEmpty())
+				mpcs.set_description(u8(c->qsDesc));
+
+			Connection::messageToNetwork(mpcs, MessageHandler::ChannelState, cs.qbaState[bucket]);
+		}
+
+		if (! cs.bLinks) {
+			if (c->qhLinks.count() > 0) {
+				MumbleProto::ChannelState mpcs;
+				mpcs.set_channel_id(c->iId);
+				foreach(Channel *l, c->qhLinks.keys())
+					mpcs.add_links(l->iId);
+				Connection::messageToNetwork(mpcs, MessageHandler::ChannelState, cs.qbaLinks);
+			}
+			cs.bLinks = true;
+		}
+
+		sync.append(cs.qbaState[bucket]);
+		links.append(cs.qbaLinks);
+
+		foreach(c, c->qlChannels)
+			q.enqueue(c);
+	}
+
+	sync.append(links);
+	return sync;
+}
+
 void Server::sendProtoMessage(ServerUser *u, const ::google::protobuf::Message &msg, unsigned int msgType) {
 	QByteArray cache;
 	u->sendMessage(msg, msgType, cache);
@@ -1459,14 +2044,26 @@ void Server::removeChannel(Channel *chan, Channel *dest) {
 	if (dest == NULL)
 		dest = chan->cParent;
 
-	chan->unlink(NULL);
+	foreach(Channel *l, chan->qhLinks.keys())
+		invalidateChannelSync(l);
+	invalidateChannelSync(chan);
+
+	{
+		UserWriteLocker wl(&ulUsers);
+		chan->unlink(NULL);
+		++uiSpeechVersion;
+	}
 
 	foreach(c, chan->qlChannels) {
 		removeChannel(c, dest);
 	}
 
 	foreach(p, chan->qlUsers) {
-		chan->removeUser(p);
+		{
+			UserWriteLocker wl(&ulUsers);
+			chan->removeUser(p);
+			++uiSpeechVersion;
+		}
 
 		Channel *target = dest;
 		while (target->cParent && ! hasPermission(static_cast<ServerUser *>(p), target, ChanACL::Enter))
@@ -1487,8 +2084,11 @@ void Server::removeChannel(Channel *chan, Channel *dest) {
 	removeChannelDB(chan);
 	emit channelRemoved(chan);
 
+	// Drop cached permissions for the channel before the pointer can be reused.
+	clearACLCacheSubtree(chan);
+
 	if (chan->cParent) {
-		QWriteLocker wl(&qrwlUsers);
+		UserWriteLocker wl(&ulUsers);
 		chan->cParent->removeChannel(chan);
 	}
 
@@ -1499,29 +2099,6 @@ bool Server::unregisterUser(int id) {
 	if (! unregisterUserDB(id))
 		return false;
 
-	{
-		QMutexLocker lock(&qmCache);
-
-		foreach(Channel *c, qhChannels) {
-			bool write = false;
-			QList<ChanACL *> ql = c->qlACL;
-
-			foreach(ChanACL *acl, ql) {
-				if (acl->iUserId == id) {
-					c->qlACL.removeAll(acl);
-					write = true;
-				}
-			}
-			foreach(Group *g, c->qhGroups) {
-				bool addrem = g->qsAdd.remove(id);
-				bool remrem = g->qsRemove.remove(id);
-				write = write || addrem || remrem;
-			}
-			if (write)
-				updateChannel(c);
-		}
-	}
-
 	foreach(ServerUser *u, qhUsers) {
 		if (u->iId == id) {
 			clearACLCache(u);
@@ -1544,8 +2121,9 @@ void Server::userEnterChannel(User *p, Channel *c, MumbleProto::UserState &mpus)
 	Channel *old = p->cChannel;
 
 	{
-		QWriteLocker wl(&qrwlUsers);
+		UserWriteLocker wl(&ulUsers);
 		c->addUser(p);
+		++uiSpeechVersion;
 
 		bool mayspeak = ChanACL::hasPermission(static_cast<ServerUser *>(p), c, ChanACL::Speak, NULL);
 		bool sup = p->bSuppress;
@@ -1674,10 +2252,67 @@ void Server::clearACLCache(User *p) {
 	}
 
 	{
-		QWriteLocker lock(&qrwlUsers);
+		UserWriteLocker lock(&ulUsers);
 
 		foreach(ServerUser *u, qhUsers)
 			u->qmTargetCache.clear();
+		++uiSpeechVersion;
+	}
+}
+
+/* Invalidates cached permissions after an ACL or group change on the given channel.
+ * Permissions in a channel only depend on the ACLs and groups of the channel itself
+ * and its parents, so only entries for the channel's subtree are dropped, and only
+ * users who were sent permissions for a channel in it get a flush.
+ */
+void Server::clearACLCacheSubtree(Channel *c) {
+	if (! c->cParent) {
+		clearACLCache();
+		return;
+	}
+
+	QSet<Channel *> subtree = c->allChildren();
+	subtree.insert(c);
+
+	MumbleProto::PermissionQuery mppq;
+
+	{
+		QMutexLocker qml(&qmCache);
+
+		foreach(ChanACL::ChanCache *h, acCache) {
+			if (h->count() < subtree.count()) {
+				ChanACL::ChanCache::iterator i = h->begin();
+				while (i != h->end()) {
+					if (subtree.contains(i.key()))
+						i = h->erase(i);
+					else
+						++i;
+				}
+			} else {
+				foreach(Channel *sc, subtree)
+					h->remove(sc);
+			}
+		}
+
+		foreach(ServerUser *u, qhUsers) {
+			if (u->sState != ServerUser::Authenticated)
+				continue;
+			foreach(Channel *sc, subtree) {
+				if (u->qmPermissionSent.contains(sc->iId)) {
+					flushClientPermissionCache(u, mppq);
+					break;
+				}
+			}
+		}
+	}
+
+	{
+		UserWriteLocker lock(&ulUsers);
+
+		foreach(ServerUser *u, qhUsers)
+			if (! u->qmTargetCache.isEmpty())
+				u->qmTargetCache.clear();
+		++uiSpeechVersion;
 	}
 }
 
@@ -1807,6 +2442,60 @@ void Server::hashAssign(QByteArray &dest, QByteArray &hash, const QByteArray &sr
 		hash = QByteArray();
 }
 
+/// Assigns a texture through bsBlobs, so users with the same texture share one copy of it.
+void Server::setUserTexture(User *u, const QByteArray &texture) {
+	const QByteArray old = u->qbaTextureHash;
+	hashAssign(u->qbaTexture, u->qbaTextureHash, texture);
+	if (! u->qbaTextureHash.isEmpty())
+		u->qbaTexture = bsBlobs.acquire(u->qbaTextureHash, texture);
+	bsBlobs.release(old, BlobStore::Texture);
+}
+
+/// Assigns a comment through bsBlobs, see setUserTexture().
+void Server::setUserComment(User *u, const QString &comment) {
+	const QByteArray old = u->qbaCommentHash;
+	hashAssign(u->qsComment, u->qbaCommentHash, comment);
+	if (! u->qbaCommentHash.isEmpty())
+		u->qsComment = bsBlobs.acquire(u->qbaCommentHash, comment);
+	bsBlobs.release(old, BlobStore::Comment);
+}
+
+/// Remembers the texture of a registration. Large ones only keep their hash
+/// and leave the data to bsBlobs, which may drop it again when unused.
+void Server::cacheTexture(Registration &r, const QByteArray &texture) {
+	hashAssign(r.qbaTexture, r.qbaTextureHash, texture);
+	if (! r.qbaTextureHash.isEmpty()) {
+		bsBlobs.insert(r.qbaTextureHash, texture);
+		r.qbaTexture = QByteArray();
+	}
+	r.bTexture = true;
+}
+
+/**
+ * Sends the UserState for a blob request. The message is the serialized
+ * session followed by the blob field bsBlobs keeps serialized, which
+ * protobuf parses like a single message.
+ */
+void Server::sendBlob(ServerUser *u, unsigned int session, const QByteArray &field) {
+	MumbleProto::UserState mpus;
+	mpus.set_session(session);
+
+	const int head = mpus.ByteSize();
+	const int len = head + field.size();
+	if (len > 0x7fffff)
+		return;
+
+	QByteArray qba;
+	qba.resize(len + 6);
+	unsigned char *uc = reinterpret_cast<unsigned char *>(qba.data());
+	qToBigEndian<quint16>(MessageHandler::UserState, & uc[0]);
+	qToBigEndian<quint32>(len, & uc[2]);
+	mpus.SerializeToArray(uc + 6, head);
+	memcpy(uc + 6 + head, field.constData(), field.size());
+
+	u->sendMessage(qba);
+}
+
 bool Server::isTextAllowed(QString &text, bool &changed) {
 	changed = false;
 
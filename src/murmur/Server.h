@@ -40,11 +40,12 @@
 #include <QtCore/QMutex>
 #include <QtCore/QTimer>
 #include <QtCore/QQueue>
-#include <QtCore/QReadWriteLock>
+#include <QtCore/QRunnable>
 #include <QtCore/QStringList>
 #include <QtCore/QSocketNotifier>
 #include <QtCore/QThread>
 #include <QtCore/QUrl>
+#include <QtCore/QWaitCondition>
 #include <QtNetwork/QSslCertificate>
 #include <QtNetwork/QSslKey>
 #include <QtNetwork/QSslSocket>
@@ -54,9 +55,12 @@
 #endif
 
 #include "ACL.h"
+#include "BanTrie.h"
+#include "BlobStore.h"
 #include "Message.h"
 #include "Mumble.pb.h"
 #include "Net.h"
+#include "PeerTable.h"
 #include "User.h"
 #include "Timer.h"
 
@@ -64,6 +68,7 @@ class BonjourServer;
 class Channel;
 class PacketDataStream;
 class ServerUser;
+class UdpBatch;
 class User;
 class QNetworkAccessManager;
 
@@ -97,6 +102,104 @@ class SslServer : public QTcpServer {
 		SslServer(QObject *parent = NULL);
 };
 
+/**
+ * Read-mostly lock protecting the user and channel tables shared between the
+ * main thread and the voice threads. Every voice thread reads through its own
+ * slot, so readers never contend with each other; a writer has to take all
+ * slots. Threads that aren't voice threads share a recursive read-write lock,
+ * so they don't serialize each other and may nest read locks.
+ */
+class UserLock {
+	private:
+		Q_DISABLE_COPY(UserLock)
+	protected:
+		QMutex qmWrite;
+		QList<QMutex *> qlSlots;
+		QReadWriteLock qrwlShared;
+		QMutex *readSlot(int slot);
+	public:
+		UserLock();
+		~UserLock();
+		void setReaders(int readers);
+		void lockForRead(int slot = -1);
+		void unlockRead(int slot = -1);
+		void lockForWrite();
+		void unlockWrite();
+};
+
+class UserReadLocker {
+	private:
+		Q_DISABLE_COPY(UserReadLocker)
+	protected:
+		UserLock *ulLock;
+		int iSlot;
+		bool bLocked;
+	public:
+		UserReadLocker(UserLock *lock, int slot = -1);
+		~UserReadLocker();
+		void unlock();
+		void relock();
+};
+
+class UserWriteLocker {
+	private:
+		Q_DISABLE_COPY(UserWriteLocker)
+	protected:
+		UserLock *ulLock;
+	public:
+		UserWriteLocker(UserLock *lock);
+		~UserWriteLocker();
+};
+
+/**
+ * One voice forwarding thread. Shard 0 runs in the Server thread itself, all
+ * others in their own thread. On Linux each shard reads from its own
+ * SO_REUSEPORT sockets and the kernel spreads the clients across them.
+ */
+struct VoiceShard {
+	int iShard;
+	QThread *qtThread;
+#ifdef Q_OS_UNIX
+	QList<int> qlSockets;
+	int aiNotify[2];
+#else
+	QList<SOCKET> qlSockets;
+#endif
+	UdpBatch *ubBatch;
+	/// Timer::now() when the current receive batch was read.
+	quint64 uiNow;
+
+	quint64 uiRecvCalls, uiRecvPackets;
+	quint64 uiSendCalls, uiSendPackets;
+	/// Datagrams that neither sendmmsg() nor the sendmsg() retry got out.
+	quint64 uiSendDropped;
+
+	VoiceShard(int shard);
+};
+
+/**
+ * Parses the certificate and key of a virtual server on a pool thread, so
+ * Meta::bootAll() doesn't do it for one server after the other.
+ */
+class CertParser : public QRunnable {
+	private:
+		Q_DISABLE_COPY(CertParser)
+	protected:
+		QMutex qmDone;
+		QWaitCondition qwcDone;
+		bool bDone;
+	public:
+		const QByteArray qbaCert, qbaKey, qbaPass;
+		QSslKey qskKey;
+		QSslCertificate qscCert;
+		QList<QSslCertificate> qlCA;
+
+		CertParser(const QByteArray &crt, const QByteArray &key, const QByteArray &pass);
+		void run();
+		/// Blocks until run() has finished.
+		void wait();
+};
+
 #define EXEC_QEVENT (QEvent::User + 959)
 
 class ExecEvent : public QEvent {
@@ -144,6 +247,8 @@ class Server : public QThread {
 		QString qsEmoticonImages;
 		bool bCertRequired;
 		bool bForceExternalAuth;
+		int iUdpBatchSize;
+		int iVoiceThreads;
 
 		QString qsRegName;
 		QString qsRegPassword;
@@ -195,18 +300,20 @@ class Server : public QThread {
 		// Certificate stuff, implemented partially in Cert.cpp
 	public:
 		static bool isKeyForCert(const QSslKey &key, const QSslCertificate &cert);
+		static void parseCert(const QByteArray &crt, const QByteArray &key, const QByteArray &pass, QSslKey &qskKey, QSslCertificate &qscCert, QList<QSslCertificate> &qlCA);
 		void initializeCert();
+		void encrypted(ServerUser *);
 		const QString getDigest() const;
 
 	public slots:
 		void newClient();
 		void connectionClosed(QAbstractSocket::SocketError, const QString &);
-		void sslError(const QList<QSslError> &);
+		void sslHandshake(QSslSocket *, bool verified, const QString &peer, const QString &error);
 		void message(unsigned int, const QByteArray &, ServerUser *cCon = NULL);
 		void checkTimeout();
 		void tcpTransmitData(QByteArray, unsigned int);
+		void flushTunnels();
 		void doSync(unsigned int);
-		void encrypted();
 		void udpActivated(int);
 	signals:
 		void reqSync(unsigned int);
@@ -218,7 +325,6 @@ class Server : public QThread {
 		QTimer *qtTimeout;
 
 #ifdef Q_OS_UNIX
-		int aiNotify[2];
 		QList<int> qlUdpSocket;
 #else
 		HANDLE hNotify;
@@ -227,21 +333,75 @@ class Server : public QThread {
 		quint32 uiVersionBlob;
 		QList<QSocketNotifier *> qlUdpNotifier;
 
+		QList<VoiceShard *> qlVoiceShards;
+		// Sessions with tunnelled voice queued since the last flushTunnels();
+		// a flush is pending whenever this is non-empty.
+		QMutex qmTunnel;
+		QList<unsigned int> qlTunnelUsers;
+		// Tunnelled voice dropped on a full ring since checkTimeout() last reported it.
+		QAtomicInt qaiTunnelDropped;
+
 		QHash<unsigned int, ServerUser *> qhUsers;
-		QHash<QPair<HostAddress, quint16>, ServerUser *> qhPeerUsers;
-		QHash<HostAddress, QSet<ServerUser *> > qhHostUsers;
+		/// qhUsers.count() for the UDP ping replies, which don't take ulUsers.
+		QAtomicInt qaiUserCount;
+		PeerTable ptPeers;
 		QHash<unsigned int, Channel *> qhChannels;
-		QReadWriteLock qrwlUsers;
+		UserLock ulUsers;
+		// Bumped under the user write lock whenever channel membership,
+		// links or ACLs change; invalidates ServerUser::qvSpeechTargets.
+		unsigned int uiSpeechVersion;
 		ChanACL::ACLCache acCache;
 		QMutex qmCache;
 		QHash<int, QString> qhUserNameCache;
 		QHash<QString, int> qhUserIDCache;
 
-		QList<Ban> qlBans;
+		/// Database registration of a user, as cached by readRegistrations().
+		struct Registration {
+			QString qsName;
+			/// SHA1 hex digest of the password, empty if none is set.
+			QString qsPassword;
+			QString qsLastActive;
+			int iLastChannel;
+			/// Texture is loaded lazily; bTexture tells whether it is known. Textures
+			/// with a hash live in bsBlobs and may have to be loaded again.
+			bool bTexture;
+			QByteArray qbaTexture;
+			QByteArray qbaTextureHash;
+			QMap<int, QString> qmInfo;
+			Registration() : iLastChannel(0), bTexture(false) {}
+		};
+		/// All registrations of this server, keyed by user id. Every write to the
+		/// users and user_info tables goes through Server and updates this as well,
+		/// so authentication never needs to touch the database.
+		QHash<int, Registration> qhRegistrations;
+		/// Lower-case user name to user id.
+		QHash<QString, int> qhRegistrationNames;
+		/// Certificate hash to user id.
+		QHash<QString, int> qhRegistrationHashes;
+		/// Last channel updates not yet written to the database, see flushLastChannels().
+		QHash<int, int> qhPendingLastChannel;
 
-		void processMsg(ServerUser *u, const char *data, int len);
-		void sendMessage(ServerUser *u, const char *data, int len, QByteArray &cache, bool force = false);
+		QList<Ban> qlBans;
+		/// Address index of qlBans, rebuilt by getBans() and saveBans().
+		BanTrie btBans;
+
+		/// Textures and comments of the users, shared between users with the same ones.
+		BlobStore bsBlobs;
+		void setUserTexture(User *u, const QByteArray &texture);
+		void setUserComment(User *u, const QString &comment);
+		void cacheTexture(Registration &r, const QByteArray &texture);
+		void sendBlob(ServerUser *u, unsigned int session, const QByteArray &field);
+
+		/// Generation of the persistent state, see Snapshot.cpp.
+		quint64 uiSnapshotGeneration;
+		/// The persistent state changed since the last snapshot was written.
+		bool bSnapshotDirty;
+
+		void processMsg(ServerUser *u, const char *data, int len, VoiceShard *vs = NULL);
+		void buildSpeechTargets(ServerUser *u, Channel *c, QVector<ServerUser *> &targets);
+		void sendMessage(ServerUser *u, const char *data, int len, QByteArray &cache, bool force = false, VoiceShard *vs = NULL);
 		void run();
+		void voiceLoop(VoiceShard *vs);
 
 		bool validateChannelName(const QString &name);
 		bool validateUserName(const QString &name);
@@ -253,6 +413,21 @@ class Server : public QThread {
 		void sendClientPermission(ServerUser *u, Channel *c, bool updatelast = false);
 		void flushClientPermissionCache(ServerUser *u, MumbleProto::PermissionQuery &mpqq);
 		void clearACLCache(User *p = NULL);
+		void clearACLCacheSubtree(Channel *c);
+
+		/// Serialized channel tree as sent to joining clients; per channel ChannelState
+		/// for clients before 1.2.2 (description) and since (description hash), plus links.
+		struct ChannelSync {
+			QByteArray qbaState[2];
+			QByteArray qbaLinks;
+			bool bLinks;
+			ChannelSync() : bLinks(false) {}
+		};
+		QHash<int, ChannelSync> qhChannelSync;
+		/// Assembled from qhChannelSync in tree order; empty when it needs rebuilding.
+		QByteArray qbaChannelSync[2];
+		void invalidateChannelSync(const Channel *c = NULL);
+		const QByteArray &channelSync(unsigned int version);
 
 		void sendProtoAll(const ::google::protobuf::Message &msg, unsigned int msgType, unsigned int minversion);
 		void sendProtoExcept(ServerUser *, const ::google::protobuf::Message &msg, unsigned int msgType, unsigned int minversion);
@@ -327,12 +502,21 @@ class Server : public QThread {
 		int authenticate(QString &name, const QString &pw, int sessionId = 0, const QStringList &emails = QStringList(), const QString &certhash = QString(), bool bStrongCert = false, const QList<QSslCertificate> & = QList<QSslCertificate>());
 		Channel *addChannel(Channel *c, const QString &name, bool temporary = false, int position = 0);
 		void removeChannelDB(const Channel *c);
-		void readChannels(Channel *p = NULL);
+		void readChannels();
 		void readLinks();
+
+		// Snapshot of the channel tree and bans. Implementation in Snapshot.cpp
+		QString snapshotPath() const;
+		void touchSnapshot();
+		bool loadSnapshot();
+		void writeSnapshot();
 		void updateChannel(const Channel *c);
-		void readChannelPrivs(Channel *c);
 		void setLastChannel(const User *u);
 		int readLastChannel(int id);
+		void flushLastChannels();
+		void readRegistrations();
+		void replaceRegistration(int id, const QString &name, int lastchannel);
+		void cacheInfo(int id, const QMap<int, QString> &info);
 		void dumpChannel(const Channel *c);
 		int getUserID(const QString &name);
 		QString getUserName(int id);
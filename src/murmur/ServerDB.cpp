@@ -53,6 +53,7 @@ class TransactionHolder {
 	public:
 		QSqlQuery *qsqQuery;
 		TransactionHolder() {
+			ServerDB::qmDatabase.lock();
 			ServerDB::db->transaction();
 			qsqQuery = new QSqlQuery();
 		}
@@ -61,17 +62,173 @@ class TransactionHolder {
 			qsqQuery->clear();
 			delete qsqQuery;
 			ServerDB::db->commit();
+			ServerDB::qmDatabase.unlock();
 		}
 		TransactionHolder(const TransactionHolder & other) {
+			ServerDB::qmDatabase.lock();
 			ServerDB::db->transaction();
 			qsqQuery = other.qsqQuery ? new QSqlQuery(*other.qsqQuery) : 0;
 		}
 };
 
+// Log rows committed per transaction by the log writer.
+#define LOG_BATCH 1000
+
 QSqlDatabase *ServerDB::db = NULL;
-Timer ServerDB::tLogClean;
+QHash<int, QHash<QString, QVariant> > ServerDB::qhConfCache;
+quint64 ServerDB::uiQueries = 0;
+QMutex ServerDB::qmDatabase(QMutex::Recursive);
+LogWriter *ServerDB::lwLog = NULL;
 QString ServerDB::qsUpgradeSuffix;
 
+LogWriter::LogWriter(QObject *p) : QThread(p) {
+	bStop = false;
+	bWriting = false;
+	uiDropped = 0;
+}
+
+LogWriter::~LogWriter() {
+	stop();
+}
+
+void LogWriter::log(int server_id, const QString &msg) {
+	QMutexLocker l(&qmQueue);
+
+	Entry e;
+	e.iServerId = server_id;
+	e.qsMsg = msg;
+	e.qdtTime = QDateTime::currentDateTime().toUTC();
+
+	// This runs on the main thread, so any wait for room is bounded.
+	if (qqEntries.count() >= Meta::mp.iLogQueueSize) {
+		if (! Meta::mp.bLogQueueWait || ! qwcSpace.wait(&qmQueue, Meta::mp.iLogQueueWait) || (qqEntries.count() >= Meta::mp.iLogQueueSize)) {
+			++uiDropped;
+			return;
+		}
+	}
+
+	qqEntries.enqueue(e);
+	qwcWork.wakeOne();
+}
+
+void LogWriter::flush() {
+	QMutexLocker l(&qmQueue);
+
+	if (! isRunning())
+		return;
+
+	qwcWork.wakeOne();
+	while (! qqEntries.isEmpty() || bWriting)
+		qwcIdle.wait(&qmQueue);
+}
+
+void LogWriter::stop() {
+	{
+		QMutexLocker l(&qmQueue);
+		bStop = true;
+		qwcWork.wakeAll();
+	}
+	wait();
+}
+
+void LogWriter::run() {
+	const QString name = QLatin1String("logwriter");
+
+	{
+		QSqlDatabase ldb = QSqlDatabase::cloneDatabase(*ServerDB::db, name);
+		if (! ldb.open())
+			qWarning("LogWriter: Failed to open database: %s", qPrintable(ldb.lastError().text()));
+
+		tPrune.restart();
+
+		forever {
+			QList<Entry> batch;
+			unsigned int dropped;
+			bool done;
+
+			{
+				QMutexLocker l(&qmQueue);
+				if (qqEntries.isEmpty() && ! bStop)
+					qwcWork.wait(&qmQueue, 60000);
+
+				while (! qqEntries.isEmpty() && (batch.count() < LOG_BATCH))
+					batch << qqEntries.dequeue();
+				bWriting = ! batch.isEmpty();
+				qwcSpace.wakeAll();
+
+				dropped = uiDropped;
+				uiDropped = 0;
+				done = bStop && qqEntries.isEmpty();
+			}
+
+			if (dropped)
+				qWarning("LogWriter: Queue full, dropped %u log entries", dropped);
+
+			if (ldb.isOpen()) {
+				if (! batch.isEmpty())
+					write(ldb, batch);
+
+				// Once per hour
+				if ((Meta::mp.iLogDays > 0) && tPrune.isElapsed(3600ULL * 1000000ULL))
+					prune(ldb);
+			}
+
+			{
+				QMutexLocker l(&qmQueue);
+				bWriting = false;
+				qwcIdle.wakeAll();
+			}
+
+			if (done)
+				break;
+		}
+
+		ldb.close();
+	}
+
+	QSqlDatabase::removeDatabase(name);
+}
+
+void LogWriter::write(QSqlDatabase &ldb, const QList<Entry> &batch) {
+	QVariantList servers, msgs, times;
+	foreach(const Entry &e, batch) {
+		servers << e.iServerId;
+		msgs << e.qsMsg;
+		times << e.qdtTime.toString(QLatin1String("yyyy-MM-dd hh:mm:ss"));
+	}
+
+	QMutexLocker l(&ServerDB::qmDatabase);
+
+	ldb.transaction();
+	QSqlQuery query(ldb);
+	query.prepare(QString::fromLatin1("INSERT INTO `%1slog` (`server_id`, `msg`, `msgtime`) VALUES(?,?,?)").arg(Meta::mp.qsDBPrefix));
+	query.addBindValue(servers);
+	query.addBindValue(msgs);
+	query.addBindValue(times);
+	if (! query.execBatch())
+		qWarning("LogWriter: SQL Error [%s]: %s", qPrintable(query.lastQuery()), qPrintable(query.lastError().text()));
+	query.clear();
+	ldb.commit();
+}
+
+void LogWriter::prune(QSqlDatabase &ldb) {
+	QString qstr;
+	if (Meta::mp.qsDBDriver == "QSQLITE") {
+		qstr = QString::fromLatin1("msgtime < datetime('now','-%1 days')").arg(Meta::mp.iLogDays);
+	} else {
+		qstr = QString::fromLatin1("msgtime < now() - INTERVAL %1 day").arg(Meta::mp.iLogDays);
+	}
+
+	QMutexLocker l(&ServerDB::qmDatabase);
+
+	ldb.transaction();
+	QSqlQuery query(ldb);
+	if (! query.exec(QString::fromLatin1("DELETE FROM %1slog WHERE ").arg(Meta::mp.qsDBPrefix) + qstr))
+		qWarning("LogWriter: SQL Error [%s]: %s", qPrintable(query.lastQuery()), qPrintable(query.lastError().text()));
+	query.clear();
+	ldb.commit();
+}
+
 ServerDB::ServerDB() {
 	if (! QSqlDatabase::isDriverAvailable(Meta::mp.qsDBDriver)) {
 		qFatal("ServerDB: Database driver %s not available", qPrintable(Meta::mp.qsDBDriver));
@@ -224,7 +381,7 @@ ServerDB::ServerDB() {
 
 			SQLDO("CREATE TABLE `%1slog`(`server_id` INTEGER NOT NULL, `msg` TEXT, `msgtime` DATE)");
 			SQLDO("CREATE INDEX `%1slog_time` ON `%1slog`(`msgtime`)");
-			SQLDO("CREATE TRIGGER `%1slog_timestamp` AFTER INSERT ON `%1slog` FOR EACH ROW BEGIN UPDATE `%1slog` SET `msgtime` = datetime('now') WHERE rowid = new.rowid; END;");
+			SQLDO("CREATE TRIGGER `%1slog_timestamp` AFTER INSERT ON `%1slog` FOR EACH ROW WHEN new.`msgtime` IS NULL BEGIN UPDATE `%1slog` SET `msgtime` = datetime('now') WHERE rowid = new.rowid; END;");
 			SQLDO("CREATE TRIGGER `%1slog_server_del` AFTER DELETE ON `%1servers` FOR EACH ROW BEGIN DELETE FROM `%1slog` WHERE `server_id` = old.`server_id`; END;");
 
 			SQLDO("CREATE TABLE `%1config` (`server_id` INTEGER NOT NULL, `key` TEXT, `value` TEXT)");
@@ -464,11 +621,21 @@ ServerDB::ServerDB() {
 
 			SQLDO("UPDATE `%1meta` SET `value` = '5' WHERE `keystring` = 'version'");
 		}
+	} else if (Meta::mp.qsDBDriver == "QSQLITE") {
+		// Older databases overwrite msgtime on every insert, including the time LogWriter binds.
+		SQLDO("DROP TRIGGER IF EXISTS `%1slog_timestamp`");
+		SQLDO("CREATE TRIGGER `%1slog_timestamp` AFTER INSERT ON `%1slog` FOR EACH ROW WHEN new.`msgtime` IS NULL BEGIN UPDATE `%1slog` SET `msgtime` = datetime('now') WHERE rowid = new.rowid; END;");
 	}
 	query.clear();
+
+	lwLog = new LogWriter();
+	lwLog->start(QThread::LowPriority);
 }
 
 ServerDB::~ServerDB() {
+	delete lwLog;
+	lwLog = NULL;
+
 	db->close();
 	delete db;
 	db = NULL;
@@ -515,6 +682,7 @@ bool ServerDB::prepare(QSqlQuery &query, const QString &str, bool fatal, bool wa
 bool ServerDB::exec(QSqlQuery &query, const QString &str, bool fatal, bool warn) {
 	if (! str.isEmpty())
 		prepare(query, str, fatal, warn);
+	++uiQueries;
 	if (query.exec()) {
 		return true;
 	} else {
@@ -532,6 +700,7 @@ bool ServerDB::exec(QSqlQuery &query, const QString &str, bool fatal, bool warn)
 bool ServerDB::execBatch(QSqlQuery &query, const QString &str, bool fatal) {
 	if (! str.isEmpty())
 		prepare(query, str, fatal);
+	++uiQueries;
 	if (query.execBatch()) {
 		return true;
 	} else {
@@ -645,6 +814,89 @@ void Server::initialize() {
 		}
 	}
 	query.clear();
+
+	readRegistrations();
+}
+
+void Server::readRegistrations() {
+	qhRegistrations.clear();
+	qhRegistrationNames.clear();
+	qhRegistrationHashes.clear();
+
+	TransactionHolder th;
+	QSqlQuery &query = *th.qsqQuery;
+
+	SQLPREP("SELECT `user_id`, `name`, `pw`, `lastchannel`, `last_active` FROM `%1users` WHERE `server_id` = ?");
+	query.addBindValue(iServerNum);
+	SQLEXEC();
+	while (query.next()) {
+		const int id = query.value(0).toInt();
+		Registration &r = qhRegistrations[id];
+		r.qsName = query.value(1).toString();
+		r.qsPassword = query.value(2).toString();
+		r.iLastChannel = query.value(3).toInt();
+		r.qsLastActive = query.value(4).toString();
+		qhRegistrationNames.insert(r.qsName.toLower(), id);
+	}
+
+	SQLPREP("SELECT `user_id`, `key`, `value` FROM `%1user_info` WHERE `server_id` = ?");
+	query.addBindValue(iServerNum);
+	SQLEXEC();
+	while (query.next()) {
+		const int id = query.value(0).toInt();
+		QHash<int, Registration>::iterator i = qhRegistrations.find(id);
+		if (i == qhRegistrations.end())
+			continue;
+		const int key = query.value(1).toInt();
+		const QString &value = query.value(2).toString();
+		i->qmInfo.insert(key, value);
+		if (key == ServerDB::User_Hash)
+			qhRegistrationHashes.insert(value, id);
+	}
+}
+
+/// Mirrors a REPLACE INTO users, which resets every column but name and lastchannel.
+/// user_info is left alone, just like in the database.
+void Server::replaceRegistration(int id, const QString &name, int lastchannel) {
+	Registration &r = qhRegistrations[id];
+	if (qhRegistrationNames.value(r.qsName.toLower(), -1) == id)
+		qhRegistrationNames.remove(r.qsName.toLower());
+
+	r.qsName = name;
+	r.qsPassword = QString();
+	r.qsLastActive = QString();
+	r.iLastChannel = lastchannel;
+	r.bTexture = true;
+	r.qbaTexture = QByteArray();
+	r.qbaTextureHash = QByteArray();
+
+	qhRegistrationNames.insert(name.toLower(), id);
+	qhPendingLastChannel.remove(id);
+}
+
+/// Applies user name and user_info changes that have been written to the database.
+void Server::cacheInfo(int id, const QMap<int, QString> &info) {
+	QHash<int, Registration>::iterator r = qhRegistrations.find(id);
+	if (r == qhRegistrations.end())
+		return;
+
+	QMap<int, QString>::const_iterator i;
+	for (i = info.constBegin(); i != info.constEnd(); ++i) {
+		if (i.key() == ServerDB::User_Name) {
+			if (qhRegistrationNames.value(r->qsName.toLower(), -1) == id)
+				qhRegistrationNames.remove(r->qsName.toLower());
+			r->qsName = i.value();
+			qhRegistrationNames.insert(r->qsName.toLower(), id);
+		} else {
+			if (i.key() == ServerDB::User_Hash) {
+				const QString &oldhash = r->qmInfo.value(ServerDB::User_Hash);
+				if (qhRegistrationHashes.value(oldhash, -1) == id)
+					qhRegistrationHashes.remove(oldhash);
+				qhRegistrationHashes.insert(i.value(), id);
+			}
+			r->qmInfo.insert(i.key(), i.value());
+		}
+	}
 }
 
 int Server::registerUser(const QMap<int, QString> &info) {
@@ -690,6 +942,7 @@ int Server::registerUser(const QMap<int, QString> &info) {
 	query.addBindValue(name);
 	SQLEXEC();
 	qhUserNameCache.remove(id);
+	replaceRegistration(id, name, 0);
 
 	setInfo(id, info);
 
@@ -714,18 +967,58 @@ bool Server::unregisterUserDB(int id) {
 		return false;
 	}
 
-	TransactionHolder th;
+	{
+		TransactionHolder th;
 
-	QSqlQuery &query = *th.qsqQuery;
-	SQLPREP("DELETE FROM `%1users` WHERE `server_id` = ? AND `user_id` = ?");
-	query.addBindValue(iServerNum);
-	query.addBindValue(id);
-	SQLEXEC();
+		QSqlQuery &query = *th.qsqQuery;
+		SQLPREP("DELETE FROM `%1users` WHERE `server_id` = ? AND `user_id` = ?");
+		query.addBindValue(iServerNum);
+		query.addBindValue(id);
+		SQLEXEC();
 
-	SQLPREP("DELETE FROM `%1user_info` WHERE `server_id` = ? AND `user_id` = ?");
-	query.addBindValue(iServerNum);
-	query.addBindValue(id);
-	SQLEXEC();
+		SQLPREP("DELETE FROM `%1user_info` WHERE `server_id` = ? AND `user_id` = ?");
+		query.addBindValue(iServerNum);
+		query.addBindValue(id);
+		SQLEXEC();
+	}
+
+	QHash<int, Registration>::iterator r = qhRegistrations.find(id);
+	if (r != qhRegistrations.end()) {
+		if (qhRegistrationNames.value(r->qsName.toLower(), -1) == id)
+			qhRegistrationNames.remove(r->qsName.toLower());
+		const QString &hash = r->qmInfo.value(ServerDB::User_Hash);
+		if (qhRegistrationHashes.value(hash, -1) == id)
+			qhRegistrationHashes.remove(hash);
+		qhRegistrations.erase(r);
+	}
+	qhPendingLastChannel.remove(id);
+
+	// The database drops the user's group memberships and ACLs by itself;
+	// drop them from the channels too, or the snapshot would hand them to
+	// the next user registered with this id.
+	{
+		QMutexLocker lock(&qmCache);
+
+		foreach(Channel *c, qhChannels) {
+			bool write = false;
+			QList<ChanACL *> ql = c->qlACL;
+
+			foreach(ChanACL *acl, ql) {
+				if (acl->iUserId == id) {
+					c->qlACL.removeAll(acl);
+					write = true;
+				}
+			}
+			foreach(Group *g, c->qhGroups) {
+				bool addrem = g->qsAdd.remove(id);
+				bool remrem = g->qsRemove.remove(id);
+				write = write || addrem || remrem;
+			}
+			if (write)
+				updateChannel(c);
+		}
+	}
+	touchSnapshot();
 
 	return true;
 }
@@ -742,6 +1035,8 @@ QList<UserInfo> Server::getRegisteredUsersEx() {
 		users.insert(it.key(), UserInfo(it.key(), it.value()));
 	}
 
+	flushLastChannels();
+
 	TransactionHolder th;
 
 	QSqlQuery &query = *th.qsqQuery;
@@ -796,17 +1091,7 @@ bool Server::isUserId(int id) {
 	if (res >= 0)
 		return (res > 0);
 
-	TransactionHolder th;
-
-	QSqlQuery &query = *th.qsqQuery;
-	SQLPREP("SELECT `user_id` FROM `%1users` WHERE `server_id` = ? AND `user_id` = ?");
-	query.addBindValue(iServerNum);
-	query.addBindValue(id);
-	SQLEXEC();
-	if (query.next()) {
-		return true;
-	}
-	return false;
+	return qhRegistrations.contains(id);
 }
 
 QMap<int, QString> Server::getRegistration(int id) {
@@ -816,26 +1101,11 @@ QMap<int, QString> Server::getRegistration(int id) {
 	if (res >= 0)
 		return info;
 
-	TransactionHolder th;
-
-	QSqlQuery &query = *th.qsqQuery;
-	SQLPREP("SELECT `name`, `last_active` FROM `%1users` WHERE `server_id` = ? AND `user_id` = ?");
-	query.addBindValue(iServerNum);
-	query.addBindValue(id);
-	SQLEXEC();
-	if (query.next()) {
-		info.insert(ServerDB::User_Name, query.value(0).toString());
-		info.insert(ServerDB::User_LastActive, query.value(1).toString());
-
-		SQLPREP("SELECT `key`, `value` FROM `%1user_info` WHERE `server_id` = ? AND `user_id` = ?");
-		query.addBindValue(iServerNum);
-		query.addBindValue(id);
-		SQLEXEC();
-		while (query.next()) {
-			const int key = query.value(0).toInt();
-			if (!info.contains(key))
-				info.insert(key, query.value(1).toString());
-		}
+	QHash<int, Registration>::const_iterator r = qhRegistrations.constFind(id);
+	if (r != qhRegistrations.constEnd()) {
+		info = r->qmInfo;
+		info.insert(ServerDB::User_Name, r->qsName);
+		info.insert(ServerDB::User_LastActive, r->qsLastActive);
 	}
 	return info;
 }
@@ -863,6 +1133,7 @@ int Server::authenticate(QString &name, const QString &pw, int sessionId, const
 			query.addBindValue(name);
 			query.addBindValue(lchan);
 			SQLEXEC();
+			replaceRegistration(res, name, lchan);
 		}
 		if (res >= 0) {
 			qhUserNameCache.remove(res);
@@ -871,62 +1142,51 @@ int Server::authenticate(QString &name, const QString &pw, int sessionId, const
 		return res;
 	}
 
-	TransactionHolder th;
-	QSqlQuery &query = *th.qsqQuery;
-
-	SQLPREP("SELECT `user_id`,`name`,`pw` FROM `%1users` WHERE `server_id` = ? AND LOWER(`name`) = LOWER(?)");
-	query.addBindValue(iServerNum);
-	query.addBindValue(name);
-	SQLEXEC();
-	if (query.next()) {
+	QHash<QString, int>::const_iterator n = qhRegistrationNames.constFind(name.toLower());
+	if (n != qhRegistrationNames.constEnd()) {
+		const Registration &r = qhRegistrations[n.value()];
 		res = -1;
-		QString storedpw = query.value(2).toString();
 		QString hashedpw = QString::fromLatin1(sha1(pw).toHex());
 
-		if (! storedpw.isEmpty() && (storedpw == hashedpw)) {
-			name = query.value(1).toString();
-			res = query.value(0).toInt();
-		} else if (query.value(0).toInt() == 0) {
+		if (! r.qsPassword.isEmpty() && (r.qsPassword == hashedpw)) {
+			name = r.qsName;
+			res = n.value();
+		} else if (n.value() == 0) {
 			return -1;
 		}
 	}
 
 	// No password match. Try cert or email match, but only for non-SuperUser.
 	if (!certhash.isEmpty() && (res < 0)) {
-		SQLPREP("SELECT `user_id` FROM `%1user_info` WHERE `server_id` = ? AND `key` = ? AND `value` = ?");
-		query.addBindValue(iServerNum);
-		query.addBindValue(ServerDB::User_Hash);
-		query.addBindValue(certhash);
-		SQLEXEC();
-		if (query.next()) {
-			res = query.value(0).toInt();
+		QHash<QString, int>::const_iterator h = qhRegistrationHashes.constFind(certhash);
+		if (h != qhRegistrationHashes.constEnd()) {
+			res = h.value();
 		} else if (bStrongCert) {
+			// Rare enough (first login with a new certificate) that a scan beats keeping another index.
 			foreach(const QString &email, emails) {
 				if (! email.isEmpty()) {
-					query.addBindValue(iServerNum);
-					query.addBindValue(ServerDB::User_Email);
-					query.addBindValue(email);
-					SQLEXEC();
-					if (query.next()) {
-						res = query.value(0).toInt();
-						break;
+					QHash<int, Registration>::const_iterator i;
+					for (i = qhRegistrations.constBegin(); i != qhRegistrations.constEnd(); ++i) {
+						if (i->qmInfo.value(ServerDB::User_Email) == email) {
+							res = i.key();
+							break;
+						}
 					}
+					if (res >= 0)
+						break;
 				}
 			}
 		}
-		if (res > 0) {
-			SQLPREP("SELECT `name` FROM `%1users` WHERE `server_id` = ? AND `user_id` = ?");
-			query.addBindValue(iServerNum);
-			query.addBindValue(res);
-			SQLEXEC();
-			if (! query.next()) {
-				res = -1;
-			} else {
-				name = query.value(0).toString();
-			}
-		}
+		if (res > 0)
+			name = qhRegistrations[res].qsName;
 	}
 	if (! certhash.isEmpty() && (res > 0)) {
+		TransactionHolder th;
+		QSqlQuery &query = *th.qsqQuery;
+
+		QMap<int, QString> info;
+		info.insert(ServerDB::User_Hash, certhash);
+
 		SQLPREP("REPLACE INTO `%1user_info` (`server_id`, `user_id`, `key`, `value`) VALUES (?, ?, ?, ?)");
 		query.addBindValue(iServerNum);
 		query.addBindValue(res);
@@ -939,7 +1199,9 @@ int Server::authenticate(QString &name, const QString &pw, int sessionId, const
 			query.addBindValue(ServerDB::User_Email);
 			query.addBindValue(emails.at(0));
 			SQLEXEC();
+			info.insert(ServerDB::User_Email, emails.at(0));
 		}
+		cacheInfo(res, info);
 	}
 	if (res >= 0) {
 		qhUserNameCache.remove(res);
@@ -985,6 +1247,8 @@ bool Server::setInfo(int id, const QMap<int, QString> &setinfo) {
 		query.addBindValue(iServerNum);
 		query.addBindValue(id);
 		SQLEXEC();
+		if (qhRegistrations.contains(id))
+			qhRegistrations[id].qsPassword = pw.isEmpty() ? QString() : QString::fromLatin1(hash.result().toHex());
 		info.remove(ServerDB::User_Password);
 	}
 	if (info.contains(ServerDB::User_Name)) {
@@ -994,6 +1258,10 @@ bool Server::setInfo(int id, const QMap<int, QString> &setinfo) {
 		query.addBindValue(iServerNum);
 		query.addBindValue(id);
 		SQLEXEC();
+
+		QMap<int, QString> renamed;
+		renamed.insert(ServerDB::User_Name, name);
+		cacheInfo(id, renamed);
 		info.remove(ServerDB::User_Name);
 	}
 	if (! info.isEmpty()) {
@@ -1013,6 +1281,7 @@ bool Server::setInfo(int id, const QMap<int, QString> &setinfo) {
 		query.addBindValue(keys);
 		query.addBindValue(values);
 		SQLEXECBATCH();
+		cacheInfo(id, info);
 	}
 
 	return true;
@@ -1030,7 +1299,7 @@ bool Server::setTexture(int id, const QByteArray &texture) {
 
 	foreach(ServerUser *u, qhUsers) {
 		if (u->iId == id)
-			hashAssign(u->qbaTexture, u->qbaTextureHash, tex);
+			setUserTexture(u, tex);
 	}
 
 	int res = -2;
@@ -1047,6 +1316,10 @@ bool Server::setTexture(int id, const QByteArray &texture) {
 	query.addBindValue(id);
 	SQLEXEC();
 
+	QHash<int, Registration>::iterator r = qhRegistrations.find(id);
+	if (r != qhRegistrations.end())
+		cacheTexture(*r, tex);
+
 	return true;
 }
 
@@ -1075,6 +1348,14 @@ void ServerDB::setSUPW(int srvnum, const QString &pw) {
 	query.addBindValue(srvnum);
 	query.addBindValue(0);
 	SQLEXEC();
+
+	// Keep the registration cache of a running server in step.
+	Server *server = meta ? meta->qhServers.value(srvnum) : NULL;
+	if (server) {
+		if (! server->qhRegistrations.contains(0))
+			server->replaceRegistration(0, QLatin1String("SuperUser"), 0);
+		server->qhRegistrations[0].qsPassword = QString::fromLatin1(hash.result().toHex());
+	}
 }
 
 QString Server::getUserName(int id) {
@@ -1088,14 +1369,9 @@ QString Server::getUserName(int id) {
 		return name;
 	}
 
-	TransactionHolder th;
-	QSqlQuery &query = *th.qsqQuery;
-	SQLPREP("SELECT `name` FROM `%1users` WHERE `server_id` = ? AND `user_id` = ?");
-	query.addBindValue(iServerNum);
-	query.addBindValue(id);
-	SQLEXEC();
-	if (query.next()) {
-		name = query.value(0).toString();
+	QHash<int, Registration>::const_iterator r = qhRegistrations.constFind(id);
+	if (r != qhRegistrations.constEnd()) {
+		name = r->qsName;
 		qhUserIDCache.insert(name, id);
 		qhUserNameCache.insert(id, name);
 	}
@@ -1117,15 +1393,9 @@ int Server::getUserID(const QString &name) {
 		return id;
 	}
 
-	TransactionHolder th;
-
-	QSqlQuery &query = *th.qsqQuery;
-	SQLPREP("SELECT `user_id` FROM `%1users` WHERE `server_id` = ? AND LOWER(`name`) = LOWER(?)");
-	query.addBindValue(iServerNum);
-	query.addBindValue(name);
-	SQLEXEC();
-	if (query.next()) {
-		id = query.value(0).toInt();
+	QHash<QString, int>::const_iterator n = qhRegistrationNames.constFind(name.toLower());
+	if (n != qhRegistrationNames.constEnd()) {
+		id = n.value();
 		qhUserIDCache.insert(name, id);
 		qhUserNameCache.insert(id, name);
 	}
@@ -1139,6 +1409,17 @@ QByteArray Server::getUserTexture(int id) {
 		return qba;
 	}
 
+	QHash<int, Registration>::iterator r = qhRegistrations.find(id);
+	if (r == qhRegistrations.end())
+		return qba;
+	if (r->bTexture) {
+		if (r->qbaTextureHash.isEmpty())
+			return r->qbaTexture;
+		qba = bsBlobs.texture(r->qbaTextureHash);
+		if (! qba.isNull())
+			return qba;
+	}
+
 	TransactionHolder th;
 
 	QSqlQuery &query = *th.qsqQuery;
@@ -1152,14 +1433,22 @@ QByteArray Server::getUserTexture(int id) {
 			if (qba.size() == 600 * 60 * 4)
 				qba = qCompress(qba);
 	}
+	cacheTexture(*r, qba);
 	return qba;
 }
 
 void Server::addLink(Channel *c, Channel *l) {
-	c->link(l);
+	{
+		UserWriteLocker wl(&ulUsers);
+		c->link(l);
+		++uiSpeechVersion;
+	}
+	invalidateChannelSync(c);
+	invalidateChannelSync(l);
 
 	if (c->bTemporary || l->bTemporary)
 		return;
+	touchSnapshot();
 	TransactionHolder th;
 
 	QSqlQuery &query = *th.qsqQuery;
@@ -1176,10 +1465,17 @@ void Server::addLink(Channel *c, Channel *l) {
 }
 
 void Server::removeLink(Channel *c, Channel *l) {
-	c->unlink(l);
+	{
+		UserWriteLocker wl(&ulUsers);
+		c->unlink(l);
+		++uiSpeechVersion;
+	}
+	invalidateChannelSync(c);
+	invalidateChannelSync(l);
 
 	if (c->bTemporary || l->bTemporary)
 		return;
+	touchSnapshot();
 	TransactionHolder th;
 
 	QSqlQuery &query = *th.qsqQuery;
@@ -1197,6 +1493,9 @@ void Server::removeLink(Channel *c, Channel *l) {
 }
 
 Channel *Server::addChannel(Channel *p, const QString &name, bool temporary, int position) {
+	if (! temporary)
+		touchSnapshot();
+
 	TransactionHolder th;
 
 	QSqlQuery &query = *th.qsqQuery;
@@ -1237,6 +1536,7 @@ Channel *Server::addChannel(Channel *p, const QString &name, bool temporary, int
 
 	Channel *c = new Channel(id, name, p);
 	c->bTemporary = temporary;
+	invalidateChannelSync(c);
 	c->iPosition = position;
 	qhChannels.insert(id, c);
 	return c;
@@ -1244,6 +1544,8 @@ Channel *Server::addChannel(Channel *p, const QString &name, bool temporary, int
 
 void Server::removeChannelDB(const Channel *c) {
 	if (! c->bTemporary) {
+		touchSnapshot();
+
 		TransactionHolder th;
 
 		QSqlQuery &query = *th.qsqQuery;
@@ -1256,8 +1558,11 @@ void Server::removeChannelDB(const Channel *c) {
 }
 
 void Server::updateChannel(const Channel *c) {
+	invalidateChannelSync(c);
+
 	if (c->bTemporary)
 		return;
+	touchSnapshot();
 	TransactionHolder th;
 	Group *g;
 	ChanACL *acl;
@@ -1335,7 +1640,7 @@ void Server::updateChannel(const Channel *c) {
 		query.addBindValue(pri++);
 
 		query.addBindValue((acl->iUserId == -1) ? QVariant() : acl->iUserId);
-		query.addBindValue((acl->qsGroup.isEmpty()) ? QVariant() : acl->qsGroup);
+		query.addBindValue((acl->group().isEmpty()) ? QVariant() : acl->group());
 		query.addBindValue(acl->bApplyHere ? 1 : 0);
 		query.addBindValue(acl->bApplySubs ? 1 : 0);
 		query.addBindValue(static_cast<int>(acl->pAllow));
@@ -1344,23 +1649,60 @@ void Server::updateChannel(const Channel *c) {
 	}
 }
 
-/** Reads the channel privileges (group and acl) as well as the channel information key/value pairs from the database.
- * @param c Channel to fetch information for
+struct ChannelRow {
+	int iId;
+	QString qsName;
+	bool bInheritACL;
+};
+
+/**
+ * Reads the whole channel tree with its info, groups and ACLs, one query per
+ * table, and assembles it in memory. Channels that aren't reachable from a root
+ * channel are skipped.
  */
-void Server::readChannelPrivs(Channel *c) {
+void Server::readChannels() {
 	TransactionHolder th;
+	QSqlQuery &query = *th.qsqQuery;
 
-	int cid = c->iId;
+	// Children of each parent in name order; -1 holds the root.
+	QHash<int, QList<ChannelRow> > qhKids;
 
-	QSqlQuery &query = *th.qsqQuery;
+	SQLPREP("SELECT `channel_id`, `parent_id`, `name`, `inheritacl` FROM `%1channels` WHERE `server_id` = ? ORDER BY `name`");
+	query.addBindValue(iServerNum);
+	SQLEXEC();
+	while (query.next()) {
+		ChannelRow r;
+		r.iId = query.value(0).toInt();
+		r.qsName = query.value(2).toString();
+		r.bInheritACL = query.value(3).toBool();
+		qhKids[query.value(1).isNull() ? -1 : query.value(1).toInt()] << r;
+	}
+
+	QList<Channel *> parents;
+	parents << NULL;
+	while (! parents.isEmpty()) {
+		Channel *p = parents.takeFirst();
+		foreach(const ChannelRow &r, qhKids.value(p ? p->iId : -1)) {
+			if (qhChannels.contains(r.iId))
+				continue;
+			Channel *c = new Channel(r.iId, r.qsName, p);
+			if (! p)
+				c->setParent(this);
+			qhChannels.insert(c->iId, c);
+			c->bInheritACL = r.bInheritACL;
+			parents << c;
+		}
+	}
 
-	SQLPREP("SELECT `key`, `value` FROM `%1channel_info` WHERE `server_id` = ? AND `channel_id` = ?");
+	SQLPREP("SELECT `channel_id`, `key`, `value` FROM `%1channel_info` WHERE `server_id` = ?");
 	query.addBindValue(iServerNum);
-	query.addBindValue(cid);
 	SQLEXEC();
 	while (query.next()) {
-		int key = query.value(0).toInt();
-		const QString &value = query.value(1).toString();
+		Channel *c = qhChannels.value(query.value(0).toInt());
+		if (! c)
+			continue;
+		int key = query.value(1).toInt();
+		const QString &value = query.value(2).toString();
 		if (key == ServerDB::Channel_Description) {
 			hashAssign(c->qsDesc, c->qbaDescHash, value);
 		} else if (key == ServerDB::Channel_Position) {
@@ -1368,82 +1710,50 @@ void Server::readChannelPrivs(Channel *c) {
 		}
 	}
 
-	SQLPREP("SELECT `group_id`, `name`, `inherit`, `inheritable` FROM `%1groups` WHERE `server_id` = ? AND `channel_id` = ?");
+	QHash<int, Group *> groups;
+
+	SQLPREP("SELECT `group_id`, `channel_id`, `name`, `inherit`, `inheritable` FROM `%1groups` WHERE `server_id` = ?");
 	query.addBindValue(iServerNum);
-	query.addBindValue(cid);
 	SQLEXEC();
 	while (query.next()) {
-		int gid = query.value(0).toInt();
-		QString name = query.value(1).toString();
-		Group *g = new Group(c, name);
-		g->bInherit = query.value(2).toBool();
-		g->bInheritable = query.value(3).toBool();
-
-		QSqlQuery mem;
-		mem.prepare(QString::fromLatin1("SELECT user_id, addit FROM %1group_members WHERE group_id = ?").arg(Meta::mp.qsDBPrefix));
-		mem.addBindValue(gid);
-		mem.exec();
-		while (mem.next()) {
-			int uid = mem.value(0).toInt();
-			if (mem.value(1).toBool())
-				g->qsAdd << uid;
-			else
-				g->qsRemove << uid;
-		}
+		Channel *c = qhChannels.value(query.value(1).toInt());
+		if (! c)
+			continue;
+		Group *g = new Group(c, query.value(2).toString());
+		g->bInherit = query.value(3).toBool();
+		g->bInheritable = query.value(4).toBool();
+		groups.insert(query.value(0).toInt(), g);
 	}
 
-	SQLPREP("SELECT `user_id`, `group_name`, `apply_here`, `apply_sub`, `grantpriv`, `revokepriv` FROM `%1acl` WHERE `server_id` = ? AND `channel_id` = ? ORDER BY `priority`");
+	SQLPREP("SELECT `group_id`, `user_id`, `addit` FROM `%1group_members` WHERE `server_id` = ?");
 	query.addBindValue(iServerNum);
-	query.addBindValue(cid);
 	SQLEXEC();
 	while (query.next()) {
-		ChanACL *acl = new ChanACL(c);
-		acl->iUserId = query.value(0).isNull() ? -1 : query.value(0).toInt();
-		acl->qsGroup = query.value(1).toString();
-		acl->bApplyHere = query.value(2).toBool();
-		acl->bApplySubs = query.value(3).toBool();
-		acl->pAllow = static_cast<ChanACL::Permissions>(query.value(4).toInt());
-		acl->pDeny = static_cast<ChanACL::Permissions>(query.value(5).toInt());
-	}
-}
-
-void Server::readChannels(Channel *p) {
-	QList<Channel *> kids;
-	Channel *c;
-	QSqlQuery query;
-	int parentid = -1;
-
-	if (p) {
-		parentid = p->iId;
-		readChannelPrivs(qhChannels.value(parentid));
+		Group *g = groups.value(query.value(0).toInt());
+		if (! g)
+			continue;
+		int uid = query.value(1).toInt();
+		if (query.value(2).toBool())
+			g->qsAdd << uid;
+		else
+			g->qsRemove << uid;
 	}
 
-	{
-		TransactionHolder th;
-		if (parentid == -1) {
-			SQLPREP("SELECT `channel_id`, `name`, `inheritacl` FROM `%1channels` WHERE `server_id` = ? AND `parent_id` IS NULL ORDER BY `name`");
-			query.addBindValue(iServerNum);
-		} else {
-			SQLPREP("SELECT `channel_id`, `name`, `inheritacl` FROM `%1channels` WHERE `server_id` = ? AND `parent_id`=? ORDER BY `name`");
-			query.addBindValue(iServerNum);
-			query.addBindValue(parentid);
-		}
-		SQLEXEC();
-
-		while (query.next()) {
-			c = new Channel(query.value(0).toInt(), query.value(1).toString(), p);
-			if (! p)
-				c->setParent(this);
-			qhChannels.insert(c->iId, c);
-			c->bInheritACL = query.value(2).toBool();
-			kids << c;
-		}
+	SQLPREP("SELECT `channel_id`, `user_id`, `group_name`, `apply_here`, `apply_sub`, `grantpriv`, `revokepriv` FROM `%1acl` WHERE `server_id` = ? ORDER BY `channel_id`, `priority`");
+	query.addBindValue(iServerNum);
+	SQLEXEC();
+	while (query.next()) {
+		Channel *c = qhChannels.value(query.value(0).toInt());
+		if (! c)
+			continue;
+		ChanACL *acl = new ChanACL(c);
+		acl->iUserId = query.value(1).isNull() ? -1 : query.value(1).toInt();
+		acl->setGroup(query.value(2).toString());
+		acl->bApplyHere = query.value(3).toBool();
+		acl->bApplySubs = query.value(4).toBool();
+		acl->pAllow = static_cast<ChanACL::Permissions>(query.value(5).toInt());
+		acl->pDeny = static_cast<ChanACL::Permissions>(query.value(6).toInt());
 	}
-
-	query.clear();
-
-	foreach(c, kids)
-		readChannels(c);
 }
 
 void Server::readLinks() {
@@ -1472,6 +1782,24 @@ void Server::setLastChannel(const User *p) {
 	if (p->cChannel->bTemporary)
 		return;
 
+	QHash<int, Registration>::iterator r = qhRegistrations.find(p->iId);
+	if (r == qhRegistrations.end())
+		return;
+
+	r->iLastChannel = p->cChannel->iId;
+	r->qsLastActive = QDateTime::currentDateTime().toUTC().toString(QLatin1String("yyyy-MM-dd hh:mm:ss"));
+
+	// Written behind by flushLastChannels(), so moving around never waits on the database.
+	qhPendingLastChannel.insert(p->iId, p->cChannel->iId);
+}
+
+/// Writes all queued last channel updates in a single transaction. Called from
+/// checkTimeout(), before anything reads lastchannel back from the database, and
+/// when the server is stopped.
+void Server::flushLastChannels() {
+	if (qhPendingLastChannel.isEmpty())
+		return;
+
 	TransactionHolder th;
 	QSqlQuery &query = *th.qsqQuery;
 
@@ -1480,26 +1808,29 @@ void Server::setLastChannel(const User *p) {
 	} else {
 		SQLPREP("UPDATE `%1users` SET `lastchannel`=?, `last_active` = now() WHERE `server_id` = ? AND `user_id` = ?");
 	}
-	query.addBindValue(p->cChannel->iId);
-	query.addBindValue(iServerNum);
-	query.addBindValue(p->iId);
-	SQLEXEC();
+
+	QVariantList channels, serverids, userids;
+	QHash<int, int>::const_iterator i;
+	for (i = qhPendingLastChannel.constBegin(); i != qhPendingLastChannel.constEnd(); ++i) {
+		channels << i.value();
+		serverids << iServerNum;
+		userids << i.key();
+	}
+	query.addBindValue(channels);
+	query.addBindValue(serverids);
+	query.addBindValue(userids);
+	SQLEXECBATCH();
+
+	qhPendingLastChannel.clear();
 }
 
 int Server::readLastChannel(int id) {
 	if (id < 0)
 		return -1;
 
-	TransactionHolder th;
-	QSqlQuery &query = *th.qsqQuery;
-
-	SQLPREP("SELECT `lastchannel` FROM `%1users` WHERE `server_id` = ? AND `user_id` = ?");
-	query.addBindValue(iServerNum);
-	query.addBindValue(id);
-	SQLEXEC();
-
-	if (query.next()) {
-		int cid = query.value(0).toInt();
+	QHash<int, Registration>::const_iterator r = qhRegistrations.constFind(id);
+	if (r != qhRegistrations.constEnd()) {
+		int cid = r->iLastChannel;
 		if (qhChannels.contains(cid))
 			return cid;
 	}
@@ -1527,7 +1858,7 @@ void Server::dumpChannel(const Channel *c) {
 	foreach(acl, c->qlACL) {
 		int allow = static_cast<int>(acl->pAllow);
 		int deny = static_cast<int>(acl->pDeny);
-		qWarning("ChanACL Here %d Sub %d Allow %04x Deny %04x ID %d Group %s", acl->bApplyHere, acl->bApplySubs, allow, deny, acl->iUserId, qPrintable(acl->qsGroup));
+		qWarning("ChanACL Here %d Sub %d Allow %04x Deny %04x ID %d Group %s", acl->bApplyHere, acl->bApplySubs, allow, deny, acl->iUserId, qPrintable(acl->group()));
 	}
 	qWarning(" ");
 
@@ -1561,9 +1892,14 @@ void Server::getBans() {
 		if (ban.isValid())
 			qlBans << ban;
 	}
+
+	btBans.rebuild(qlBans);
 }
 
 void Server::saveBans() {
+	btBans.rebuild(qlBans);
+	touchSnapshot();
+
 	TransactionHolder th;
 
 	QSqlQuery &query = *th.qsqQuery;
@@ -1590,6 +1926,10 @@ QVariant Server::getConf(const QString &key, QVariant def) {
 }
 
 QVariant ServerDB::getConf(int server_id, const QString &key, QVariant def) {
+	QHash<int, QHash<QString, QVariant> >::const_iterator i = qhConfCache.constFind(server_id);
+	if (i != qhConfCache.constEnd())
+		return i.value().value(key, def);
+
 	TransactionHolder th;
 
 	QSqlQuery &query = *th.qsqQuery;
@@ -1603,6 +1943,27 @@ QVariant ServerDB::getConf(int server_id, const QString &key, QVariant def) {
 	return def;
 }
 
+void ServerDB::preloadConf() {
+	TransactionHolder th;
+
+	qhConfCache.clear();
+	foreach(int server_id, getAllServers())
+		qhConfCache.insert(server_id, QHash<QString, QVariant>());
+
+	QSqlQuery &query = *th.qsqQuery;
+	SQLPREP("SELECT `server_id`, `key`, `value` FROM `%1config`");
+	SQLEXEC();
+	while (query.next()) {
+		const int server_id = query.value(0).toInt();
+		if (qhConfCache.contains(server_id))
+			qhConfCache[server_id].insert(query.value(1).toString(), query.value(2));
+	}
+}
+
+void ServerDB::clearConfCache() {
+	qhConfCache.clear();
+}
+
 QMap<QString, QString> ServerDB::getAllConf(int server_id) {
 	TransactionHolder th;
 
@@ -1623,31 +1984,12 @@ void Server::setConf(const QString &key, const QVariant &value) {
 }
 
 void Server::dblog(const QString &str) const {
-	TransactionHolder th;
-	QSqlQuery &query = *th.qsqQuery;
-
 	// Is logging disabled?
 	if (Meta::mp.iLogDays < 0)
 		return;
 
-	// Once per hour
-	if (Meta::mp.iLogDays > 0) {
-		if (ServerDB::tLogClean.isElapsed(3600ULL * 1000000ULL)) {
-			QString qstr;
-			if (Meta::mp.qsDBDriver == "QSQLITE") {
-				qstr = QString::fromLatin1("msgtime < datetime('now','-%1 days')").arg(Meta::mp.iLogDays);
-			} else {
-				qstr = QString::fromLatin1("msgtime < now() - INTERVAL %1 day").arg(Meta::mp.iLogDays);
-			}
-			ServerDB::prepare(query, QString::fromLatin1("DELETE FROM %1slog WHERE ") + qstr);
-			SQLEXEC();
-		}
-	}
-
-	SQLPREP("INSERT INTO `%1slog` (`server_id`, `msg`) VALUES(?,?)");
-	query.addBindValue(iServerNum);
-	query.addBindValue(str);
-	SQLEXEC();
+	if (ServerDB::lwLog)
+		ServerDB::lwLog->log(iServerNum, str);
 }
 
 void ServerDB::wipeLogs() {
@@ -1658,6 +2000,9 @@ void ServerDB::wipeLogs() {
 }
 
 QList<QPair<unsigned int, QString> > ServerDB::getLog(int server_id, unsigned int offs_min, unsigned int offs_max) {
+	if (lwLog)
+		lwLog->flush();
+
 	TransactionHolder th;
 	QSqlQuery &query = *th.qsqQuery;
 
@@ -1677,6 +2022,9 @@ QList<QPair<unsigned int, QString> > ServerDB::getLog(int server_id, unsigned in
 }
 
 int ServerDB::getLogLen(int server_id) {
+	if (lwLog)
+		lwLog->flush();
+
 	TransactionHolder th;
 	QSqlQuery &query = *th.qsqQuery;
 
@@ -1692,6 +2040,8 @@ int ServerDB::getLogLen(int server_id) {
 }
 
 void ServerDB::setConf(int server_id, const QString &k, const QVariant &value) {
+	qhConfCache.remove(server_id);
+
 	TransactionHolder th;
 
 	const QString &key = (k == "serverpassword") ? "password" : k;
@@ -1711,6 +2061,48 @@ void ServerDB::setConf(int server_id, const QString &k, const QVariant &value) {
 }
 
 
+/**
+ * Generation of the server state last written to the database, 0 if it was
+ * never recorded. A snapshot of the server is only valid if it carries the
+ * same generation.
+ */
+quint64 ServerDB::getSnapshotGeneration(int server_id) {
+	TransactionHolder th;
+	QSqlQuery &query = *th.qsqQuery;
+
+	SQLPREP("SELECT `value` FROM `%1meta` WHERE `keystring` = ?");
+	query.addBindValue(QString::fromLatin1("snapshot_generation_%1").arg(server_id));
+	SQLEXEC();
+	if (query.next())
+		return query.value(0).toULongLong();
+	return 0;
+}
+
+/**
+ * Gives the server state a new generation, unique across all servers so a
+ * snapshot left behind by a deleted server can never match.
+ */
+quint64 ServerDB::bumpSnapshotGeneration(int server_id) {
+	TransactionHolder th;
+	QSqlQuery &query = *th.qsqQuery;
+
+	quint64 generation = 1;
+	SQLDO("SELECT `value` FROM `%1meta` WHERE `keystring` = 'snapshot_generation'");
+	if (query.next())
+		generation = query.value(0).toULongLong() + 1;
+
+	SQLPREP("REPLACE INTO `%1meta` (`keystring`, `value`) VALUES (?,?)");
+	query.addBindValue(QLatin1String("snapshot_generation"));
+	query.addBindValue(QString::number(generation));
+	SQLEXEC();
+
+	query.addBindValue(QString::fromLatin1("snapshot_generation_%1").arg(server_id));
+	query.addBindValue(QString::number(generation));
+	SQLEXEC();
+
+	return generation;
+}
+
 QList<int> ServerDB::getAllServers() {
 	TransactionHolder th;
 	QSqlQuery &query = *th.qsqQuery;
@@ -1731,6 +2123,11 @@ QList<int> ServerDB::getBootServers() {
 
 	QList<int> bootlist;
 	foreach(int i, ql) {
+		if (qhConfCache.contains(i)) {
+			if (qhConfCache.value(i).value(QLatin1String("boot"), true).toBool())
+				bootlist << i;
+			continue;
+		}
 		SQLPREP("SELECT `value` FROM `%1config` WHERE `server_id` = ? AND `key` = ?");
 		query.addBindValue(i);
 		query.addBindValue(QLatin1String("boot"));
@@ -1767,8 +2164,18 @@ int ServerDB::addServer() {
 }
 
 void ServerDB::deleteServer(int server_id) {
+	qhConfCache.remove(server_id);
+
+	// Rows still queued for this server would otherwise be inserted after it is gone.
+	if (lwLog)
+		lwLog->flush();
+
 	TransactionHolder th;
 	QSqlQuery &query = *th.qsqQuery;
+	SQLPREP("DELETE FROM `%1meta` WHERE `keystring` = ?");
+	query.addBindValue(QString::fromLatin1("snapshot_generation_%1").arg(server_id));
+	SQLEXEC();
+
 	SQLPREP("DELETE FROM `%1servers` WHERE `server_id` = ?");
 	query.addBindValue(server_id);
 	SQLEXEC();
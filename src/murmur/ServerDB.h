@@ -31,7 +31,13 @@
 #ifndef MUMBLE_MURMUR_DATABASE_H_
 #define MUMBLE_MURMUR_DATABASE_H_
 
+#include <QtCore/QDateTime>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QQueue>
+#include <QtCore/QThread>
 #include <QtCore/QVariant>
+#include <QtCore/QWaitCondition>
 
 #include "Timer.h"
 
@@ -41,6 +47,47 @@ class Connection;
 class QSqlDatabase;
 class QSqlQuery;
 
+/**
+ * Writes the server log (the slog table) on its own thread and database
+ * connection. Entries are queued by Server::dblog() and committed in
+ * batches, one transaction per batch, and old entries are pruned from the
+ * same thread once an hour. When the queue is full, entries are dropped
+ * and counted, after waiting up to logqueuewait milliseconds for room if
+ * logqueuefull is set to wait. Entries carry the time they were logged.
+ */
+class LogWriter : public QThread {
+	private:
+		Q_DISABLE_COPY(LogWriter)
+	protected:
+		struct Entry {
+			int iServerId;
+			QString qsMsg;
+			QDateTime qdtTime;
+		};
+
+		QMutex qmQueue;
+		QWaitCondition qwcWork;
+		QWaitCondition qwcIdle;
+		QWaitCondition qwcSpace;
+		QQueue<Entry> qqEntries;
+		bool bStop;
+		/// A dequeued batch is being written.
+		bool bWriting;
+		unsigned int uiDropped;
+		Timer tPrune;
+
+		void run();
+		void write(QSqlDatabase &, const QList<Entry> &);
+		void prune(QSqlDatabase &);
+	public:
+		LogWriter(QObject *p = NULL);
+		~LogWriter();
+		void log(int server_id, const QString &msg);
+		/// Waits until every queued entry is in the database. Must not be called with qmDatabase held.
+		void flush();
+		void stop();
+};
+
 class ServerDB {
 	public:
 		enum ChannelInfo { Channel_Description, Channel_Position };
@@ -48,9 +95,14 @@ class ServerDB {
 		ServerDB();
 		~ServerDB();
 		typedef QPair<unsigned int, QString> LogRecord;
-		static Timer tLogClean;
 		static QSqlDatabase *db;
+		// Held for every transaction, so the log writer's connection never
+		// contends with the main one inside the database.
+		static QMutex qmDatabase;
+		static LogWriter *lwLog;
 		static QString qsUpgradeSuffix;
+		/// Statements executed through exec() and execBatch(), for startup statistics.
+		static quint64 uiQueries;
 		static void setSUPW(int iServNum, const QString &pw);
 		static QList<int> getBootServers();
 		static QList<int> getAllServers();
@@ -59,6 +111,12 @@ class ServerDB {
 		static bool serverExists(int num);
 		static QMap<QString, QString> getAllConf(int server_id);
 		static QVariant getConf(int server_id, const QString &key, QVariant def = QVariant());
+		/// Configuration of all servers read by preloadConf(), served by getConf() while booting.
+		static QHash<int, QHash<QString, QVariant> > qhConfCache;
+		static void preloadConf();
+		static void clearConfCache();
+		static quint64 getSnapshotGeneration(int server_id);
+		static quint64 bumpSnapshotGeneration(int server_id);
 		static void setConf(int server_id, const QString &key, const QVariant &value = QVariant());
 		static QList<LogRecord> getLog(int server_id, unsigned int offs_min, unsigned int offs_max);
 		static int getLogLen(int server_id);
@@ -41,6 +41,10 @@ ServerUser::ServerUser(Server *p, QSslSocket *socket) : Connection(p, socket), U
 
 	memset(&saiUdpAddress, 0, sizeof(saiUdpAddress));
 	memset(&saiTcpLocalAddress, 0, sizeof(saiTcpLocalAddress));
+	bUdpSource = false;
+#ifdef Q_OS_LINUX
+	memset(&mhUdp, 0, sizeof(mhUdp));
+#endif
 
 	dUDPPingAvg = dUDPPingVar = 0.0f;
 	dTCPPingAvg = dTCPPingVar = 0.0f;
@@ -50,81 +54,133 @@ ServerUser::ServerUser(Server *p, QSslSocket *socket) : Connection(p, socket), U
 	uiVersion = 0;
 	bVerified = true;
 	iLastPermissionCheck = -1;
+	cSpeechChannel = NULL;
+	uiSpeechVersion = 0;
 	
 	bOpus = false;
 }
 
 
+ServerUser::~ServerUser() {
+#if QT_VERSION >= 0x050000
+	delete qapTunnel.loadAcquire();
+#else
+	delete static_cast<TunnelQueue *>(qapTunnel);
+#endif
+}
+
+TunnelQueue *ServerUser::tunnel(int producers) {
+#if QT_VERSION >= 0x050000
+	TunnelQueue *tq = qapTunnel.loadAcquire();
+#else
+	TunnelQueue *tq = qapTunnel.fetchAndAddAcquire(0);
+#endif
+	if (tq)
+		return tq;
+
+	// Several voice threads may get here at once; the first one to publish wins.
+	tq = new TunnelQueue(producers);
+	if (! qapTunnel.testAndSetOrdered(NULL, tq)) {
+		delete tq;
+#if QT_VERSION >= 0x050000
+		tq = qapTunnel.loadAcquire();
+#else
+		tq = qapTunnel.fetchAndAddAcquire(0);
+#endif
+	}
+	return tq;
+}
+
+void ServerUser::flushTunnel() {
+#if QT_VERSION >= 0x050000
+	TunnelQueue *tq = qapTunnel.loadAcquire();
+#else
+	TunnelQueue *tq = qapTunnel.fetchAndAddAcquire(0);
+#endif
+	if (! tq)
+		return;
+
+	// Control messages queued before the voice must reach the socket first,
+	// then one TCP_NODELAY flush covers everything.
+	flushBatch();
+	if (tq->drain(qtsSocket))
+		forceFlush();
+}
+
 ServerUser::operator const QString() const {
 	return QString::fromLatin1("%1:%2(%3)").arg(qsName).arg(uiSession).arg(iId);
 }
 BandwidthRecord::BandwidthRecord() {
-	iRecNum = 0;
-	iSum = 0;
+	uiFirst = uiIdleControl = uiLastFrame = uiRefill = Timer::now();
+	uiTokens = ~0ULL;
+	uiSlot = static_cast<quint32>(uiFirst / BANDWIDTH_SLOT_LENGTH);
 	for (int i=0;i<N_BANDWIDTH_SLOTS;i++)
-		a_iBW[i] = 0;
+		a_uiBytes[i] = 0;
 }
 
-bool BandwidthRecord::addFrame(int size, int maxpersec) {
-	quint64 elapsed = a_qtWhen[iRecNum].elapsed();
+bool BandwidthRecord::addFrame(int size, int maxpersec, quint64 now) {
+	const quint64 burst = static_cast<quint64>(maxpersec) * BANDWIDTH_BURST;
 
-	if (elapsed == 0)
-		return false;
-
-	int nsum = iSum-a_iBW[iRecNum]+size;
-	int bw = static_cast<int>((nsum * 1000000LL) / elapsed);
+	if (now > uiRefill) {
+		const quint64 elapsed = qMin(now - uiRefill, BANDWIDTH_BURST);
+		uiTokens = qMin(uiTokens, burst - qMin(burst, elapsed * maxpersec)) + elapsed * maxpersec;
+		uiRefill = now;
+	} else if (uiTokens > burst) {
+		uiTokens = burst;
+	}
 
-	if (bw > maxpersec)
+	const quint64 cost = static_cast<quint64>(size) * 1000000ULL;
+	if (uiTokens < cost)
 		return false;
+	uiTokens -= cost;
 
-	a_iBW[iRecNum] = static_cast<unsigned short>(size);
-	a_qtWhen[iRecNum].restart();
-
-	iSum = nsum;
+	if (now > uiLastFrame)
+		uiLastFrame = now;
 
-	iRecNum++;
-	if (iRecNum == N_BANDWIDTH_SLOTS)
-		iRecNum = 0;
+	const quint32 slot = static_cast<quint32>(now / BANDWIDTH_SLOT_LENGTH);
+	if (slot != uiSlot) {
+		const quint32 stale = qMin(slot - uiSlot, static_cast<quint32>(N_BANDWIDTH_SLOTS));
+		for (quint32 i = 1; i <= stale; ++i)
+			a_uiBytes[(uiSlot + i) % N_BANDWIDTH_SLOTS] = 0;
+		uiSlot = slot;
+	}
+	a_uiBytes[slot % N_BANDWIDTH_SLOTS] += static_cast<quint32>(size);
 
 	return true;
 }
 
 int BandwidthRecord::onlineSeconds() const {
-	return static_cast<int>(tFirst.elapsed() / 1000000LL);
+	return static_cast<int>((Timer::now() - uiFirst) / 1000000LL);
 }
 
 int BandwidthRecord::idleSeconds() const {
-	quint64 iIdle = a_qtWhen[(iRecNum + N_BANDWIDTH_SLOTS - 1) % N_BANDWIDTH_SLOTS].elapsed();
-	if (tIdleControl.elapsed() < iIdle)
-		iIdle = tIdleControl.elapsed();
-
-	return static_cast<int>(iIdle / 1000000LL);
+	const quint64 last = qMax(uiLastFrame, uiIdleControl);
+	const quint64 now = Timer::now();
+	if (now <= last)
+		return 0;
+	return static_cast<int>((now - last) / 1000000LL);
 }
 
 void BandwidthRecord::resetIdleSeconds() {
-	tIdleControl.restart();
+	uiIdleControl = Timer::now();
 }
 
 int BandwidthRecord::bandwidth() const {
-	int sum = 0;
-	int records = 0;
-	quint64 elapsed = 0ULL;
-
-	for (int i=1;i<N_BANDWIDTH_SLOTS;++i) {
-		int idx = (iRecNum + N_BANDWIDTH_SLOTS - i) % N_BANDWIDTH_SLOTS;
-		quint64 e = a_qtWhen[idx].elapsed();
-		if (e > 1000000ULL) {
-			break;
-		} else {
-			++records;
-			sum += a_iBW[idx];
-			elapsed = e;
-		}
+	const quint64 now = Timer::now();
+	const quint32 slot = static_cast<quint32>(now / BANDWIDTH_SLOT_LENGTH);
+
+	// The current slot and the N_BANDWIDTH_SLOTS - 1 before it, as far as they were written.
+	quint64 sum = 0;
+	for (quint32 i = 0; i < N_BANDWIDTH_SLOTS; ++i) {
+		const quint32 s = slot - i;
+		if ((uiSlot - s) < N_BANDWIDTH_SLOTS && (s <= uiSlot))
+			sum += a_uiBytes[s % N_BANDWIDTH_SLOTS];
 	}
 
-	if (elapsed < 250000ULL)
+	const quint64 from = qMax(static_cast<quint64>(slot - (N_BANDWIDTH_SLOTS - 1)) * BANDWIDTH_SLOT_LENGTH, uiFirst);
+	if (now < from + BANDWIDTH_SLOT_LENGTH)
 		return 0;
 
-	return static_cast<int>((sum * 1000000ULL) / elapsed);
+	return static_cast<int>((sum * 1000000ULL) / (now - from));
 }
 
@@ -32,7 +32,9 @@
 #ifndef MUMBLE_MURMUR_SERVERUSER_H_
 #define MUMBLE_MURMUR_SERVERUSER_H_
 
+#include <QtCore/QMutex>
 #include <QtCore/QStringList>
+#include <QtCore/QVector>
 
 #ifdef Q_OS_UNIX
 #include <sys/socket.h>
@@ -43,24 +45,34 @@
 #include "Connection.h"
 #include "Net.h"
 #include "Timer.h"
+#include "TunnelQueue.h"
 #include "User.h"
 
-// Unfortunately, this needs to be "large enough" to hold
-// enough frames to account for both short-term and
-// long-term "maladjustments".
+// The rate limit allows bursts of up to this long at the maximum rate, to
+// absorb network jitter; the sustained rate can't exceed the maximum.
+#define BANDWIDTH_BURST 1000000ULL
 
-#define N_BANDWIDTH_SLOTS 360
+// bandwidth() averages over this many slots of BANDWIDTH_SLOT_LENGTH usec.
+#define N_BANDWIDTH_SLOTS 4
+#define BANDWIDTH_SLOT_LENGTH 250000ULL
 
+/**
+ * Voice data rate limit and statistics of a user. The limit is a token bucket,
+ * so checking a frame is a bit of arithmetic on a time stamp the caller took
+ * for its whole receive batch. Times are Timer::now() microseconds.
+ */
 struct BandwidthRecord {
-	int iRecNum;
-	int iSum;
-	Timer tFirst;
-	Timer tIdleControl;
-	unsigned short a_iBW[N_BANDWIDTH_SLOTS];
-	Timer a_qtWhen[N_BANDWIDTH_SLOTS];
+	quint64 uiFirst;
+	quint64 uiIdleControl;
+	quint64 uiLastFrame;
+	quint64 uiRefill;
+	/// Bytes the user may still send, times 1000000.
+	quint64 uiTokens;
+	quint32 uiSlot;
+	quint32 a_uiBytes[N_BANDWIDTH_SLOTS];
 
 	BandwidthRecord();
-	bool addFrame(int size, int maxpersec);
+	bool addFrame(int size, int maxpersec, quint64 now);
 	int onlineSeconds() const;
 	int idleSeconds() const;
 	void resetIdleSeconds();
@@ -119,6 +131,12 @@ class ServerUser : public Connection, public User {
 		QMap<int, TargetCache> qmTargetCache;
 		QMap<QString, QString> qmWhisperRedirect;
 
+		// Recipients of normal speech in cSpeechChannel and the channels linked
+		// to it. Valid while uiSpeechVersion matches Server::uiSpeechVersion.
+		QVector<ServerUser *> qvSpeechTargets;
+		Channel *cSpeechChannel;
+		unsigned int uiSpeechVersion;
+
 		int iLastPermissionCheck;
 		QMap<int, unsigned int> qmPermissionSent;
 #ifdef Q_OS_UNIX
@@ -127,9 +145,30 @@ class ServerUser : public Connection, public User {
 		SOCKET sUdpSocket;
 #endif
 		BandwidthRecord bwr;
+		// Serializes csCrypt between the voice threads; several of them may
+		// forward voice to the same user at once. Also guards the UDP peer
+		// address, which a voice thread sets when it learns the peer.
+		QMutex qmCrypt;
 		struct sockaddr_storage saiUdpAddress;
 		struct sockaddr_storage saiTcpLocalAddress;
+		// Set once the UDP peer is known and a source address for it exists.
+		bool bUdpSource;
+#ifdef Q_OS_LINUX
+		// Prebuilt sendmsg() header for voice to this user; msg_name points
+		// at saiUdpAddress and msg_control at aucUdpControl.
+		struct msghdr mhUdp;
+		u_char aucUdpControl[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+#endif
+		// Voice tunnelled over TCP, queued by the voice threads and written
+		// out by flushTunnel(). Allocated the first time it is needed.
+		QAtomicPointer<TunnelQueue> qapTunnel;
+		// Set while this user is on Server::qlTunnelUsers.
+		QAtomicInt qaiTunnelQueued;
+		TunnelQueue *tunnel(int producers);
+		void flushTunnel();
+
 		ServerUser(Server *parent, QSslSocket *socket);
+		~ServerUser();
 };
 
 #endif
@@ -0,0 +1,290 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "murmur_pch.h"
+
+#include "ACL.h"
+#include "Channel.h"
+#include "Group.h"
+#include "Meta.h"
+#include "Server.h"
+#include "ServerDB.h"
+
+/*
+ * A snapshot is a copy of the persistent channel tree and ban list of one
+ * virtual server, written so the next start doesn't have to assemble them
+ * from the database. The database stays authoritative: every snapshot carries
+ * the generation the server had in the meta table when it was written, and
+ * the first change after a write bumps that generation before touching the
+ * database. A snapshot is therefore only loaded if nothing changed since it
+ * was written, and anything that fails to verify falls back to SQL.
+ *
+ * Layout, all integers big endian as written by QDataStream:
+ *   quint32 magic, quint32 version, qint32 server id, quint64 generation,
+ *   quint32 payload length, 20 bytes SHA1 of the payload, payload.
+ */
+
+static const quint32 uiSnapshotMagic = 0x4d534e50;
+static const quint32 uiSnapshotVersion = 1;
+
+QString Server::snapshotPath() const {
+	if (Meta::mp.qsSnapshotDir.isEmpty())
+		return QString();
+	return QDir(Meta::mp.qsSnapshotDir).absoluteFilePath(QString::fromLatin1("murmur-%1.snapshot").arg(iServerNum));
+}
+
+/// Called before every change to the persistent state in the database.
+void Server::touchSnapshot() {
+	if (bSnapshotDirty)
+		return;
+	uiSnapshotGeneration = ServerDB::bumpSnapshotGeneration(iServerNum);
+	bSnapshotDirty = true;
+}
+
+bool Server::loadSnapshot() {
+	const QString path = snapshotPath();
+	if (path.isEmpty() || ! uiSnapshotGeneration)
+		return false;
+
+	QFile f(path);
+	if (! f.open(QIODevice::ReadOnly))
+		return false;
+
+	// The mapping lives as long as f, so file must not outlive it. Everything
+	// read from it below is a deep copy.
+	QByteArray file;
+	const uchar *mapped = f.map(0, f.size());
+	if (mapped)
+		file = QByteArray::fromRawData(reinterpret_cast<const char *>(mapped), static_cast<int>(f.size()));
+	else
+		file = f.readAll();
+
+	QDataStream ds(file);
+	ds.setVersion(QDataStream::Qt_4_6);
+
+	quint32 magic = 0, version = 0, length = 0;
+	qint32 server = -1;
+	quint64 generation = 0;
+	char digest[20];
+
+	ds >> magic >> version >> server >> generation >> length;
+	if (ds.readRawData(digest, sizeof(digest)) != sizeof(digest) || ds.status() != QDataStream::Ok)
+		return false;
+	if ((magic != uiSnapshotMagic) || (version != uiSnapshotVersion) || (server != iServerNum) || (generation != uiSnapshotGeneration))
+		return false;
+
+	const int offset = static_cast<int>(ds.device()->pos());
+	if (static_cast<qint64>(offset) + length != file.size())
+		return false;
+
+	const QByteArray payload = QByteArray::fromRawData(file.constData() + offset, static_cast<int>(length));
+	if (QCryptographicHash::hash(payload, QCryptographicHash::Sha1) != QByteArray::fromRawData(digest, sizeof(digest))) {
+		log(QString("Snapshot %1 is corrupt, reading state from the database").arg(path));
+		return false;
+	}
+
+	QDataStream ps(payload);
+	ps.setVersion(QDataStream::Qt_4_6);
+
+	Channel *root = NULL;
+	bool ok = true;
+
+	quint32 channels = 0;
+	ps >> channels;
+	for (quint32 i = 0; ok && (i < channels); ++i) {
+		qint32 id, parent, position;
+		QString name, desc;
+		bool inheritacl;
+		ps >> id >> parent >> name >> inheritacl >> desc >> position;
+
+		Channel *p = qhChannels.value(parent);
+		if ((ps.status() != QDataStream::Ok) || qhChannels.contains(id) || ((parent < 0) ? (root != NULL) : (p == NULL))) {
+			ok = false;
+			break;
+		}
+
+		Channel *c = new Channel(id, name, p);
+		if (! p) {
+			c->setParent(this);
+			root = c;
+		}
+		qhChannels.insert(c->iId, c);
+		c->bInheritACL = inheritacl;
+		c->iPosition = position;
+		hashAssign(c->qsDesc, c->qbaDescHash, desc);
+
+		quint32 groups = 0;
+		ps >> groups;
+		for (quint32 j = 0; (j < groups) && (ps.status() == QDataStream::Ok); ++j) {
+			QString gname;
+			bool inherit, inheritable;
+			QSet<int> add, remove;
+			ps >> gname >> inherit >> inheritable >> add >> remove;
+
+			Group *g = new Group(c, gname);
+			g->bInherit = inherit;
+			g->bInheritable = inheritable;
+			g->qsAdd = add;
+			g->qsRemove = remove;
+		}
+
+		quint32 acls = 0;
+		ps >> acls;
+		for (quint32 j = 0; (j < acls) && (ps.status() == QDataStream::Ok); ++j) {
+			qint32 userid, allow, deny;
+			QString group;
+			bool here, subs;
+			ps >> userid >> group >> here >> subs >> allow >> deny;
+
+			ChanACL *acl = new ChanACL(c);
+			acl->iUserId = userid;
+			acl->setGroup(group);
+			acl->bApplyHere = here;
+			acl->bApplySubs = subs;
+			acl->pAllow = static_cast<ChanACL::Permissions>(allow);
+			acl->pDeny = static_cast<ChanACL::Permissions>(deny);
+		}
+	}
+
+	quint32 links = 0;
+	ps >> links;
+	for (quint32 i = 0; ok && (i < links); ++i) {
+		qint32 cid, lid;
+		ps >> cid >> lid;
+		Channel *c = qhChannels.value(cid);
+		Channel *l = qhChannels.value(lid);
+		if (c && l)
+			c->link(l);
+	}
+
+	quint32 bans = 0;
+	ps >> bans;
+	for (quint32 i = 0; ok && (i < bans) && (ps.status() == QDataStream::Ok); ++i) {
+		QByteArray address;
+		qint32 mask;
+		Ban ban;
+		ps >> address >> mask >> ban.qsUsername >> ban.qsHash >> ban.qsReason >> ban.qdtStart >> ban.iDuration;
+		ban.haAddress = address;
+		ban.iMask = mask;
+		ban.qdtStart.setTimeSpec(Qt::UTC);
+		if (ban.isValid())
+			qlBans << ban;
+	}
+
+	if (! ok || ! root || (ps.status() != QDataStream::Ok) || ! ps.atEnd()) {
+		log(QString("Snapshot %1 is malformed, reading state from the database").arg(path));
+		delete root;
+		qhChannels.clear();
+		qlBans.clear();
+		return false;
+	}
+
+	btBans.rebuild(qlBans);
+	return true;
+}
+
+void Server::writeSnapshot() {
+	bSnapshotDirty = false;
+
+	const QString path = snapshotPath();
+	Channel *root = qhChannels.value(0);
+	if (path.isEmpty() || ! root)
+		return;
+
+	if (! uiSnapshotGeneration)
+		uiSnapshotGeneration = ServerDB::bumpSnapshotGeneration(iServerNum);
+
+	// Parents always precede their children, so the loader can build the
+	// tree in a single pass.
+	QList<Channel *> channels;
+	channels << root;
+	for (int i = 0; i < channels.count(); ++i)
+		foreach(Channel *c, channels.at(i)->qlChannels)
+			if (! c->bTemporary)
+				channels << c;
+
+	QByteArray payload;
+	{
+		QDataStream ps(&payload, QIODevice::WriteOnly);
+		ps.setVersion(QDataStream::Qt_4_6);
+
+		QList<QPair<int, int> > links;
+
+		ps << static_cast<quint32>(channels.count());
+		foreach(Channel *c, channels) {
+			ps << static_cast<qint32>(c->iId) << static_cast<qint32>(c->cParent ? c->cParent->iId : -1) << c->qsName << c->bInheritACL << c->qsDesc << static_cast<qint32>(c->iPosition);
+
+			ps << static_cast<quint32>(c->qhGroups.count());
+			foreach(Group *g, c->qhGroups)
+				ps << g->qsName << g->bInherit << g->bInheritable << g->qsAdd << g->qsRemove;
+
+			ps << static_cast<quint32>(c->qlACL.count());
+			foreach(ChanACL *acl, c->qlACL)
+				ps << static_cast<qint32>(acl->iUserId) << acl->group() << acl->bApplyHere << acl->bApplySubs << static_cast<qint32>(acl->pAllow) << static_cast<qint32>(acl->pDeny);
+
+			// Links are symmetric; store each pair once.
+			foreach(Channel *l, c->qsPermLinks)
+				if ((c->iId < l->iId) && ! l->bTemporary)
+					links << qMakePair(c->iId, l->iId);
+		}
+
+		ps << static_cast<quint32>(links.count());
+		typedef QPair<int, int> Link;
+		foreach(const Link &l, links)
+			ps << static_cast<qint32>(l.first) << static_cast<qint32>(l.second);
+
+		ps << static_cast<quint32>(qlBans.count());
+		foreach(const Ban &ban, qlBans)
+			ps << ban.haAddress.toByteArray() << static_cast<qint32>(ban.iMask) << ban.qsUsername << ban.qsHash << ban.qsReason << ban.qdtStart << ban.iDuration;
+	}
+
+	QByteArray header;
+	{
+		QDataStream ds(&header, QIODevice::WriteOnly);
+		ds.setVersion(QDataStream::Qt_4_6);
+		ds << uiSnapshotMagic << uiSnapshotVersion << static_cast<qint32>(iServerNum) << uiSnapshotGeneration << static_cast<quint32>(payload.size());
+		const QByteArray digest = QCryptographicHash::hash(payload, QCryptographicHash::Sha1);
+		ds.writeRawData(digest.constData(), digest.size());
+	}
+
+	const QString tmp = path + QLatin1String(".tmp");
+	QFile f(tmp);
+	if (! f.open(QIODevice::WriteOnly | QIODevice::Truncate) || (f.write(header) != header.size()) || (f.write(payload) != payload.size()) || ! f.flush()) {
+		log(QString("Failed to write snapshot %1: %2").arg(tmp).arg(f.errorString()));
+		f.close();
+		QFile::remove(tmp);
+		return;
+	}
+	f.close();
+
+	QFile::remove(path);
+	if (! QFile::rename(tmp, path))
+		log(QString("Failed to replace snapshot %1").arg(path));
+}
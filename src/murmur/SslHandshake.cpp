@@ -0,0 +1,207 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "murmur_pch.h"
+
+#include "SslHandshake.h"
+
+HandshakeWorker::HandshakeWorker(HandshakePool *pool, QObject *p) : QObject(p), hpPool(pool) {
+	qtTimeout = new QTimer(this);
+	connect(qtTimeout, SIGNAL(timeout()), this, SLOT(checkTimeout()));
+}
+
+/**
+ * Decides whether the handshake may go on despite \p errors. Problems that only
+ * mean the client certificate can't be trusted clear \p verified; anything else
+ * is fatal and described in \p error.
+ */
+bool HandshakeWorker::acceptErrors(const QList<QSslError> &errors, bool &verified, QString &error) {
+	foreach(const QSslError &e, errors) {
+		switch (e.error()) {
+			case QSslError::InvalidPurpose:
+				// Allow email certificates.
+				break;
+			case QSslError::NoPeerCertificate:
+			case QSslError::SelfSignedCertificate:
+			case QSslError::SelfSignedCertificateInChain:
+			case QSslError::UnableToGetLocalIssuerCertificate:
+			case QSslError::HostNameMismatch:
+			case QSslError::CertificateNotYetValid:
+			case QSslError::CertificateExpired:
+				verified = false;
+				break;
+			default:
+				error = QString("SSL Error: %1").arg(e.errorString());
+				return false;
+		}
+	}
+	return true;
+}
+
+void HandshakeWorker::handshake(QSslSocket *sock, int id, int timeout) {
+	Pending p;
+	p.iId = id;
+	p.qsPeer = QString("%1:%2").arg(sock->peerAddress().toString()).arg(sock->peerPort());
+	p.bVerified = true;
+	p.iTimeout = timeout;
+	qhPending.insert(sock, p);
+
+	sock->setParent(this);
+	connect(sock, SIGNAL(sslErrors(const QList<QSslError> &)), this, SLOT(sslErrors(const QList<QSslError> &)));
+	connect(sock, SIGNAL(encrypted()), this, SLOT(encrypted()));
+	connect(sock, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(error(QAbstractSocket::SocketError)));
+	connect(sock, SIGNAL(disconnected()), this, SLOT(disconnected()));
+
+	if (! qtTimeout->isActive())
+		qtTimeout->start(1000);
+
+	sock->startServerEncryption();
+}
+
+void HandshakeWorker::sslErrors(const QList<QSslError> &errors) {
+	QSslSocket *sock = qobject_cast<QSslSocket *>(sender());
+	if (! sock || ! qhPending.contains(sock))
+		return;
+
+	QString err;
+	if (acceptErrors(errors, qhPending[sock].bVerified, err))
+		sock->ignoreSslErrors();
+	else
+		fail(sock, err);
+}
+
+void HandshakeWorker::encrypted() {
+	QSslSocket *sock = qobject_cast<QSslSocket *>(sender());
+	if (! sock || ! qhPending.contains(sock))
+		return;
+
+	// The socket is still inside its own signal emission; hand it over once that has unwound.
+	disconnect(sock, NULL, this, NULL);
+	QMetaObject::invokeMethod(this, "release", Qt::QueuedConnection, Q_ARG(QSslSocket *, sock));
+}
+
+void HandshakeWorker::error(QAbstractSocket::SocketError) {
+	QSslSocket *sock = qobject_cast<QSslSocket *>(sender());
+	if (sock && qhPending.contains(sock))
+		fail(sock, sock->errorString());
+}
+
+void HandshakeWorker::disconnected() {
+	QSslSocket *sock = qobject_cast<QSslSocket *>(sender());
+	if (sock && qhPending.contains(sock))
+		fail(sock, QLatin1String("Disconnected during handshake"));
+}
+
+void HandshakeWorker::release(QSslSocket *sock) {
+	const Pending p = qhPending.take(sock);
+	if (qhPending.isEmpty())
+		qtTimeout->stop();
+
+	sock->setParent(NULL);
+	sock->moveToThread(hpPool->thread());
+	QMetaObject::invokeMethod(hpPool, "finished", Qt::QueuedConnection, Q_ARG(QSslSocket *, sock), Q_ARG(int, p.iId), Q_ARG(bool, p.bVerified), Q_ARG(QString, p.qsPeer), Q_ARG(QString, QString()));
+}
+
+void HandshakeWorker::fail(QSslSocket *sock, const QString &err) {
+	const Pending p = qhPending.take(sock);
+	if (qhPending.isEmpty())
+		qtTimeout->stop();
+
+	disconnect(sock, NULL, this, NULL);
+	sock->abort();
+	sock->deleteLater();
+
+	QMetaObject::invokeMethod(hpPool, "finished", Qt::QueuedConnection, Q_ARG(QSslSocket *, static_cast<QSslSocket *>(NULL)), Q_ARG(int, p.iId), Q_ARG(bool, false), Q_ARG(QString, p.qsPeer), Q_ARG(QString, err));
+}
+
+void HandshakeWorker::checkTimeout() {
+	QList<QSslSocket *> qlExpired;
+	QHash<QSslSocket *, Pending>::const_iterator i;
+	for (i = qhPending.constBegin(); i != qhPending.constEnd(); ++i)
+		if (i.value().tStarted.elapsed() > static_cast<quint64>(i.value().iTimeout) * 1000000ULL)
+			qlExpired << i.key();
+
+	foreach(QSslSocket *sock, qlExpired)
+		fail(sock, QLatin1String("Timeout during handshake"));
+}
+
+HandshakePool::HandshakePool(int threads, QObject *p) : QObject(p) {
+	qRegisterMetaType<QSslSocket *>("QSslSocket *");
+
+	iNext = 0;
+	iSerial = 0;
+	for (int i = 0; i < threads; ++i) {
+		QThread *t = new QThread(this);
+		HandshakeWorker *w = new HandshakeWorker(this);
+		w->moveToThread(t);
+		connect(t, SIGNAL(finished()), w, SLOT(deleteLater()));
+		t->start();
+
+		qlThreads << t;
+		qlWorkers << w;
+	}
+
+	if (qlWorkers.isEmpty())
+		qlWorkers << new HandshakeWorker(this, this);
+}
+
+HandshakePool::~HandshakePool() {
+	foreach(QThread *t, qlThreads) {
+		t->quit();
+		t->wait();
+	}
+}
+
+void HandshakePool::start(QSslSocket *sock, QObject *receiver, int timeout) {
+	HandshakeWorker *w = qlWorkers.at(iNext);
+	iNext = (iNext + 1) % qlWorkers.count();
+
+	const int id = ++iSerial;
+	qhReceivers.insert(id, receiver);
+
+	sock->setParent(NULL);
+	sock->moveToThread(w->thread());
+	QMetaObject::invokeMethod(w, "handshake", Qt::QueuedConnection, Q_ARG(QSslSocket *, sock), Q_ARG(int, id), Q_ARG(int, timeout));
+}
+
+void HandshakePool::finished(QSslSocket *sock, int id, bool verified, const QString &peer, const QString &error) {
+	QPointer<QObject> receiver = qhReceivers.take(id);
+
+	if (! receiver) {
+		// The server went away during the handshake.
+		if (sock) {
+			sock->abort();
+			sock->deleteLater();
+		}
+		return;
+	}
+
+	QMetaObject::invokeMethod(receiver, "sslHandshake", Qt::DirectConnection, Q_ARG(QSslSocket *, sock), Q_ARG(bool, verified), Q_ARG(QString, peer), Q_ARG(QString, error));
+}
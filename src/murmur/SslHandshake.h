@@ -0,0 +1,116 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MURMUR_SSLHANDSHAKE_H_
+#define MUMBLE_MURMUR_SSLHANDSHAKE_H_
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QObject>
+#include <QtCore/QPointer>
+#include <QtCore/QThread>
+#include <QtNetwork/QSslError>
+#include <QtNetwork/QSslSocket>
+
+#include "Timer.h"
+
+class QTimer;
+class HandshakePool;
+
+/**
+ * Runs TLS server handshakes for the sockets handed to it by its HandshakePool.
+ *
+ * Once a handshake completes the socket is moved back to the pool's thread and
+ * reported through HandshakePool::finished(). Failed handshakes are cleaned up
+ * here and reported with a NULL socket, so the receiver can log them.
+ */
+class HandshakeWorker : public QObject {
+	private:
+		Q_OBJECT
+		Q_DISABLE_COPY(HandshakeWorker)
+	protected:
+		struct Pending {
+			int iId;
+			QString qsPeer;
+			bool bVerified;
+			int iTimeout;
+			Timer tStarted;
+		};
+		HandshakePool *hpPool;
+		QHash<QSslSocket *, Pending> qhPending;
+		QTimer *qtTimeout;
+
+		void fail(QSslSocket *, const QString &error);
+	protected slots:
+		void sslErrors(const QList<QSslError> &);
+		void encrypted();
+		void error(QAbstractSocket::SocketError);
+		void disconnected();
+		void release(QSslSocket *);
+		void checkTimeout();
+	public slots:
+		void handshake(QSslSocket *, int id, int timeout);
+	public:
+		HandshakeWorker(HandshakePool *pool, QObject *p = NULL);
+
+		static bool acceptErrors(const QList<QSslError> &, bool &verified, QString &error);
+};
+
+/**
+ * Spreads TLS handshakes of incoming connections over a few worker threads, so
+ * the private key operations of a reconnect storm don't hold up the control
+ * traffic of the users already connected. Without threads, the handshakes run
+ * in the caller's thread just as before.
+ *
+ * Results are handed to the receiver's sslHandshake(QSslSocket *, bool verified,
+ * QString peer, QString error) slot from the pool's thread, which receivers must
+ * live in. The pool holds the socket until then, so a receiver deleted while its
+ * handshake was running doesn't leak it.
+ */
+class HandshakePool : public QObject {
+	private:
+		Q_OBJECT
+		Q_DISABLE_COPY(HandshakePool)
+	protected:
+		QList<QThread *> qlThreads;
+		QList<HandshakeWorker *> qlWorkers;
+		QHash<int, QPointer<QObject> > qhReceivers;
+		int iNext;
+		int iSerial;
+	public slots:
+		void finished(QSslSocket *, int id, bool verified, const QString &peer, const QString &error);
+	public:
+		HandshakePool(int threads, QObject *p = NULL);
+		~HandshakePool();
+		/// Takes ownership of the unparented \p sock and starts the server handshake.
+		void start(QSslSocket *sock, QObject *receiver, int timeout);
+};
+
+#endif
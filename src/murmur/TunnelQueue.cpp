@@ -0,0 +1,161 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "murmur_pch.h"
+
+#include "TunnelQueue.h"
+
+#include "Message.h"
+
+// Framing header of a UDPTunnel message; 16-bit type and 32-bit length.
+#define TUNNEL_HEADER 6
+// Type bytes marking the unused end of the ring before a wrap.
+#define TUNNEL_PAD 0xff
+
+static inline unsigned int loadAcquire(const QAtomicInt &v) {
+#if QT_VERSION >= 0x050000
+	return static_cast<unsigned int>(v.loadAcquire());
+#else
+	return static_cast<unsigned int>(const_cast<QAtomicInt &>(v).fetchAndAddAcquire(0));
+#endif
+}
+
+static inline void storeRelease(QAtomicInt &v, unsigned int value) {
+#if QT_VERSION >= 0x050000
+	v.storeRelease(static_cast<int>(value));
+#else
+	v.fetchAndStoreRelease(static_cast<int>(value));
+#endif
+}
+
+static inline TunnelQueue::Ring *loadRing(const QAtomicPointer<TunnelQueue::Ring> &p) {
+#if QT_VERSION >= 0x050000
+	return p.loadAcquire();
+#else
+	return const_cast<QAtomicPointer<TunnelQueue::Ring> &>(p).fetchAndAddAcquire(0);
+#endif
+}
+
+TunnelQueue::Ring::Ring() : qaiHead(0), qaiTail(0) {
+}
+
+bool TunnelQueue::Ring::push(const char *data, unsigned int len) {
+	const unsigned int need = len + TUNNEL_HEADER;
+	const unsigned int head = loadAcquire(qaiHead);
+	unsigned int tail = static_cast<unsigned int>(loadAcquire(qaiTail));
+	unsigned int offset = tail & (uiSize - 1);
+	const unsigned int contiguous = uiSize - offset;
+
+	// Records never wrap; if this one doesn't fit before the end, skip the rest.
+	unsigned int skip = (need > contiguous) ? contiguous : 0;
+	if ((tail - head) + skip + need > uiSize)
+		return false;
+
+	if (skip) {
+		if (skip >= TUNNEL_HEADER)
+			cBuffer[offset] = cBuffer[offset + 1] = static_cast<char>(TUNNEL_PAD);
+		tail += skip;
+		offset = 0;
+	}
+
+	unsigned char *uc = reinterpret_cast<unsigned char *>(cBuffer + offset);
+	uc[0] = static_cast<unsigned char>(MessageHandler::UDPTunnel >> 8);
+	uc[1] = static_cast<unsigned char>(MessageHandler::UDPTunnel & 0xff);
+	uc[2] = static_cast<unsigned char>(len >> 24);
+	uc[3] = static_cast<unsigned char>((len >> 16) & 0xff);
+	uc[4] = static_cast<unsigned char>((len >> 8) & 0xff);
+	uc[5] = static_cast<unsigned char>(len & 0xff);
+	memcpy(uc + TUNNEL_HEADER, data, len);
+
+	storeRelease(qaiTail, tail + need);
+	return true;
+}
+
+int TunnelQueue::Ring::drain(QIODevice *dev) {
+	const unsigned int tail = loadAcquire(qaiTail);
+	unsigned int head = static_cast<unsigned int>(loadAcquire(qaiHead));
+	int packets = 0;
+
+	while (head != tail) {
+		const unsigned int offset = head & (uiSize - 1);
+		const unsigned int contiguous = uiSize - offset;
+		const unsigned char *uc = reinterpret_cast<const unsigned char *>(cBuffer + offset);
+
+		if ((contiguous < TUNNEL_HEADER) || ((uc[0] == TUNNEL_PAD) && (uc[1] == TUNNEL_PAD))) {
+			head += contiguous;
+			continue;
+		}
+
+		const unsigned int len = (static_cast<unsigned int>(uc[2]) << 24) | (static_cast<unsigned int>(uc[3]) << 16) | (static_cast<unsigned int>(uc[4]) << 8) | static_cast<unsigned int>(uc[5]);
+		dev->write(reinterpret_cast<const char *>(uc), len + TUNNEL_HEADER);
+		head += len + TUNNEL_HEADER;
+		++packets;
+	}
+
+	storeRelease(qaiHead, head);
+	return packets;
+}
+
+TunnelQueue::TunnelQueue(int producers) : iProducers(producers) {
+	qapRings = new QAtomicPointer<Ring>[iProducers];
+}
+
+TunnelQueue::~TunnelQueue() {
+	for (int i = 0; i < iProducers; ++i)
+		delete loadRing(qapRings[i]);
+	delete [] qapRings;
+}
+
+bool TunnelQueue::push(int producer, const char *data, unsigned int len) {
+	if ((producer < 0) || (producer >= iProducers) || (len + TUNNEL_HEADER > Ring::uiSize / 4))
+		return false;
+
+	// Only this producer ever stores to its slot, so there is no race to allocate it.
+	Ring *r = loadRing(qapRings[producer]);
+	if (! r) {
+		r = new Ring();
+#if QT_VERSION >= 0x050000
+		qapRings[producer].storeRelease(r);
+#else
+		qapRings[producer].fetchAndStoreRelease(r);
+#endif
+	}
+	return r->push(data, len);
+}
+
+int TunnelQueue::drain(QIODevice *dev) {
+	int packets = 0;
+	for (int i = 0; i < iProducers; ++i) {
+		Ring *r = loadRing(qapRings[i]);
+		if (r)
+			packets += r->drain(dev);
+	}
+	return packets;
+}
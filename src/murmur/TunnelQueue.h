@@ -0,0 +1,85 @@
+/* Copyright (C) 2005-2011, Thorvald Natvig <thorvald@natvig.com>
+
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright notice,
+     this list of conditions and the following disclaimer.
+   - Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+   - Neither the name of the Mumble Developers nor the names of its
+     contributors may be used to endorse or promote products derived from this
+     software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MUMBLE_MURMUR_TUNNELQUEUE_H_
+#define MUMBLE_MURMUR_TUNNELQUEUE_H_
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QAtomicPointer>
+
+class QIODevice;
+
+/**
+ * Voice for a client that gets it tunnelled over TCP.
+ *
+ * Each thread producing voice for the client (the voice threads and the main
+ * thread) has its own single-producer single-consumer byte ring, so pushing
+ * a packet never takes a lock. Packets are stored with their UDPTunnel framing
+ * header already in place, and the socket owner writes them straight from the
+ * ring to the socket. Rings are only allocated once a producer actually has
+ * something to send.
+ */
+class TunnelQueue {
+	private:
+		Q_DISABLE_COPY(TunnelQueue)
+	public:
+		class Ring {
+			private:
+				Q_DISABLE_COPY(Ring)
+			public:
+				/// Must be a power of two.
+				static const unsigned int uiSize = 16384;
+
+				Ring();
+				/// Producer side. Returns false if the ring is full.
+				bool push(const char *data, unsigned int len);
+				/// Consumer side. Returns the number of packets written.
+				int drain(QIODevice *);
+			protected:
+				QAtomicInt qaiHead;
+				char cPadHead[64 - sizeof(QAtomicInt)];
+				QAtomicInt qaiTail;
+				char cPadTail[64 - sizeof(QAtomicInt)];
+				char cBuffer[uiSize];
+		};
+
+		TunnelQueue(int producers);
+		~TunnelQueue();
+
+		/// Queues a voice packet. Each producer must use its own index.
+		bool push(int producer, const char *data, unsigned int len);
+		/// Writes everything queued to the device. Must only be called from one thread.
+		int drain(QIODevice *);
+	protected:
+		int iProducers;
+		QAtomicPointer<Ring> *qapRings;
+};
+
+#endif
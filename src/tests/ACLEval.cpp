@@ -0,0 +1,142 @@
+/**
+ * Benchmark of a full ACL cache rebuild (every user in every channel, as
+ * after Server::clearACLCache()), and of group evaluation from the raw
+ * group string against the compiled GroupPredicate.
+ */
+
+#include <QtCore>
+#include <QtNetwork>
+
+#include "ACL.h"
+#include "Channel.h"
+#include "Group.h"
+#include "ServerUser.h"
+#include "Timer.h"
+
+#define USERS 1000
+#define CHANNELS 500
+#define ROUNDS 5
+
+static const char *groupSpecs[] = {
+	"admin", "~admin", "!auth", "in", "~out", "sub,0,1", "~sub,1", "#opkey", "!#opkey", "$0123456789abcdef", "strong", "all"
+};
+
+class ACLEval {
+	public:
+		Channel *cRoot;
+		QList<Channel *> qlChannels;
+		QList<ServerUser *> qlUsers;
+		quint64 uiGranted;
+
+		ACLEval();
+		~ACLEval();
+		quint64 rebuild();
+		quint64 evaluate(bool compiled, int &matches);
+};
+
+ACLEval::ACLEval() {
+	uiGranted = 0;
+
+	cRoot = new Channel(0, QLatin1String("Root"));
+	qlChannels << cRoot;
+
+	ChanACL *acl = new ChanACL(cRoot);
+	acl->setGroup(QLatin1String("admin"));
+	acl->pAllow = ChanACL::Write;
+	acl = new ChanACL(cRoot);
+	acl->setGroup(QLatin1String("auth"));
+	acl->pAllow = ChanACL::MakeTempChannel;
+	acl = new ChanACL(cRoot);
+	acl->setGroup(QLatin1String("all"));
+	acl->bApplySubs = false;
+	acl->pAllow = ChanACL::SelfRegister;
+
+	Group *g = new Group(cRoot, QLatin1String("admin"));
+	for (int i = 1; i < USERS; i += 50)
+		g->qsAdd << i;
+
+	// A tree of roughly logarithmic depth, with a couple of ACLs on every channel.
+	for (int i = 1; i < CHANNELS; ++i) {
+		Channel *c = new Channel(i, QString::fromLatin1("Channel %1").arg(i), qlChannels.at((i - 1) / 4));
+		qlChannels << c;
+
+		acl = new ChanACL(c);
+		acl->setGroup(QLatin1String(groupSpecs[i % (sizeof(groupSpecs) / sizeof(groupSpecs[0]))]));
+		acl->pAllow = ChanACL::Speak | ChanACL::Enter;
+		acl = new ChanACL(c);
+		acl->setGroup(QLatin1String(groupSpecs[(i * 7) % (sizeof(groupSpecs) / sizeof(groupSpecs[0]))]));
+		acl->pDeny = ChanACL::Speak;
+
+		if ((i % 10) == 0) {
+			g = new Group(c, QLatin1String("admin"));
+			g->qsAdd << i;
+			g->qsRemove << (i + 1);
+		}
+	}
+
+	for (int i = 0; i < USERS; ++i) {
+		ServerUser *u = new ServerUser(NULL, new QSslSocket());
+		u->uiSession = i + 1;
+		u->iId = (i % 3) ? i + 1 : -1;
+		u->bVerified = (i % 2);
+		if ((i % 5) == 0)
+			u->qslAccessTokens << QLatin1String("OpKey");
+		qlChannels.at((i * 13) % CHANNELS)->addUser(u);
+		qlUsers << u;
+	}
+}
+
+ACLEval::~ACLEval() {
+	qDeleteAll(qlUsers);
+	delete cRoot;
+}
+
+quint64 ACLEval::rebuild() {
+	ChanACL::ACLCache cache;
+
+	Timer t;
+	foreach(ServerUser *u, qlUsers)
+		foreach(Channel *c, qlChannels)
+			uiGranted += ChanACL::effectivePermissions(u, c, &cache);
+	quint64 elapsed = t.elapsed();
+
+	qDeleteAll(cache);
+	return elapsed;
+}
+
+quint64 ACLEval::evaluate(bool compiled, int &matches) {
+	matches = 0;
+
+	Timer t;
+	foreach(ServerUser *u, qlUsers) {
+		foreach(Channel *c, qlChannels) {
+			foreach(ChanACL *acl, c->qlACL) {
+				if (compiled ? Group::isMember(c, c, acl->groupPredicate(), u) : Group::isMember(c, c, acl->group(), u))
+					++matches;
+			}
+		}
+	}
+	return t.elapsed();
+}
+
+int main(int argc, char **argv) {
+	QCoreApplication a(argc, argv);
+
+	ACLEval bench;
+
+	for (int i = 0; i < ROUNDS; ++i) {
+		quint64 usec = bench.rebuild();
+		qWarning("Full cache rebuild, %d users x %d channels: %8.2f ms", USERS, CHANNELS, static_cast<double>(usec) / 1000.0);
+	}
+
+	for (int i = 0; i < ROUNDS; ++i) {
+		int smatch, cmatch;
+		quint64 susec = bench.evaluate(false, smatch);
+		quint64 cusec = bench.evaluate(true, cmatch);
+		if (smatch != cmatch)
+			qFatal("Group string and predicate disagree: %d != %d", smatch, cmatch);
+		qWarning("Group evaluation: string %8.2f ms, predicate %8.2f ms (%d matches)", static_cast<double>(susec) / 1000.0, static_cast<double>(cusec) / 1000.0, cmatch);
+	}
+
+	return 0;
+}
@@ -0,0 +1,18 @@
+include(../mumble.pri)
+
+TEMPLATE = app
+CONFIG *= qt thread warn_on network qtestlib
+CONFIG -= app_bundle
+QT *= network
+LANGUAGE = C++
+TARGET = ACLEval
+DEFINES *= MURMUR
+SOURCES *= ACLEval.cpp ServerUser.cpp TunnelQueue.cpp
+HEADERS *= ServerUser.h TunnelQueue.h
+VPATH *= .. ../murmur
+INCLUDEPATH *= .. ../murmur ../mumble
+QMAKE_CXXFLAGS += -O3
+LIBS *= -lprotobuf
+!win32 {
+	LIBS *= -lcrypto -lssl
+}
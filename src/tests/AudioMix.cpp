@@ -0,0 +1,117 @@
+/**
+ * Mixes N speakers into M output channels the way AudioOutput::mix does,
+ * once with the old strided loops into the interleaved buffer and once
+ * into planes with AudioKernels followed by a single interleave. Each case
+ * runs with constant gains and with every gain ramping, as it does while
+ * positional sources move.
+ */
+
+#include <QtCore>
+
+#include "AudioKernels.h"
+#include "Timer.h"
+
+#define ITER 2000
+#define FRAME 480
+
+static void mixStrided(float *output, float * const *sources, const float *gains, const float *ramps, unsigned int nsources, unsigned int nchan) {
+	memset(output, 0, sizeof(float) * FRAME * nchan);
+	for (unsigned int k = 0; k < nsources; ++k) {
+		for (unsigned int s = 0; s < nchan; ++s) {
+			const float str = gains[k * nchan + s];
+			float * RESTRICT o = output + s;
+			const float * RESTRICT pfBuffer = sources[k];
+			if (ramps) {
+				const float inc = ramps[k * nchan + s];
+				for (unsigned int i = 0; i < FRAME; ++i)
+					o[i * nchan] += pfBuffer[i] * (str + inc * static_cast<float>(i));
+			} else {
+				for (unsigned int i = 0; i < FRAME; ++i)
+					o[i * nchan] += pfBuffer[i] * str;
+			}
+		}
+	}
+	AudioKernels::clip(output, FRAME * nchan);
+}
+
+static void mixPlanar(float *output, float *planes, float * const *sources, const float *gains, const float *ramps, unsigned int nsources, unsigned int nchan) {
+	memset(planes, 0, sizeof(float) * FRAME * nchan);
+	for (unsigned int s = 0; s < nchan; ++s)
+		for (unsigned int k = 0; k < nsources; ++k)
+			if (ramps)
+				AudioKernels::mixRamp(planes + s * FRAME, sources[k], gains[k * nchan + s], ramps[k * nchan + s], FRAME);
+			else
+				AudioKernels::mixAdd(planes + s * FRAME, sources[k], gains[k * nchan + s], FRAME);
+	AudioKernels::interleave(output, planes, nchan, FRAME);
+	AudioKernels::clip(output, FRAME * nchan);
+}
+
+int main(int argc, char **argv) {
+	QCoreApplication a(argc, argv);
+
+	const unsigned int speakers[] = { 1, 8, 32, 64 };
+	const unsigned int channels[] = { 1, 2, 6 };
+	const unsigned int maxsources = 64;
+	const unsigned int maxchan = 6;
+
+	float *sources[maxsources];
+	float gains[maxsources * maxchan];
+	float ramps[maxsources * maxchan];
+	for (unsigned int k = 0; k < maxsources; ++k) {
+		sources[k] = new float[FRAME];
+		for (unsigned int i = 0; i < FRAME; ++i)
+			sources[k][i] = sinf(static_cast<float>(i * (k + 1)) * 0.001f) * 0.1f;
+	}
+	for (unsigned int i = 0; i < maxsources * maxchan; ++i) {
+		gains[i] = 0.5f + static_cast<float>(i % 7) * 0.05f;
+		// Towards the gain of the neighbouring slot over one frame
+		ramps[i] = (static_cast<float>((i + 1) % 7) - static_cast<float>(i % 7)) * 0.05f / static_cast<float>(FRAME);
+	}
+
+	float *ref = new float[FRAME * maxchan];
+	float *output = new float[FRAME * maxchan];
+	float *planes = new float[FRAME * maxchan];
+
+	for (unsigned int c = 0; c < sizeof(channels) / sizeof(channels[0]); ++c) {
+		for (unsigned int n = 0; n < sizeof(speakers) / sizeof(speakers[0]); ++n) {
+			const unsigned int nchan = channels[c];
+			const unsigned int nsources = speakers[n];
+			Timer t;
+
+			t.restart();
+			for (int i = 0; i < ITER; ++i)
+				mixStrided(ref, sources, gains, NULL, nsources, nchan);
+			const quint64 strided = t.restart();
+
+			for (int i = 0; i < ITER; ++i)
+				mixPlanar(output, planes, sources, gains, NULL, nsources, nchan);
+			const quint64 planar = t.restart();
+
+			bool same = (memcmp(ref, output, sizeof(float) * FRAME * nchan) == 0);
+
+			t.restart();
+			for (int i = 0; i < ITER; ++i)
+				mixStrided(ref, sources, gains, ramps, nsources, nchan);
+			const quint64 rampStrided = t.restart();
+
+			for (int i = 0; i < ITER; ++i)
+				mixPlanar(output, planes, sources, gains, ramps, nsources, nchan);
+			const quint64 rampPlanar = t.restart();
+
+			same = same && (memcmp(ref, output, sizeof(float) * FRAME * nchan) == 0);
+
+			// us per 10 ms frame
+			qWarning("%2u speakers x %u channels: strided %6.1f  planar %6.1f  ramped: strided %6.1f  planar %6.1f %s", nsources, nchan,
+			         static_cast<double>(strided) / ITER, static_cast<double>(planar) / ITER,
+			         static_cast<double>(rampStrided) / ITER, static_cast<double>(rampPlanar) / ITER, same ? "" : "MISMATCH");
+		}
+	}
+
+	for (unsigned int k = 0; k < maxsources; ++k)
+		delete [] sources[k];
+	delete [] ref;
+	delete [] output;
+	delete [] planes;
+
+	return 0;
+}
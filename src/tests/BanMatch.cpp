@@ -0,0 +1,100 @@
+/**
+ * Benchmark of the per connection ban check in Server::newClient; a linear
+ * HostAddress::match() scan over the ban list against the BanTrie, with a
+ * blocklist sized like an imported set of CIDRs.
+ */
+
+#include <QtCore>
+#include <QtNetwork>
+
+#include "BanTrie.h"
+#include "Net.h"
+#include "Timer.h"
+
+#define BANS 100000
+#define ITER 200000
+
+static HostAddress randomAddress(bool v6) {
+	Q_IPV6ADDR addr;
+	memset(&addr, 0, sizeof(addr));
+	if (v6) {
+		addr[0] = 0x20;
+		addr[1] = 0x01;
+		for (int i = 2; i < 16; ++i)
+			addr[i] = static_cast<quint8>(qrand());
+	} else {
+		addr[10] = 0xff;
+		addr[11] = 0xff;
+		for (int i = 12; i < 16; ++i)
+			addr[i] = static_cast<quint8>(qrand());
+	}
+	return HostAddress(addr);
+}
+
+int main(int argc, char **argv) {
+	QCoreApplication a(argc, argv);
+
+	qsrand(1);
+
+	QList<Ban> bans;
+	for (int i = 0; i < BANS; ++i) {
+		Ban b;
+		const bool v6 = (i % 10) == 0;
+		b.haAddress = randomAddress(v6);
+		// Mostly /16 to /32 IPv4 ranges, some /32 to /64 IPv6 ones.
+		b.iMask = v6 ? (32 + qrand() % 33) : (96 + 16 + qrand() % 17);
+		b.qdtStart = QDateTime::currentDateTime().toUTC();
+		b.iDuration = (i % 3) ? 0 : 3600;
+		bans << b;
+	}
+
+	QVector<HostAddress> qvAddress;
+	for (int i = 0; i < ITER; ++i) {
+		if ((i % 4) == 0) {
+			// A quarter of the lookups hit a banned range.
+			qvAddress.append(bans.at(qrand() % BANS).haAddress);
+		} else {
+			qvAddress.append(randomAddress((i % 10) == 1));
+		}
+	}
+
+	Timer t;
+	BanTrie bt;
+	bt.rebuild(bans);
+	quint64 elapsed = t.elapsed();
+	qWarning("BanTrie build: %8lld usec for %d bans, %d nodes", elapsed, BANS, bt.nodes());
+
+	const quint64 now = BanTrie::now();
+	int trieHits = 0;
+	t.restart();
+	for (int i = 0; i < ITER; ++i)
+		if (bt.match(qvAddress.at(i), now))
+			++trieHits;
+	elapsed = t.elapsed();
+	qWarning("BanTrie      : %8lld usec, %.3f usec/lookup", elapsed, static_cast<double>(elapsed) / ITER);
+
+	// The linear scan is slow enough that a fraction of the lookups suffices.
+	const int linearIter = ITER / 100;
+	int linearHits = 0;
+	t.restart();
+	for (int i = 0; i < linearIter; ++i) {
+		const HostAddress &ha = qvAddress.at(i);
+		foreach(const Ban &ban, bans) {
+			if (ban.haAddress.match(ha, ban.iMask)) {
+				++linearHits;
+				break;
+			}
+		}
+	}
+	elapsed = t.elapsed();
+	qWarning("Linear scan  : %8lld usec, %.3f usec/lookup", elapsed, static_cast<double>(elapsed) / linearIter);
+
+	int check = 0;
+	for (int i = 0; i < linearIter; ++i)
+		if (bt.match(qvAddress.at(i), now))
+			++check;
+	if (check != linearHits)
+		qFatal("BanTrie found %d bans, linear scan %d", check, linearHits);
+
+	qWarning("%d of %d connections banned", trieHits, ITER);
+}
@@ -0,0 +1,11 @@
+TEMPLATE = app
+CONFIG  += qt thread warn_on network qtestlib
+CONFIG -= app_bundle
+QT += network
+LANGUAGE = C++
+TARGET = BanMatch
+SOURCES = BanMatch.cpp BanTrie.cpp Net.cpp Timer.cpp
+HEADERS = BanTrie.h Net.h Timer.h
+VPATH += .. ../murmur
+INCLUDEPATH += .. ../murmur ../mumble
+QMAKE_CXXFLAGS += -O3
@@ -0,0 +1,139 @@
+/**
+ * Benchmark of the startup work Meta::bootAll() does for many virtual
+ * servers; reading the configuration key by key against one bulk query,
+ * and parsing the server keys one after the other against on the thread pool.
+ */
+
+#include <QtCore>
+#include <QtNetwork>
+#include <QtSql>
+
+#include <openssl/bn.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+
+#include "Timer.h"
+
+#define SERVERS 300
+#define KEYS 40
+
+static QByteArray generateKey() {
+	RSA *rsa = RSA_new();
+	BIGNUM *e = BN_new();
+	BN_set_word(e, RSA_F4);
+	RSA_generate_key_ex(rsa, 2048, e, NULL);
+
+	BIO *mem = BIO_new(BIO_s_mem());
+	PEM_write_bio_RSAPrivateKey(mem, rsa, NULL, NULL, 0, NULL, NULL);
+	char *data = NULL;
+	long len = BIO_get_mem_data(mem, &data);
+	QByteArray qba(data, static_cast<int>(len));
+
+	BIO_free(mem);
+	BN_free(e);
+	RSA_free(rsa);
+	return qba;
+}
+
+class KeyParser : public QRunnable {
+	public:
+		const QByteArray qbaKey;
+		QSslKey qskKey;
+
+		KeyParser(const QByteArray &key) : qbaKey(key) {
+			setAutoDelete(false);
+		}
+
+		void run() {
+			qskKey = QSslKey(qbaKey, QSsl::Rsa, QSsl::Pem, QSsl::PrivateKey);
+		}
+};
+
+int main(int argc, char **argv) {
+	QCoreApplication a(argc, argv);
+
+	QSqlDatabase db = QSqlDatabase::addDatabase(QLatin1String("QSQLITE"));
+	db.setDatabaseName(QLatin1String(":memory:"));
+	if (! db.open())
+		qFatal("Failed to open database");
+
+	QSqlQuery query;
+	query.exec(QLatin1String("CREATE TABLE config (server_id INTEGER, key TEXT, value TEXT)"));
+	query.exec(QLatin1String("CREATE UNIQUE INDEX config_key ON config(server_id, key)"));
+
+	QStringList keys;
+	for (int k = 0; k < KEYS; ++k)
+		keys << QString::fromLatin1("key%1").arg(k);
+
+	// Every server sets a few keys; the rest fall back to the defaults.
+	db.transaction();
+	query.prepare(QLatin1String("INSERT INTO config (server_id, key, value) VALUES (?,?,?)"));
+	for (int s = 1; s <= SERVERS; ++s) {
+		for (int k = 0; k < KEYS; k += 4) {
+			query.addBindValue(s);
+			query.addBindValue(keys.at(k));
+			query.addBindValue(QString::number(s * k));
+			query.exec();
+		}
+	}
+	db.commit();
+
+	Timer t;
+	qint64 sum = 0;
+	query.prepare(QLatin1String("SELECT value FROM config WHERE server_id = ? AND key = ?"));
+	for (int s = 1; s <= SERVERS; ++s) {
+		foreach(const QString &key, keys) {
+			query.addBindValue(s);
+			query.addBindValue(key);
+			query.exec();
+			if (query.next())
+				sum += query.value(0).toInt();
+		}
+	}
+	quint64 elapsed = t.elapsed();
+	qWarning("Config, one query per key: %8lld usec (%lld)", elapsed, sum);
+
+	t.restart();
+	QHash<int, QHash<QString, QVariant> > cache;
+	query.exec(QLatin1String("SELECT server_id, key, value FROM config"));
+	while (query.next())
+		cache[query.value(0).toInt()].insert(query.value(1).toString(), query.value(2));
+	sum = 0;
+	for (int s = 1; s <= SERVERS; ++s) {
+		const QHash<QString, QVariant> &conf = cache[s];
+		foreach(const QString &key, keys)
+			sum += conf.value(key, 0).toInt();
+	}
+	elapsed = t.elapsed();
+	qWarning("Config, bulk query       : %8lld usec (%lld)", elapsed, sum);
+
+	QList<QByteArray> pem;
+	for (int i = 0; i < 8; ++i)
+		pem << generateKey();
+
+	t.restart();
+	for (int s = 0; s < SERVERS; ++s) {
+		QSslKey key(pem.at(s % pem.count()), QSsl::Rsa, QSsl::Pem, QSsl::PrivateKey);
+		if (key.isNull())
+			qFatal("Failed to parse key");
+	}
+	elapsed = t.elapsed();
+	qWarning("Keys, serial             : %8lld usec", elapsed);
+
+	QList<KeyParser *> parsers;
+	t.restart();
+	for (int s = 0; s < SERVERS; ++s) {
+		KeyParser *kp = new KeyParser(pem.at(s % pem.count()));
+		parsers << kp;
+		QThreadPool::globalInstance()->start(kp);
+	}
+	QThreadPool::globalInstance()->waitForDone();
+	elapsed = t.elapsed();
+	qWarning("Keys, %2d threads         : %8lld usec", QThreadPool::globalInstance()->maxThreadCount(), elapsed);
+
+	foreach(KeyParser *kp, parsers) {
+		if (kp->qskKey.isNull())
+			qFatal("Failed to parse key");
+		delete kp;
+	}
+}
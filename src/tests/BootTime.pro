@@ -0,0 +1,12 @@
+TEMPLATE = app
+CONFIG  += qt thread warn_on network sql
+CONFIG -= app_bundle
+QT += network sql
+LANGUAGE = C++
+TARGET = BootTime
+SOURCES = BootTime.cpp Timer.cpp
+HEADERS = Timer.h
+VPATH += ..
+INCLUDEPATH += .. ../murmur ../mumble
+LIBS *= -lcrypto
+QMAKE_CXXFLAGS += -O3
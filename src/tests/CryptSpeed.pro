@@ -0,0 +1,12 @@
+TEMPLATE = app
+CONFIG *= qt thread warn_on network
+CONFIG -= app_bundle
+QT *= network
+LANGUAGE = C++
+TARGET = CryptSpeed
+SOURCES *= CryptSpeed.cpp CryptState.cpp Timer.cpp
+HEADERS *= CryptState.h Timer.h
+VPATH *= ..
+INCLUDEPATH *= .. ../murmur ../mumble
+LIBS *= -lcrypto
+QMAKE_CXXFLAGS *= -O3
@@ -0,0 +1,184 @@
+/**
+ * Benchmark of voice fan-out from one speaker to 1, 10 and 100 listeners
+ * over loopback; encrypting and building a msghdr per datagram with one
+ * sendmsg() each, against encrypting into a send ring with per-listener
+ * msghdr templates and a single sendmmsg(). Linux only.
+ */
+
+#include <QtCore>
+#include <QtNetwork>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "CryptState.h"
+#include "Net.h"
+#include "Timer.h"
+
+#define ITER 20000
+#define PAYLOAD 120
+#define MAX_FANOUT 100
+
+struct Listener {
+	int sock;
+	struct sockaddr_storage addr;
+	struct sockaddr_storage local;
+	CryptState cs;
+	struct msghdr mh;
+	u_char control[CMSG_SPACE(sizeof(struct in_pktinfo))];
+};
+
+struct Slot {
+	struct sockaddr_storage addr;
+	char buffer[PAYLOAD + 8];
+	struct iovec iov;
+	u_char control[CMSG_SPACE(sizeof(struct in_pktinfo))];
+};
+
+static void buildSource(struct msghdr *msg, const struct sockaddr_storage &local) {
+	msg->msg_controllen = CMSG_SPACE(sizeof(struct in_pktinfo));
+	memset(msg->msg_control, 0, msg->msg_controllen);
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
+	HostAddress ha(local);
+	cmsg->cmsg_level = IPPROTO_IP;
+	cmsg->cmsg_type = IP_PKTINFO;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+	struct in_pktinfo *pktinfo = reinterpret_cast<struct in_pktinfo *>(CMSG_DATA(cmsg));
+	pktinfo->ipi_spec_dst.s_addr = ha.hash[3];
+}
+
+class FanOut {
+	public:
+		int sock;
+		Listener *listeners;
+		Slot *slots;
+		struct mmsghdr *msgs;
+		unsigned char plain[PAYLOAD];
+
+		FanOut() {
+			struct sockaddr_in sin;
+			memset(&sin, 0, sizeof(sin));
+			sin.sin_family = AF_INET;
+			sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+			sock = ::socket(AF_INET, SOCK_DGRAM, 0);
+			::bind(sock, reinterpret_cast<struct sockaddr *>(&sin), sizeof(sin));
+
+			listeners = new Listener[MAX_FANOUT];
+			for (int i=0;i<MAX_FANOUT;i++) {
+				Listener &l = listeners[i];
+				socklen_t len = sizeof(l.addr);
+				l.sock = ::socket(AF_INET, SOCK_DGRAM, 0);
+				::bind(l.sock, reinterpret_cast<struct sockaddr *>(&sin), sizeof(sin));
+				::getsockname(l.sock, reinterpret_cast<struct sockaddr *>(&l.addr), &len);
+				memcpy(&l.local, &l.addr, sizeof(l.local));
+				l.cs.genKey();
+
+				memset(&l.mh, 0, sizeof(l.mh));
+				l.mh.msg_name = &l.addr;
+				l.mh.msg_namelen = sizeof(struct sockaddr_in);
+				l.mh.msg_control = l.control;
+				buildSource(&l.mh, l.local);
+			}
+
+			slots = new Slot[MAX_FANOUT];
+			msgs = new struct mmsghdr[MAX_FANOUT];
+			memset(msgs, 0, sizeof(struct mmsghdr) * MAX_FANOUT);
+			for (int i=0;i<MAX_FANOUT;i++) {
+				slots[i].iov.iov_base = slots[i].buffer + 4;
+				msgs[i].msg_hdr.msg_name = &slots[i].addr;
+				msgs[i].msg_hdr.msg_iov = &slots[i].iov;
+				msgs[i].msg_hdr.msg_iovlen = 1;
+				msgs[i].msg_hdr.msg_control = slots[i].control;
+			}
+
+			for (int i=0;i<PAYLOAD;i++)
+				plain[i] = static_cast<unsigned char>(i);
+		}
+
+		~FanOut() {
+			for (int i=0;i<MAX_FANOUT;i++)
+				::close(listeners[i].sock);
+			::close(sock);
+			delete [] listeners;
+			delete [] slots;
+			delete [] msgs;
+		}
+
+		quint64 perPacket(int fanout) {
+			Timer t;
+			t.restart();
+			for (int i=0;i<ITER;i++) {
+				for (int j=0;j<fanout;j++) {
+					Listener &l = listeners[j];
+					char buffer[PAYLOAD + 4];
+					l.cs.encrypt(plain, reinterpret_cast<unsigned char *>(buffer), PAYLOAD);
+
+					struct msghdr msg;
+					struct iovec iov[1];
+					u_char controldata[CMSG_SPACE(sizeof(struct in_pktinfo))];
+
+					iov[0].iov_base = buffer;
+					iov[0].iov_len = PAYLOAD + 4;
+
+					memset(&msg, 0, sizeof(msg));
+					msg.msg_name = &l.addr;
+					msg.msg_namelen = sizeof(struct sockaddr_in);
+					msg.msg_iov = iov;
+					msg.msg_iovlen = 1;
+					msg.msg_control = controldata;
+					buildSource(&msg, l.local);
+
+					::sendmsg(sock, &msg, 0);
+				}
+			}
+			return t.elapsed();
+		}
+
+		quint64 ring(int fanout) {
+			Timer t;
+			t.restart();
+			for (int i=0;i<ITER;i++) {
+				for (int j=0;j<fanout;j++) {
+					Listener &l = listeners[j];
+					Slot &s = slots[j];
+					struct msghdr &msg = msgs[j].msg_hdr;
+
+					msg.msg_namelen = l.mh.msg_namelen;
+					memcpy(&s.addr, &l.addr, msg.msg_namelen);
+					msg.msg_controllen = l.mh.msg_controllen;
+					memcpy(s.control, l.control, msg.msg_controllen);
+					l.cs.encrypt(plain, reinterpret_cast<unsigned char *>(s.iov.iov_base), PAYLOAD);
+					s.iov.iov_len = PAYLOAD + 4;
+				}
+				int sent = 0;
+				while (sent < fanout) {
+					int ret = ::sendmmsg(sock, msgs + sent, fanout - sent, 0);
+					sent += (ret > 0) ? ret : 1;
+				}
+			}
+			return t.elapsed();
+		}
+};
+
+int main(int argc, char **argv) {
+	QCoreApplication a(argc, argv);
+
+	FanOut fo;
+	const int fanouts[] = { 1, 10, 100 };
+
+	for (unsigned int i=0;i<sizeof(fanouts)/sizeof(fanouts[0]);i++) {
+		int fanout = fanouts[i];
+		quint64 packets = static_cast<quint64>(ITER) * fanout;
+
+		quint64 elapsed = fo.perPacket(fanout);
+		qWarning("1->%3d sendmsg : %8lld pps", fanout, packets * 1000000ULL / qMax<quint64>(elapsed, 1));
+
+		elapsed = fo.ring(fanout);
+		qWarning("1->%3d sendmmsg: %8lld pps", fanout, packets * 1000000ULL / qMax<quint64>(elapsed, 1));
+	}
+}
@@ -0,0 +1,18 @@
+# sendmmsg() is Linux only; elsewhere this project builds nothing.
+linux* {
+	TEMPLATE = app
+	CONFIG *= qt thread warn_on network xml sql
+	CONFIG -= app_bundle
+	QT *= network xml sql
+	LANGUAGE = C++
+	TARGET = FanOut
+	SOURCES *= FanOut.cpp CryptState.cpp Net.cpp Timer.cpp
+	HEADERS *= CryptState.h Net.h Timer.h
+	VPATH *= ..
+	INCLUDEPATH *= .. ../murmur ../mumble
+	LIBS *= -lcrypto
+	QMAKE_CXXFLAGS *= -O3
+} else {
+	TEMPLATE = subdirs
+	message(FanOut benchmarks sendmmsg() and is only built on Linux)
+}
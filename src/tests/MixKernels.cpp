@@ -0,0 +1,91 @@
+/**
+ * Compares the scalar, SSE2 and AVX2 versions of the audio conversion
+ * and downmix kernels on 10 ms frames.
+ */
+
+#include <QtCore>
+
+#include "AudioKernels.h"
+#include "Timer.h"
+
+#define ITER 20000
+#define FRAME 480
+#define SURROUND 6
+
+static const char *names[] = { "scalar", "SSE2", "AVX2" };
+
+int main(int argc, char **argv) {
+	QCoreApplication a(argc, argv);
+
+	float *pfStereo = new float[FRAME * 2];
+	short *psStereo = new short[FRAME * 2];
+	float *pfSurround = new float[FRAME * SURROUND];
+	short *psSurround = new short[FRAME * SURROUND];
+	float *pfOut = new float[FRAME * 2];
+	short *psOut = new short[FRAME * 2];
+
+	for (int i = 0; i < FRAME * 2; ++i) {
+		pfStereo[i] = sinf(static_cast<float>(i) * 0.01f) * 1.2f;
+		psStereo[i] = static_cast<short>(pfStereo[i] * 20000.f);
+	}
+
+	for (int i = 0; i < FRAME * SURROUND; ++i) {
+		pfSurround[i] = sinf(static_cast<float>(i) * 0.003f);
+		psSurround[i] = static_cast<short>(pfSurround[i] * 20000.f);
+	}
+
+	qWarning("Best supported: %s", names[AudioKernels::detect()]);
+
+	for (int l = AudioKernels::Scalar; l <= AudioKernels::detect(); ++l) {
+		AudioKernels::setLevel(static_cast<AudioKernels::Level>(l));
+		AudioKernels::MixerFunc mixFloat = AudioKernels::mixer(2, true);
+		AudioKernels::MixerFunc mixShort = AudioKernels::mixer(2, false);
+		AudioKernels::MixerFunc mixFloatN = AudioKernels::mixer(SURROUND, true);
+		AudioKernels::MixerFunc mixShortN = AudioKernels::mixer(SURROUND, false);
+		Timer t;
+
+		t.restart();
+		for (int i = 0; i < ITER; ++i)
+			mixFloat(pfOut, pfStereo, FRAME, 2);
+		const quint64 mf = t.restart();
+
+		for (int i = 0; i < ITER; ++i)
+			mixShort(pfOut, psStereo, FRAME, 2);
+		const quint64 ms = t.restart();
+
+		for (int i = 0; i < ITER; ++i)
+			mixFloatN(pfOut, pfSurround, FRAME, SURROUND);
+		const quint64 mfn = t.restart();
+
+		for (int i = 0; i < ITER; ++i)
+			mixShortN(pfOut, psSurround, FRAME, SURROUND);
+		const quint64 msn = t.restart();
+
+		for (int i = 0; i < ITER; ++i)
+			AudioKernels::shortToFloat(pfOut, psStereo, FRAME * 2);
+		const quint64 sf = t.restart();
+
+		for (int i = 0; i < ITER; ++i)
+			AudioKernels::floatToShort(psOut, pfStereo, FRAME * 2);
+		const quint64 fs = t.restart();
+
+		for (int i = 0; i < ITER; ++i) {
+			memcpy(pfOut, pfStereo, FRAME * 2 * sizeof(float));
+			AudioKernels::clip(pfOut, FRAME * 2);
+		}
+		const quint64 cl = t.restart();
+
+		// ns per frame
+		qWarning("%-6s stereo float mix %5llu  stereo short mix %5llu  5.1 float mix %5llu  5.1 short mix %5llu  short->float %5llu  float->short %5llu  clip %5llu",
+		         names[l], mf * 1000ULL / ITER, ms * 1000ULL / ITER, mfn * 1000ULL / ITER, msn * 1000ULL / ITER, sf * 1000ULL / ITER, fs * 1000ULL / ITER, cl * 1000ULL / ITER);
+	}
+
+	delete [] pfStereo;
+	delete [] psStereo;
+	delete [] pfSurround;
+	delete [] psSurround;
+	delete [] pfOut;
+	delete [] psOut;
+
+	return 0;
+}
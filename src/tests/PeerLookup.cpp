@@ -0,0 +1,110 @@
+/**
+ * Benchmark of UDP peer lookup in the voice thread; a QReadWriteLock
+ * protected QHash (the old qhPeerUsers) against the lock-free PeerTable.
+ */
+
+#include <QtCore>
+#include <QtNetwork>
+
+#include "Net.h"
+#include "PeerTable.h"
+#include "Timer.h"
+
+#define PEERS 1000
+#define ITER 10000000
+
+typedef QPair<HostAddress, quint16> PeerKey;
+
+static HostAddress peerAddress(int i) {
+	Q_IPV6ADDR addr;
+	memset(&addr, 0, sizeof(addr));
+	addr[10] = 0xff;
+	addr[11] = 0xff;
+	addr[12] = 10;
+	addr[13] = static_cast<quint8>(i >> 16);
+	addr[14] = static_cast<quint8>(i >> 8);
+	addr[15] = static_cast<quint8>(i);
+	return HostAddress(addr);
+}
+
+static ServerUser *fakeUser(int i) {
+	return reinterpret_cast<ServerUser *>(static_cast<quintptr>(i + 1) * 64);
+}
+
+class HashLookup {
+	public:
+		QReadWriteLock qrwl;
+		QHash<PeerKey, ServerUser *> qh;
+
+		void add(const HostAddress &ha, quint16 port, ServerUser *u) {
+			QWriteLocker lock(&qrwl);
+			qh.insert(PeerKey(ha, port), u);
+		}
+
+		ServerUser *lookup(const HostAddress &ha, quint16 port) {
+			QReadLocker lock(&qrwl);
+			return qh.value(PeerKey(ha, port));
+		}
+};
+
+class TableLookup {
+	public:
+		PeerTable pt;
+
+		void add(const HostAddress &ha, quint16 port, ServerUser *u) {
+			pt.addHost(u, ha);
+			pt.bind(u, ha, port);
+		}
+
+		ServerUser *lookup(const HostAddress &ha, quint16 port) {
+			PeerTable::ReadGuard pg(&pt, 0);
+			return pg.peer(ha, port);
+		}
+};
+
+template<class T>
+class SpeedTest {
+	public:
+		T &table;
+		QVector<HostAddress> qvAddress;
+
+		SpeedTest(T &t) : table(t) {
+			for (int i=0;i<PEERS;i++) {
+				qvAddress.append(peerAddress(i));
+				table.add(qvAddress.at(i), static_cast<quint16>(50000 + i), fakeUser(i));
+			}
+		}
+
+		quint64 test() {
+			Timer t;
+			quint64 found = 0;
+			t.restart();
+			for (int i=0;i<ITER;i++) {
+				int idx = i % PEERS;
+				if (table.lookup(qvAddress.at(idx), static_cast<quint16>(50000 + idx)))
+					++found;
+			}
+			quint64 elapsed = t.elapsed();
+			if (found != ITER)
+				qFatal("Lookup missed %lld peers", ITER - found);
+			return elapsed;
+		}
+};
+
+int main(int argc, char **argv) {
+	QCoreApplication a(argc, argv);
+
+	HashLookup hl;
+	TableLookup tl;
+
+	SpeedTest<HashLookup> sthl(hl);
+	SpeedTest<TableLookup> sttl(tl);
+
+	quint64 elapsed;
+
+	elapsed = sthl.test();
+	qWarning("QHash+QReadWriteLock: %8lld", elapsed);
+
+	elapsed = sttl.test();
+	qWarning("PeerTable           : %8lld", elapsed);
+}
@@ -0,0 +1,11 @@
+TEMPLATE = app
+CONFIG  += qt thread warn_on network xml qtestlib sql
+CONFIG -= app_bundle
+QT += xml sql network
+LANGUAGE = C++
+TARGET = PeerLookup
+SOURCES = PeerLookup.cpp PeerTable.cpp Net.cpp Timer.cpp
+HEADERS = PeerTable.h Net.h Timer.h
+VPATH += .. ../murmur
+INCLUDEPATH += .. ../murmur ../mumble
+QMAKE_CXXFLAGS += -O3
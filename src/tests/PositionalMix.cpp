@@ -0,0 +1,156 @@
+/**
+ * A 64 player game on stereo output: times one mix callback without
+ * positional audio, with the gains worked out from scratch for every
+ * source each callback, and with the gains cached until a source moves.
+ */
+
+#include <QtCore>
+
+#include "AudioKernels.h"
+#include "Timer.h"
+
+#define ITER 2000
+#define FRAME 480
+#define SOURCES 64
+#define CHANNELS 2
+
+static const float fSpeakers[CHANNELS * 3] = { -1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f };
+
+// AudioOutput::calcGain() with the default settings
+static float calcGain(float dotproduct, float distance) {
+	const float bloom = 0.5f, mindist = 1.0f, maxdist = 15.0f, maxvol = 0.25f;
+	const float dotfactor = (dotproduct + 1.0f) / 2.0f;
+
+	if (distance < mindist)
+		return qMin(1.0f, bloom * (1.0f - distance / mindist) + dotfactor);
+
+	float datt = maxvol;
+	if (distance < maxdist)
+		datt = powf(10.0f, log10f(maxvol) * (distance - mindist) / (maxdist - mindist));
+	return datt * dotfactor;
+}
+
+// Listener basis and speaker rotation of AudioOutput::mix
+static void rotateSpeakers(float *speaker, const float *camfront, const float *camtop) {
+	float front[3] = { camfront[0], camfront[1], camfront[2] };
+	float top[3] = { camtop[0], camtop[1], camtop[2] };
+	const float flen = sqrtf(front[0]*front[0]+front[1]*front[1]+front[2]*front[2]);
+	const float tlen = sqrtf(top[0]*top[0]+top[1]*top[1]+top[2]*top[2]);
+	for (int i = 0; i < 3; ++i) {
+		front[i] /= flen;
+		top[i] /= tlen;
+	}
+	if (fabsf(front[0] * top[0] + front[1] * top[1] + front[2] * top[2]) > 0.01f) {
+		const float azimuth = atan2f(front[2], front[0]);
+		const float inclination = acosf(front[1]) - static_cast<float>(M_PI) / 2.0f;
+		top[0] = sinf(inclination)*cosf(azimuth);
+		top[1] = cosf(inclination);
+		top[2] = sinf(inclination)*sinf(azimuth);
+	}
+	const float right[3] = {top[1]*front[2] - top[2]*front[1], top[2]*front[0] - top[0]*front[2], top[0]*front[1] - top[1] * front[0] };
+	for (unsigned int i = 0; i < CHANNELS; ++i)
+		for (int j = 0; j < 3; ++j)
+			speaker[3*i+j] = fSpeakers[3*i+0] * right[j] + fSpeakers[3*i+1] * top[j] + fSpeakers[3*i+2] * front[j];
+}
+
+struct Source {
+	float *pfBuffer;
+	float fPos[3];
+	float fVolume[CHANNELS];
+	float fGain[CHANNELS];
+	float fGainPos[3];
+	bool bGainValid;
+};
+
+static void sourceGains(float *gains, const Source &src, const float *speaker, const float *campos) {
+	float dir[3] = { src.fPos[0] - campos[0], src.fPos[1] - campos[1], src.fPos[2] - campos[2] };
+	const float len = sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+	for (int i = 0; i < 3; ++i)
+		dir[i] /= len;
+	for (unsigned int s = 0; s < CHANNELS; ++s)
+		gains[s] = calcGain(dir[0] * speaker[s*3+0] + dir[1] * speaker[s*3+1] + dir[2] * speaker[s*3+2], len);
+}
+
+static void mixSource(float *planes, Source &src, const float *gains) {
+	for (unsigned int s = 0; s < CHANNELS; ++s) {
+		const float old = src.fVolume[s];
+		src.fVolume[s] = gains[s];
+		if (gains[s] != old)
+			AudioKernels::mixRamp(planes + s * FRAME, src.pfBuffer, old, (gains[s] - old) / FRAME, FRAME);
+		else
+			AudioKernels::mixAdd(planes + s * FRAME, src.pfBuffer, old, FRAME);
+	}
+}
+
+int main(int argc, char **argv) {
+	QCoreApplication a(argc, argv);
+
+	static float planes[FRAME * CHANNELS];
+	static float output[FRAME * CHANNELS];
+	Source sources[SOURCES];
+	const float campos[3] = { 0.0f, 1.7f, 0.0f };
+	const float camfront[3] = { 0.3f, -0.1f, 0.9f };
+	const float camtop[3] = { 0.0f, 1.0f, 0.0f };
+
+	for (int k = 0; k < SOURCES; ++k) {
+		sources[k].pfBuffer = new float[FRAME];
+		for (int i = 0; i < FRAME; ++i)
+			sources[k].pfBuffer[i] = sinf(static_cast<float>(i * (k + 1)) * 0.001f) * 0.1f;
+	}
+
+	for (int mode = 0; mode < 3; ++mode) {
+		for (int k = 0; k < SOURCES; ++k) {
+			sources[k].fPos[0] = static_cast<float>(k % 8) * 2.0f - 7.0f;
+			sources[k].fPos[1] = 1.7f;
+			sources[k].fPos[2] = static_cast<float>(k / 8) * 2.0f + 0.5f;
+			sources[k].bGainValid = false;
+			for (int s = 0; s < CHANNELS; ++s)
+				sources[k].fVolume[s] = 0.5f;
+		}
+
+		float speaker[CHANNELS * 3];
+		Timer t;
+
+		for (int iter = 0; iter < ITER; ++iter) {
+			// Each player moves every fourth callback, a quarter of them at a time
+			for (int k = iter % 4; k < SOURCES; k += 4)
+				sources[k].fPos[0] += 0.01f;
+
+			memset(planes, 0, sizeof(planes));
+			if (mode == 0) {
+				const float gains[CHANNELS] = { 0.5f, 0.5f };
+				for (int k = 0; k < SOURCES; ++k)
+					mixSource(planes, sources[k], gains);
+			} else if (mode == 1) {
+				rotateSpeakers(speaker, camfront, camtop);
+				for (int k = 0; k < SOURCES; ++k) {
+					float gains[CHANNELS];
+					sourceGains(gains, sources[k], speaker, campos);
+					mixSource(planes, sources[k], gains);
+				}
+			} else {
+				if (iter == 0)
+					rotateSpeakers(speaker, camfront, camtop);
+				for (int k = 0; k < SOURCES; ++k) {
+					Source &src = sources[k];
+					if (! src.bGainValid || (memcmp(src.fGainPos, src.fPos, sizeof(src.fPos)) != 0)) {
+						sourceGains(src.fGain, src, speaker, campos);
+						memcpy(src.fGainPos, src.fPos, sizeof(src.fPos));
+						src.bGainValid = true;
+					}
+					mixSource(planes, src, src.fGain);
+				}
+			}
+			AudioKernels::interleave(output, planes, CHANNELS, FRAME);
+			AudioKernels::clip(output, FRAME * CHANNELS);
+		}
+
+		static const char *names[] = { "non-positional", "positional", "positional, cached gains" };
+		qWarning("%-26s %6.1f us per callback", names[mode], static_cast<double>(t.elapsed()) / ITER);
+	}
+
+	for (int k = 0; k < SOURCES; ++k)
+		delete [] sources[k].pfBuffer;
+
+	return 0;
+}
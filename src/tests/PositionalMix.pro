@@ -0,0 +1,11 @@
+include(../../compiler.pri)
+TEMPLATE = app
+CONFIG += qt thread warn_on release console
+CONFIG -= app_bundle
+LANGUAGE = C++
+TARGET = PositionalMix
+SOURCES = PositionalMix.cpp AudioKernels.cpp Timer.cpp
+HEADERS = AudioKernels.h Timer.h
+VPATH += ..
+INCLUDEPATH += .. ../murmur ../mumble
+QMAKE_CXXFLAGS += -O3
@@ -0,0 +1,100 @@
+#include <QtCore>
+#include <QtTest>
+
+#include "BlobStore.h"
+
+class TestBlobStore : public QObject {
+		Q_OBJECT
+	private slots:
+		void refcount();
+		void shared();
+		void eviction();
+		void referencedStays();
+};
+
+static QByteArray hash(int i) {
+	return QCryptographicHash::hash(QByteArray::number(i), QCryptographicHash::Sha1);
+}
+
+static QByteArray texture(char c) {
+	return QByteArray(1000, c);
+}
+
+void TestBlobStore::refcount() {
+	BlobStore bs;
+
+	bs.acquire(hash(1), texture('a'));
+	bs.acquire(hash(1), texture('a'));
+	QCOMPARE(bs.count(), 1);
+	QCOMPARE(bs.idleBytes(), 0);
+
+	bs.release(hash(1), BlobStore::Texture);
+	QCOMPARE(bs.idleBytes(), 0);
+
+	bs.release(hash(1), BlobStore::Texture);
+	QCOMPARE(bs.idleBytes(), 1000);
+	QCOMPARE(bs.count(), 1);
+
+	// Releasing an idle or unknown blob does nothing
+	bs.release(hash(1), BlobStore::Texture);
+	bs.release(hash(2), BlobStore::Texture);
+	QCOMPARE(bs.idleBytes(), 1000);
+
+	// Taking it again moves it off the idle list
+	bs.acquire(hash(1), texture('a'));
+	QCOMPARE(bs.idleBytes(), 0);
+}
+
+void TestBlobStore::shared() {
+	BlobStore bs;
+
+	const QByteArray first = bs.acquire(hash(1), texture('a'));
+	const QByteArray second = bs.acquire(hash(1), QByteArray(texture('a')));
+	QCOMPARE(first.constData(), second.constData());
+
+	// Textures and comments with the same hash are separate entries
+	bs.acquire(hash(1), QString::fromLatin1("comment"));
+	QCOMPARE(bs.count(), 2);
+}
+
+void TestBlobStore::eviction() {
+	BlobStore bs;
+	bs.setLimit(2500);
+
+	bs.insert(hash(1), texture('a'));
+	bs.insert(hash(2), texture('b'));
+	bs.insert(hash(3), texture('c'));
+
+	// Over the limit, so the least recently used one goes
+	QVERIFY(bs.texture(hash(1)).isNull());
+	QCOMPARE(bs.count(), 2);
+	QCOMPARE(bs.idleBytes(), 2000);
+
+	// Using 2 makes 3 the oldest
+	QCOMPARE(bs.texture(hash(2)), texture('b'));
+	bs.insert(hash(4), texture('d'));
+	QVERIFY(bs.texture(hash(3)).isNull());
+	QCOMPARE(bs.texture(hash(2)), texture('b'));
+	QCOMPARE(bs.texture(hash(4)), texture('d'));
+
+	bs.setLimit(0);
+	QCOMPARE(bs.count(), 0);
+	QCOMPARE(bs.idleBytes(), 0);
+}
+
+void TestBlobStore::referencedStays() {
+	BlobStore bs;
+	bs.setLimit(0);
+
+	bs.acquire(hash(1), texture('a'));
+	QCOMPARE(bs.texture(hash(1)), texture('a'));
+	QVERIFY(! bs.field(hash(1), BlobStore::Texture).isEmpty());
+	QCOMPARE(bs.count(), 1);
+
+	bs.release(hash(1), BlobStore::Texture);
+	QCOMPARE(bs.count(), 0);
+	QVERIFY(bs.texture(hash(1)).isNull());
+}
+
+QTEST_MAIN(TestBlobStore)
+#include "TestBlobStore.moc"
@@ -0,0 +1,20 @@
+TEMPLATE = app
+CONFIG += qt thread warn_on qtestlib
+CONFIG -= app_bundle
+QT += network sql xml
+LANGUAGE = C++
+TARGET = TestBlobStore
+HEADERS = BlobStore.h Message.h
+SOURCES = TestBlobStore.cpp BlobStore.cpp
+PROTOBUF = ../Mumble.proto
+VPATH += .. ../murmur
+INCLUDEPATH += .. ../murmur
+LIBS += -lprotobuf
+
+pb.output = ${QMAKE_FILE_BASE}.pb.cc
+pb.commands = protoc --cpp_out=. -I. -I.. ${QMAKE_FILE_NAME}
+pb.input = PROTOBUF
+pb.CONFIG *= no_link target_predeps
+pb.variable_out = SOURCES
+
+QMAKE_EXTRA_COMPILERS *= pb
@@ -12,6 +12,7 @@ class TestCrypt : public QObject {
 		void ivrecovery();
 		void reverserecovery();
 		void tamper();
+		void accelerated();
 };
 
 void TestCrypt::reverserecovery() {
@@ -202,5 +203,45 @@ void TestCrypt::tamper() {
 	QVERIFY(cs.decrypt(encrypted, decrypted, len+4));
 }
 
+void TestCrypt::accelerated() {
+	if (! CryptState::hasAesNi())
+#if QT_VERSION >= 0x050000
+		QSKIP("CPU lacks AES-NI");
+#else
+		QSKIP("CPU lacks AES-NI", SkipAll);
+#endif
+
+	const unsigned char rawkey[AES_BLOCK_SIZE] = {0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f};
+	const unsigned char nonce[AES_BLOCK_SIZE] = {0xff, 0xee, 0xdd, 0xcc, 0xbb, 0xaa, 0x99, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11, 0x00};
+	CryptState fast, slow;
+	fast.setKey(rawkey, nonce, nonce);
+	slow.setKey(rawkey, nonce, nonce);
+	slow.bAccelerated = false;
+
+	QVERIFY(fast.bAccelerated);
+
+	const int maxlen = 1100;
+	unsigned char src[maxlen];
+	unsigned char fastenc[maxlen], slowenc[maxlen], decrypted[maxlen];
+
+	// Covers partial batches, several batches and every tail length.
+	for (int len=0;len<maxlen;len++) {
+		for (int i=0;i<len;i++)
+			src[i] = (i * 31 + 7);
+
+		unsigned char fasttag[AES_BLOCK_SIZE], slowtag[AES_BLOCK_SIZE], dectag[AES_BLOCK_SIZE];
+
+		fast.ocb_encrypt(src, fastenc, len, nonce, fasttag);
+		slow.ocb_encrypt(src, slowenc, len, nonce, slowtag);
+
+		QVERIFY(memcmp(fasttag, slowtag, AES_BLOCK_SIZE) == 0);
+		QVERIFY(memcmp(fastenc, slowenc, len) == 0);
+
+		fast.ocb_decrypt(slowenc, decrypted, len, nonce, dectag);
+		QVERIFY(memcmp(dectag, slowtag, AES_BLOCK_SIZE) == 0);
+		QVERIFY(memcmp(decrypted, src, len) == 0);
+	}
+}
+
 QTEST_MAIN(TestCrypt)
 #include "TestCrypt.moc"
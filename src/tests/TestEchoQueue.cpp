@@ -0,0 +1,152 @@
+#include <QtCore>
+#include <QtTest>
+
+#include <cstdlib>
+#include <new>
+
+#include "EchoQueue.h"
+
+#if __cplusplus >= 201103L
+#define THROW_BAD_ALLOC
+#define THROW_NOTHING noexcept
+#else
+#define THROW_BAD_ALLOC throw(std::bad_alloc)
+#define THROW_NOTHING throw()
+#endif
+
+// Counts heap allocations made while bCountAllocs is set.
+static bool bCountAllocs = false;
+static QAtomicInt qaiAllocs(0);
+
+static void *countedAlloc(size_t sz) {
+	if (bCountAllocs)
+		qaiAllocs.ref();
+	void *p = malloc(sz ? sz : 1);
+	if (! p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new(size_t sz) THROW_BAD_ALLOC {
+	return countedAlloc(sz);
+}
+
+void *operator new[](size_t sz) THROW_BAD_ALLOC {
+	return countedAlloc(sz);
+}
+
+void operator delete(void *p) THROW_NOTHING {
+	free(p);
+}
+
+void operator delete[](void *p) THROW_NOTHING {
+	free(p);
+}
+
+static int allocs() {
+#if QT_VERSION >= 0x050000
+	return qaiAllocs.load();
+#else
+	return static_cast<int>(qaiAllocs);
+#endif
+}
+
+// 10 ms of 48 kHz stereo, as queued by AudioInput with multichannel echo.
+#define FRAME_SIZE 960
+// Simulated seconds of audio callbacks.
+#define SECONDS 10
+
+class Producer : public QThread {
+	public:
+		EchoQueue *eq;
+		unsigned int uiFrames;
+		Producer(EchoQueue *q, unsigned int frames) : eq(q), uiFrames(frames) {}
+		void run() {
+			for (unsigned int i = 0; i < uiFrames; ++i) {
+				short *frame;
+				while (! (frame = eq->reserve()))
+					yieldCurrentThread();
+				for (int j = 0; j < FRAME_SIZE; ++j)
+					frame[j] = static_cast<short>(i & 0x7fff);
+				eq->commit();
+			}
+		}
+};
+
+class TestEchoQueue : public QObject {
+		Q_OBJECT
+	private slots:
+		void order();
+		void full();
+		void allocations();
+};
+
+void TestEchoQueue::order() {
+	const unsigned int frames = 100000;
+	EchoQueue eq(FRAME_SIZE);
+	Producer p(&eq, frames);
+	p.start();
+
+	bool ok = true;
+	for (unsigned int i = 0; ok && (i < frames); ++i) {
+		while (eq.count() == 0)
+			QThread::yieldCurrentThread();
+		const short *frame = eq.front();
+		for (int j = 0; j < FRAME_SIZE; ++j)
+			ok = ok && (frame[j] == static_cast<short>(i & 0x7fff));
+		eq.pop();
+	}
+	p.wait();
+
+	QVERIFY(ok);
+	QCOMPARE(eq.count(), 0U);
+	QCOMPARE(eq.written(), frames);
+}
+
+void TestEchoQueue::full() {
+	EchoQueue eq(FRAME_SIZE);
+	for (unsigned int i = 0; i < EchoQueue::uiSlots; ++i) {
+		QVERIFY(eq.reserve() != NULL);
+		eq.commit();
+	}
+	QVERIFY(eq.reserve() == NULL);
+	eq.pop();
+	QVERIFY(eq.reserve() != NULL);
+}
+
+void TestEchoQueue::allocations() {
+	// The old path: a new frame per 10 ms, handed over in a QList.
+	QList<short *> ql;
+	ql.reserve(2);
+	qaiAllocs = 0;
+	bCountAllocs = true;
+	for (int i = 0; i < SECONDS * 100; ++i) {
+		short *frame = new short[FRAME_SIZE];
+		frame[0] = 0;
+		ql.append(frame);
+		delete [] ql.takeFirst();
+	}
+	bCountAllocs = false;
+	const int legacy = allocs() / SECONDS;
+
+	EchoQueue eq(FRAME_SIZE);
+	short speaker[FRAME_SIZE];
+	qaiAllocs = 0;
+	bCountAllocs = true;
+	for (int i = 0; i < SECONDS * 100; ++i) {
+		short *frame = eq.reserve();
+		frame[0] = static_cast<short>(i);
+		eq.commit();
+		memcpy(speaker, eq.front(), sizeof(speaker));
+		eq.pop();
+	}
+	bCountAllocs = false;
+	const int queued = allocs() / SECONDS;
+
+	qWarning("Allocations per second: %d with new[], %d with EchoQueue", legacy, queued);
+	QVERIFY(legacy >= 100);
+	QCOMPARE(queued, 0);
+}
+
+QTEST_MAIN(TestEchoQueue)
+#include "TestEchoQueue.moc"
@@ -0,0 +1,9 @@
+TEMPLATE = app
+CONFIG += qt thread warn_on qtestlib
+CONFIG -= app_bundle
+LANGUAGE = C++
+TARGET = TestEchoQueue
+SOURCES = TestEchoQueue.cpp
+HEADERS = EchoQueue.h
+VPATH += ../mumble
+INCLUDEPATH += .. ../mumble
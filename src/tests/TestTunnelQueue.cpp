@@ -0,0 +1,203 @@
+#include <QtCore>
+#include <QtTest>
+
+#include "Message.h"
+#include "TunnelQueue.h"
+
+// Framing header written in front of every packet: 16-bit type, 32-bit length.
+#define HEADER 6
+
+// Packets of the ordering test; lengths vary so records wrap at every offset.
+#define PACKETS 200000
+
+static unsigned int packetLength(unsigned int seq) {
+	return 4 + (seq * 37) % 300;
+}
+
+static void fillPacket(char *data, unsigned int seq) {
+	const unsigned int len = packetLength(seq);
+	data[0] = static_cast<char>(seq >> 24);
+	data[1] = static_cast<char>(seq >> 16);
+	data[2] = static_cast<char>(seq >> 8);
+	data[3] = static_cast<char>(seq);
+	for (unsigned int i = 4; i < len; ++i)
+		data[i] = static_cast<char>(seq + i);
+}
+
+/**
+ * Splits what drain() wrote back into packets and appends their payloads to
+ * \p packets. Returns false if the stream isn't a clean sequence of UDPTunnel
+ * records.
+ */
+static bool parse(const QByteArray &stream, QList<QByteArray> &packets) {
+	const unsigned char *uc = reinterpret_cast<const unsigned char *>(stream.constData());
+	int offset = 0;
+	while (offset < stream.size()) {
+		if (stream.size() - offset < HEADER)
+			return false;
+		const unsigned int type = (uc[offset] << 8) | uc[offset + 1];
+		const unsigned int len = (uc[offset + 2] << 24) | (uc[offset + 3] << 16) | (uc[offset + 4] << 8) | uc[offset + 5];
+		if ((type != MessageHandler::UDPTunnel) || (static_cast<unsigned int>(stream.size() - offset - HEADER) < len))
+			return false;
+		packets << stream.mid(offset + HEADER, len);
+		offset += HEADER + len;
+	}
+	return true;
+}
+
+static int drainInto(TunnelQueue::Ring &r, QList<QByteArray> &packets, bool &ok) {
+	QBuffer buf;
+	buf.open(QIODevice::WriteOnly);
+	const int n = r.drain(&buf);
+	ok = parse(buf.data(), packets) && (packets.count() >= n);
+	return n;
+}
+
+class Producer : public QThread {
+	public:
+		TunnelQueue *tq;
+		Producer(TunnelQueue *q) : tq(q) {}
+		void run() {
+			char data[512];
+			for (unsigned int seq = 0; seq < PACKETS; ++seq) {
+				fillPacket(data, seq);
+				while (! tq->push(0, data, packetLength(seq)))
+					yieldCurrentThread();
+			}
+		}
+};
+
+class TestTunnelQueue : public QObject {
+		Q_OBJECT
+	private:
+		void wrap(unsigned int skip);
+	private slots:
+		void wrapShortGap();
+		void wrapPadded();
+		void full();
+		void order();
+};
+
+/// Leaves \p skip bytes free before the end of the ring, then pushes a packet that doesn't fit there.
+void TestTunnelQueue::wrap(unsigned int skip) {
+	TunnelQueue::Ring r;
+	QList<QByteArray> packets;
+	bool ok;
+
+	const QByteArray first(TunnelQueue::Ring::uiSize - skip - HEADER, 'a');
+	QVERIFY(r.push(first.constData(), first.size()));
+	QCOMPARE(drainInto(r, packets, ok), 1);
+	QVERIFY(ok);
+
+	const QByteArray second(skip + 10, 'b');
+	QVERIFY(r.push(second.constData(), second.size()));
+	const QByteArray third(20, 'c');
+	QVERIFY(r.push(third.constData(), third.size()));
+	QCOMPARE(drainInto(r, packets, ok), 2);
+	QVERIFY(ok);
+
+	QCOMPARE(packets.count(), 3);
+	QVERIFY(packets.at(0) == first);
+	QVERIFY(packets.at(1) == second);
+	QVERIFY(packets.at(2) == third);
+
+	// Nothing is left behind; a second drain writes nothing.
+	QCOMPARE(drainInto(r, packets, ok), 0);
+	QCOMPARE(packets.count(), 3);
+}
+
+void TestTunnelQueue::wrapShortGap() {
+	// Too short for a pad marker; the consumer skips it by size alone.
+	for (unsigned int skip = 1; skip < HEADER; ++skip)
+		wrap(skip);
+}
+
+void TestTunnelQueue::wrapPadded() {
+	wrap(HEADER);
+	wrap(HEADER + 1);
+	wrap(100);
+}
+
+void TestTunnelQueue::full() {
+	TunnelQueue::Ring r;
+	QList<QByteArray> packets;
+	bool ok;
+	const QByteArray data(100, 'x');
+	const int fits = TunnelQueue::Ring::uiSize / (data.size() + HEADER);
+
+	for (int i = 0; i < fits; ++i)
+		QVERIFY(r.push(data.constData(), data.size()));
+	QVERIFY(! r.push(data.constData(), data.size()));
+
+	QCOMPARE(drainInto(r, packets, ok), fits);
+	QVERIFY(ok);
+
+	// Drained space is usable again, including across the wrap.
+	for (int i = 0; i < fits; ++i)
+		QVERIFY(r.push(data.constData(), data.size()));
+	QVERIFY(! r.push(data.constData(), data.size()));
+	QCOMPARE(drainInto(r, packets, ok), fits);
+	QVERIFY(ok);
+	QCOMPARE(packets.count(), 2 * fits);
+
+	// 20 bytes remain before the end of the ring. The next packet fits the
+	// free space only if those bytes are counted, so it has to be refused.
+	TunnelQueue::Ring w;
+	packets.clear();
+	const QByteArray lead(TunnelQueue::Ring::uiSize - 50 - HEADER, 'a');
+	QVERIFY(w.push(lead.constData(), lead.size()));
+	QCOMPARE(drainInto(w, packets, ok), 1);
+	const QByteArray small(30 - HEADER, 'b');
+	QVERIFY(w.push(small.constData(), small.size()));
+	const QByteArray big(TunnelQueue::Ring::uiSize - 30 - 10 - HEADER, 'c');
+	QVERIFY(! w.push(big.constData(), big.size()));
+
+	QCOMPARE(drainInto(w, packets, ok), 1);
+	QVERIFY(ok);
+	QVERIFY(w.push(big.constData(), big.size()));
+	QCOMPARE(drainInto(w, packets, ok), 1);
+	QVERIFY(ok);
+	QCOMPARE(packets.count(), 3);
+	QVERIFY(packets.at(1) == small);
+	QVERIFY(packets.at(2) == big);
+}
+
+void TestTunnelQueue::order() {
+	TunnelQueue tq(1);
+	Producer p(&tq);
+	p.start();
+
+	unsigned int seq = 0;
+	bool ok = true;
+	char expected[512];
+	while (ok && (seq < PACKETS)) {
+		QBuffer buf;
+		buf.open(QIODevice::WriteOnly);
+		if (tq.drain(&buf) == 0) {
+			QThread::yieldCurrentThread();
+			continue;
+		}
+
+		QList<QByteArray> packets;
+		ok = parse(buf.data(), packets);
+		foreach(const QByteArray &qba, packets) {
+			fillPacket(expected, seq);
+			ok = ok && (static_cast<unsigned int>(qba.size()) == packetLength(seq)) && (memcmp(qba.constData(), expected, qba.size()) == 0);
+			++seq;
+		}
+	}
+
+	// A failed check stops the loop above; keep draining so the producer isn't stuck on a full ring.
+	while (! p.isFinished()) {
+		QBuffer buf;
+		buf.open(QIODevice::WriteOnly);
+		tq.drain(&buf);
+	}
+	p.wait();
+
+	QVERIFY(ok);
+	QCOMPARE(seq, static_cast<unsigned int>(PACKETS));
+}
+
+QTEST_MAIN(TestTunnelQueue)
+#include "TestTunnelQueue.moc"
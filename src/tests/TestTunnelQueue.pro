@@ -0,0 +1,10 @@
+TEMPLATE = app
+CONFIG += qt thread warn_on qtestlib
+CONFIG -= app_bundle
+QT += network sql xml
+LANGUAGE = C++
+TARGET = TestTunnelQueue
+HEADERS = TunnelQueue.h Message.h
+SOURCES = TestTunnelQueue.cpp TunnelQueue.cpp
+VPATH += .. ../murmur
+INCLUDEPATH += .. ../murmur